@@ -0,0 +1,528 @@
+/***************************************************************************
+ *  Title: Resource envelopes
+ * -------------------------------------------------------------------------
+ *    Purpose: Places jobs into cgroup v2 groups with cpu/memory/io limits
+ *    File: cgroup.c
+ ***************************************************************************/
+#define __CGROUP_IMPL__
+
+/************System include***********************************************/
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/************Private include**********************************************/
+#include "cgroup.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define CGROUP_PATHLEN 1024
+/* leaf the shell moves into, its parent may not hold processes once it has controllers */
+#define SHELL_LEAF "tsh.shell"
+/* the controllers enabled for job cgroups, in the order delegate() tries them */
+#define CONTROLLER_CPU    (1 << 0)
+#define CONTROLLER_MEMORY (1 << 1)
+#define CONTROLLER_IO     (1 << 2)
+/* cpu.max period in microseconds */
+#define CPU_PERIOD 100000
+
+/************Global Variables*********************************************/
+
+/* cgroup delegated to the shell, the parent of its leaf and of the job cgroups, "" until looked up */
+static char gShellCgroup[CGROUP_PATHLEN] = "";
+/* controllers are enabled on gShellCgroup, or there are none to enable */
+static bool gDelegated = FALSE;
+/* the shell moved into SHELL_LEAF, CgroupRelease() moves it back */
+static bool gInLeaf = FALSE;
+/* which of them, CONTROLLER_* bits */
+static int gControllers = 0;
+/* the delegation warning is only printed once per shell */
+static bool gWarned = FALSE;
+/* used to give every job cgroup a unique name */
+static int gCgroupCount = 0;
+/* the controllers for job cgroups, CONTROLLER_* bit i is kControllers[i] */
+static char* kControllers[] = { "cpu", "memory", "io" };
+
+/************Function Prototypes******************************************/
+/* finds the cgroup the shell lives in */
+static bool findShellCgroup();
+/* moves the shell into its leaf and enables the controllers for the job cgroups */
+static bool delegate();
+/* moves the shell and its children out of a cgroup into another */
+static void moveProcesses(char* from, char* to);
+/* checks whether a process was started by the shell */
+static bool descendsFromShell(long pid);
+/* checks for a controller in a cgroup.controllers line */
+static bool hasController(char* list, char* name);
+/* writes a string into a cgroup control file */
+static bool writeCgroupFile(char* dir, char* file, char* value);
+/* reads the first line of a cgroup control file */
+static bool readCgroupFile(char* dir, char* file, char* buf, int size);
+/* converts a memory size like 4G into bytes */
+static bool parseSize(char* size, char* buf, int len);
+/* warns once that limits cannot be enforced */
+static void warnUnconfined(char* reason);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+limitT* ParseLimits(int argc, char** argv, int* first)
+{
+  limitT* limits = malloc(sizeof(limitT));
+  int i = 1;
+  limits->cpu = limits->mem = limits->io = NULL;
+
+  //Consume "--flag value" pairs until the command itself starts
+  while (i < argc && strncmp(argv[i], "--", 2) == 0)
+  {
+    if (i + 1 >= argc)
+    {
+      fprintf(stderr, "limit: %s needs a value\n", argv[i]);
+      ReleaseLimits(&limits);
+      return NULL;
+    }
+    if (strcmp(argv[i], "--cpu") == 0)
+    {
+      //A share of the cpus, anything else would end up as a bogus cpu.max
+      char* end;
+      double cpus = strtod(argv[i+1], &end);
+      if (strcmp(argv[i+1], "max") != 0 && (end == argv[i+1] || *end != '\0' || !isfinite(cpus) || cpus <= 0))
+      {
+        fprintf(stderr, "limit: invalid cpu count %s\n", argv[i+1]);
+        ReleaseLimits(&limits);
+        return NULL;
+      }
+      if (limits->cpu != NULL) free(limits->cpu);
+      limits->cpu = strdup(argv[i+1]);
+    }
+    else if (strcmp(argv[i], "--mem") == 0)
+    {
+      //Checked here too, so a bad size stops the command before it runs
+      char bytes[64];
+      if (!parseSize(argv[i+1], bytes, sizeof(bytes)))
+      {
+        fprintf(stderr, "limit: invalid size %s\n", argv[i+1]);
+        ReleaseLimits(&limits);
+        return NULL;
+      }
+      if (limits->mem != NULL) free(limits->mem);
+      limits->mem = strdup(argv[i+1]);
+    }
+    else if (strcmp(argv[i], "--io") == 0)
+      limits->io = strdup(argv[i+1]);
+    else
+    {
+      fprintf(stderr, "limit: unknown flag %s\n", argv[i]);
+      ReleaseLimits(&limits);
+      return NULL;
+    }
+    i += 2;
+  }
+  *first = i;
+  return limits;
+}
+
+void ReleaseLimits(limitT** limits)
+{
+  if ((*limits)->cpu != NULL) free((*limits)->cpu);
+  if ((*limits)->mem != NULL) free((*limits)->mem);
+  if ((*limits)->io != NULL) free((*limits)->io);
+  free(*limits);
+  *limits = NULL;
+}
+
+char* CgroupCreate(limitT* limits)
+{
+  char path[CGROUP_PATHLEN + 64];
+  char value[64];
+
+  if (!findShellCgroup())
+  {
+    warnUnconfined("no cgroup v2 hierarchy");
+    return NULL;
+  }
+
+  if (!delegate())
+    return NULL;
+
+  //A sibling of the shell's leaf, the parent only holds cgroups
+  snprintf(path, sizeof(path), "%s/tsh.%d.%d", gShellCgroup, (int)getpid(), ++gCgroupCount);
+  if (mkdir(path, 0755) == -1)
+  {
+    warnUnconfined(strerror(errno));
+    return NULL;
+  }
+
+  if (limits->cpu != NULL && !(gControllers & CONTROLLER_CPU))
+    fprintf(stderr, "limit: the cpu controller is not delegated to %s, --cpu ignored\n", gShellCgroup);
+  else if (limits->cpu != NULL)
+  {
+    if (strcmp(limits->cpu, "max") == 0)
+      snprintf(value, sizeof(value), "max %d", CPU_PERIOD);
+    else
+      snprintf(value, sizeof(value), "%ld %d", (long)(strtod(limits->cpu, NULL) * CPU_PERIOD), CPU_PERIOD);
+    if (!writeCgroupFile(path, "cpu.max", value))
+      fprintf(stderr, "limit: cpu.max: %s, --cpu ignored\n", strerror(errno));
+  }
+  if (limits->mem != NULL && !(gControllers & CONTROLLER_MEMORY))
+    fprintf(stderr, "limit: the memory controller is not delegated to %s, --mem ignored\n", gShellCgroup);
+  else if (limits->mem != NULL)
+  {
+    if (!parseSize(limits->mem, value, sizeof(value)))
+      fprintf(stderr, "limit: invalid size %s, --mem ignored\n", limits->mem);
+    else if (!writeCgroupFile(path, "memory.max", value))
+      fprintf(stderr, "limit: memory.max: %s, --mem ignored\n", strerror(errno));
+  }
+  if (limits->io != NULL && !(gControllers & CONTROLLER_IO))
+    fprintf(stderr, "limit: the io controller is not delegated to %s, --io ignored\n", gShellCgroup);
+  else if (limits->io != NULL)
+  {
+    if (!writeCgroupFile(path, "io.max", limits->io))
+      fprintf(stderr, "limit: io.max: %s, --io ignored\n", strerror(errno));
+  }
+  return strdup(path);
+}
+
+void CgroupAttach(char* path)
+{
+  //"0" stands for the writing process itself
+  if (!writeCgroupFile(path, "cgroup.procs", "0"))
+    fprintf(stderr, "limit: could not join %s\n", path);
+}
+
+void CgroupRemove(char* path)
+{
+  //Fails harmlessly while the group still holds processes
+  rmdir(path);
+}
+
+bool CgroupPopulated(char* path)
+{
+  char line[64];
+
+  //The first line of cgroup.events is "populated 0" or "populated 1"
+  if (!readCgroupFile(path, "cgroup.events", line, sizeof(line)))
+    return FALSE;
+  return strncmp(line, "populated 1", 11) == 0;
+}
+
+void CgroupKill(char* path)
+{
+  char procs[CGROUP_PATHLEN + 16], line[64];
+  FILE* f;
+
+  if (writeCgroupFile(path, "cgroup.kill", "1"))
+    return;
+  //Kernels before 5.14 have no cgroup.kill, one process at a time then
+  snprintf(procs, sizeof(procs), "%s/cgroup.procs", path);
+  if ((f = fopen(procs, "r")) == NULL)
+    return;
+  while (fgets(line, sizeof(line), f) != NULL)
+    kill(atol(line), SIGKILL);
+  fclose(f);
+}
+
+void CgroupRelease()
+{
+  char leaf[CGROUP_PATHLEN + 64], path[CGROUP_PATHLEN + 80], line[64], disable[16];
+  FILE* f;
+  int i;
+
+  if (!gInLeaf)
+    return;
+  snprintf(leaf, sizeof(leaf), "%s/%s", gShellCgroup, SHELL_LEAF);
+  //Another shell of the same cgroup still lives in the leaf, it keeps it and the controllers
+  snprintf(path, sizeof(path), "%s/cgroup.procs", leaf);
+  if ((f = fopen(path, "r")) == NULL)
+    return;
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (!descendsFromShell(atol(line)))
+    {
+      fclose(f);
+      return;
+    }
+  fclose(f);
+
+  //A cgroup with controllers for its children cannot take the shell back
+  for (i = 0; i < sizeof(kControllers) / sizeof(kControllers[0]); i++)
+    if (gControllers & (1 << i))
+    {
+      snprintf(disable, sizeof(disable), "-%s", kControllers[i]);
+      writeCgroupFile(gShellCgroup, "cgroup.subtree_control", disable);
+    }
+  moveProcesses(leaf, gShellCgroup);
+  rmdir(leaf);
+  gInLeaf = gDelegated = FALSE;
+  gControllers = 0;
+}
+
+void CgroupUsage(char* path, char* buf, int size)
+{
+  char line[128];
+  long long mem = -1, usec = -1;
+  FILE* f;
+
+  if (readCgroupFile(path, "memory.current", line, sizeof(line)))
+    mem = atoll(line);
+
+  snprintf(line, sizeof(line), "%s/cpu.stat", path);
+  f = fopen(line, "r");
+  if (f != NULL)
+  {
+    while (fgets(line, sizeof(line), f) != NULL)
+      if (strncmp(line, "usage_usec ", 11) == 0)
+        usec = atoll(line + 11);
+    fclose(f);
+  }
+
+  buf[0] = '\0';
+  if (mem >= 0 && usec >= 0)
+    snprintf(buf, size, "mem=%.1fM cpu=%.2fs", mem / 1048576.0, usec / 1000000.0);
+  else if (mem >= 0)
+    snprintf(buf, size, "mem=%.1fM", mem / 1048576.0);
+  else if (usec >= 0)
+    snprintf(buf, size, "cpu=%.2fs", usec / 1000000.0);
+}
+
+//////////////////////////////////////////////////////////////
+//  Support Functions
+//////////////////////////////////////////////////////////////
+
+//Finds the cgroup v2 mount point and the shell's place in it
+static bool findShellCgroup()
+{
+  char line[CGROUP_PATHLEN];
+  char mount[CGROUP_PATHLEN] = "";
+  char dev[64], dir[CGROUP_PATHLEN], type[64];
+  FILE* f;
+
+  if (gShellCgroup[0] != '\0')
+    return TRUE;
+
+  //Look for the unified hierarchy, it is not always at /sys/fs/cgroup
+  f = fopen("/proc/self/mounts", "r");
+  if (f == NULL)
+    return FALSE;
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    if (sscanf(line, "%63s %1023s %63s", dev, dir, type) == 3 && strcmp(type, "cgroup2") == 0)
+    {
+      strcpy(mount, dir);
+      break;
+    }
+  }
+  fclose(f);
+  if (mount[0] == '\0')
+    return FALSE;
+
+  //The v2 entry is the one with hierarchy id 0 and no controller list
+  f = fopen("/proc/self/cgroup", "r");
+  if (f == NULL)
+    return FALSE;
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    if (strncmp(line, "0::", 3) == 0)
+    {
+      line[strcspn(line, "\n")] = '\0';
+      //The root cgroup is "/", avoid a double slash
+      snprintf(gShellCgroup, sizeof(gShellCgroup), "%s%s", mount, strcmp(line + 3, "/") == 0 ? "" : line + 3);
+      break;
+    }
+  }
+  fclose(f);
+  //A shell started by another one is already in the leaf, the cgroup to use is its parent
+  if (strlen(gShellCgroup) > strlen(SHELL_LEAF) + 1 &&
+      strcmp(gShellCgroup + strlen(gShellCgroup) - strlen(SHELL_LEAF) - 1, "/" SHELL_LEAF) == 0)
+    gShellCgroup[strlen(gShellCgroup) - strlen(SHELL_LEAF) - 1] = '\0';
+  return gShellCgroup[0] != '\0';
+}
+
+//cgroup v2 lets a cgroup with controllers for its children hold no processes of its own,
+//so the shell leaves gShellCgroup for a leaf first, then the controllers are enabled
+static bool delegate()
+{
+  char leaf[CGROUP_PATHLEN + 64], reason[CGROUP_PATHLEN + 128], controllers[256];
+  int i, available = 0;
+
+  if (gDelegated)
+    return TRUE;
+  //The controllers have to be available here first, the parent of gShellCgroup hands them down;
+  //the ones left out are reported by the limits that need them
+  if (!readCgroupFile(gShellCgroup, "cgroup.controllers", controllers, sizeof(controllers)))
+    controllers[0] = '\0';
+  for (i = 0; i < sizeof(kControllers) / sizeof(kControllers[0]); i++)
+    if (hasController(controllers, kControllers[i]))
+      available |= 1 << i;
+  //Nothing to enable, the job cgroups can live next to the shell where it is
+  if (available == 0)
+  {
+    gDelegated = TRUE;
+    return TRUE;
+  }
+
+  snprintf(leaf, sizeof(leaf), "%s/%s", gShellCgroup, SHELL_LEAF);
+  if (mkdir(leaf, 0755) == -1 && errno != EEXIST)
+  {
+    snprintf(reason, sizeof(reason), "cannot create %s: %s", leaf, strerror(errno));
+    warnUnconfined(reason);
+    return FALSE;
+  }
+  moveProcesses(gShellCgroup, leaf);
+  gInLeaf = TRUE;
+
+  for (i = 0; i < sizeof(kControllers) / sizeof(kControllers[0]); i++)
+  {
+    char enable[16];
+    if (!(available & (1 << i)))
+      continue;
+    snprintf(enable, sizeof(enable), "+%s", kControllers[i]);
+    if (writeCgroupFile(gShellCgroup, "cgroup.subtree_control", enable))
+    {
+      gControllers |= 1 << i;
+      continue;
+    }
+    if (errno == EBUSY)
+      snprintf(reason, sizeof(reason), "%s holds processes that are not the shell's", gShellCgroup);
+    else
+      snprintf(reason, sizeof(reason), "cannot enable controllers in %s: %s", gShellCgroup, strerror(errno));
+    warnUnconfined(reason);
+    return FALSE;
+  }
+  gDelegated = TRUE;
+  return TRUE;
+}
+
+static void moveProcesses(char* from, char* to)
+{
+  char path[CGROUP_PATHLEN + 64], line[64], pid[32];
+  FILE* f;
+
+  //The shell first, then what it started: the spawn server and the jobs running so far
+  snprintf(pid, sizeof(pid), "%d", (int)getpid());
+  writeCgroupFile(to, "cgroup.procs", pid);
+  snprintf(path, sizeof(path), "%s/cgroup.procs", from);
+  if ((f = fopen(path, "r")) == NULL)
+    return;
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    line[strcspn(line, "\n")] = '\0';
+    if (descendsFromShell(atol(line)))
+      writeCgroupFile(to, "cgroup.procs", line);
+  }
+  fclose(f);
+}
+
+//Follows the parents of a process up to the shell or to init
+static bool descendsFromShell(long pid)
+{
+  char path[64], line[512];
+  char* paren;
+  FILE* stat;
+
+  while (pid > 1 && pid != getpid())
+  {
+    snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+    if ((stat = fopen(path, "r")) == NULL)
+      return FALSE;
+    //The name in parentheses may hold spaces, the parent pid is the second field after it
+    if (fgets(line, sizeof(line), stat) == NULL || (paren = strrchr(line, ')')) == NULL ||
+        sscanf(paren + 1, " %*c %ld", &pid) != 1)
+      pid = 0;
+    fclose(stat);
+  }
+  return pid == getpid();
+}
+
+//Whole words only, "cpu" must not match "cpuset"
+static bool hasController(char* list, char* name)
+{
+  size_t len = strlen(name);
+  char* at;
+
+  for (at = strstr(list, name); at != NULL; at = strstr(at + 1, name))
+    if ((at == list || at[-1] == ' ') && (at[len] == ' ' || at[len] == '\n' || at[len] == '\0'))
+      return TRUE;
+  return FALSE;
+}
+
+static bool writeCgroupFile(char* dir, char* file, char* value)
+{
+  char path[CGROUP_PATHLEN + 64];
+  int fd, len = strlen(value);
+  bool ok;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, file);
+  fd = open(path, O_WRONLY);
+  if (fd == -1)
+    return FALSE;
+  ok = (write(fd, value, len) == len);
+  close(fd);
+  return ok;
+}
+
+static bool readCgroupFile(char* dir, char* file, char* buf, int size)
+{
+  char path[CGROUP_PATHLEN + 64];
+  int fd, n;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, file);
+  fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return FALSE;
+  n = read(fd, buf, size - 1);
+  close(fd);
+  if (n <= 0)
+    return FALSE;
+  buf[n] = '\0';
+  return TRUE;
+}
+
+static bool parseSize(char* size, char* buf, int len)
+{
+  char* end;
+  unsigned long long bytes;
+
+  if (strcmp(size, "max") == 0)
+  {
+    snprintf(buf, len, "max");
+    return TRUE;
+  }
+  //strtoull() takes a sign, and a unit on its own would be 0 bytes
+  if (size[0] < '0' || size[0] > '9')
+    return FALSE;
+  bytes = strtoull(size, &end, 10);
+  switch (*end)
+  {
+    case 'T': case 't': bytes <<= 10;
+    case 'G': case 'g': bytes <<= 10;
+    case 'M': case 'm': bytes <<= 10;
+    case 'K': case 'k': bytes <<= 10; end++;
+    case '\0': break;
+    default: return FALSE;
+  }
+  if (*end != '\0')
+    return FALSE;
+  snprintf(buf, len, "%llu", bytes);
+  return TRUE;
+}
+
+static void warnUnconfined(char* reason)
+{
+  if (gWarned)
+    return;
+  gWarned = TRUE;
+  fprintf(stderr, "limit: cgroup delegation unavailable (%s), running without limits\n", reason);
+}
@@ -0,0 +1,138 @@
+/***************************************************************************
+ *  Title: Resource envelopes
+ * -------------------------------------------------------------------------
+ *    Purpose: Places jobs into cgroup v2 groups with cpu/memory/io limits
+ *    File: cgroup.h
+ ***************************************************************************/
+
+#ifndef __CGROUP_H__
+#define __CGROUP_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __CGROUP_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+typedef struct limit_t
+{
+  char *cpu;  /* number of cpus, e.g. "2" or "0.5" */
+  char *mem;  /* memory ceiling, e.g. "4G" or "max" */
+  char *io;   /* raw io.max line, e.g. "8:0 rbps=1048576" */
+} limitT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Parse limit flags
+ * ---------------------------------------------------------------------
+ *    Purpose: Parses the --cpu/--mem/--io flags of the limit builtin.
+ *    --cpu has to be a number of cpus above 0 or "max".
+ *    Input: argc/argv of the builtin and a pointer to the index of
+ *    the first argument that is not a flag
+ *    Output: a limit structure, NULL on a malformed flag
+ ***********************************************************************/
+EXTERN limitT* ParseLimits(int, char**, int*);
+
+/***********************************************************************
+ *  Title: Release a limit structure
+ * ---------------------------------------------------------------------
+ *    Purpose: Frees the allocated memory of a limit structure.
+ *    Input: the limit structure
+ *    Output: void
+ ***********************************************************************/
+EXTERN void ReleaseLimits(limitT**);
+
+/***********************************************************************
+ *  Title: Create a cgroup for a job
+ * ---------------------------------------------------------------------
+ *    Purpose: Creates a cgroup below the one delegated to the shell,
+ *    next to the leaf the shell moves itself into the first time, and
+ *    writes the requested limits into it. Prints why and returns NULL
+ *    when cgroup v2 delegation is not available.
+ *    Input: the limits
+ *    Output: the path of the new cgroup (malloc'd) or NULL
+ ***********************************************************************/
+EXTERN char* CgroupCreate(limitT*);
+
+/***********************************************************************
+ *  Title: Move the calling process into a cgroup
+ * ---------------------------------------------------------------------
+ *    Purpose: Called in the child between fork and exec.
+ *    Input: the cgroup path
+ *    Output: void
+ ***********************************************************************/
+EXTERN void CgroupAttach(char*);
+
+/***********************************************************************
+ *  Title: Remove a job cgroup
+ * ---------------------------------------------------------------------
+ *    Purpose: Removes the (empty) cgroup of a finished job.
+ *    Input: the cgroup path
+ *    Output: void
+ ***********************************************************************/
+EXTERN void CgroupRemove(char*);
+
+/***********************************************************************
+ *  Title: Check a job cgroup for processes
+ * ---------------------------------------------------------------------
+ *    Purpose: Reads cgroup.events; a populated cgroup cannot be removed.
+ *    Input: the cgroup path
+ *    Output: true while processes are left in it
+ ***********************************************************************/
+EXTERN bool CgroupPopulated(char*);
+
+/***********************************************************************
+ *  Title: Kill what is left in a job cgroup
+ * ---------------------------------------------------------------------
+ *    Purpose: SIGKILLs every process in the cgroup, through cgroup.kill
+ *    where the kernel has it.
+ *    Input: the cgroup path
+ *    Output: void
+ ***********************************************************************/
+EXTERN void CgroupKill(char*);
+
+/***********************************************************************
+ *  Title: Leave the shell's leaf cgroup
+ * ---------------------------------------------------------------------
+ *    Purpose: Moves the shell back out of the leaf the first limit
+ *    moved it into, turns the controllers off again and removes the
+ *    leaf, unless another shell still lives in it. Called at exit,
+ *    after the job cgroups are gone.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void CgroupRelease();
+
+/***********************************************************************
+ *  Title: Format live cgroup usage
+ * ---------------------------------------------------------------------
+ *    Purpose: Reads memory.current and cpu.stat of a job cgroup.
+ *    Input: the cgroup path, an output buffer and its size
+ *    Output: void
+ ***********************************************************************/
+EXTERN void CgroupUsage(char*, char*, int);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __CGROUP_H__ */
@@ -0,0 +1,239 @@
+/***************************************************************************
+ *  Title: Compressed output
+ * -------------------------------------------------------------------------
+ *    Purpose: Redirections to .gz, .zst and .xz files through a compressor
+ *    File: compress.c
+ ***************************************************************************/
+#define __COMPRESS_IMPL__
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "compress.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define COMPRESS_GZ  0
+#define COMPRESS_ZST 1
+#define COMPRESS_XZ  2
+
+static const char* kSuffixes[] = { ".gz", ".zst", ".xz" };
+
+/************Global Variables*********************************************/
+
+/* -N for the compressor, 0 for its default */
+static int gLevel = 0;
+/* threads the compressor may use, 0 for one per core */
+static int gThreads = 1;
+
+/************Function Prototypes******************************************/
+static int compressorOf(char*);
+static void runCompressor(int);
+static void waitFor(pid_t, int*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+bool CompressedFile(char* file)
+{
+  return compressorOf(file) != -1;
+}
+
+void CompressOutput(char* file)
+{
+  pid_t program, compressor;
+  int fd, status, compressorStatus;
+
+  //The handlers of the shell must not run here, and ctrl-c is for the program alone
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+  signal(SIGINT, SIG_IGN);
+  if ((compressor = CompressPipe(file, &fd)) == -1)
+    _exit(1);
+  if ((program = fork()) == 0)
+  {
+    signal(SIGINT, SIG_DFL);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    return;
+  }
+  if (program == -1)
+  {
+    perror("tsh: fork");
+    _exit(1);
+  }
+  close(fd);
+
+  //The compressor sees the end of its input once the program is gone
+  waitFor(program, &status);
+  waitFor(compressor, &compressorStatus);
+  //A program that lost its reader to a compressor that failed did not fail by itself
+  if (WIFSIGNALED(status) && WTERMSIG(status) == SIGPIPE && WIFEXITED(compressorStatus) &&
+      WEXITSTATUS(compressorStatus) != 0)
+    status = 0;
+  //Killed is reported as killed, by the same signal
+  if (WIFSIGNALED(status))
+  {
+    signal(WTERMSIG(status), SIG_DFL);
+    kill(getpid(), WTERMSIG(status));
+  }
+  //A file that could not be written fails a job that succeeded, with the status of the compressor
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+      !(WIFEXITED(compressorStatus) && WEXITSTATUS(compressorStatus) == 0))
+    _exit(WIFEXITED(compressorStatus) ? WEXITSTATUS(compressorStatus) : 1);
+  _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
+
+pid_t CompressPipe(char* file, int* fd)
+{
+  pid_t compressor;
+  int fds[2], out;
+
+  //Close on exec, or other compressors of the same job keep it open
+  if (pipe2(fds, O_CLOEXEC) == -1)
+  {
+    perror("tsh: pipe");
+    return -1;
+  }
+  if ((compressor = fork()) == -1)
+  {
+    perror("tsh: fork");
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  if (compressor == 0)
+  {
+    if ((out = open(file, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR)) == -1)
+    {
+      fprintf(stderr, "%s: %s\n", file, strerror(errno));
+      _exit(1);
+    }
+    dup2(fds[0], STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    close(out);
+    close(fds[0]);
+    close(fds[1]);
+    runCompressor(compressorOf(file));
+  }
+  close(fds[0]);
+  *fd = fds[1];
+  return compressor;
+}
+
+int CompressConfigure(int argc, char** argv)
+{
+  int i, level = gLevel, threads = gThreads;
+  char* end;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--level") == 0 && i + 1 < argc)
+    {
+      level = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || level < 0 || level > 19)
+        break;
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      threads = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || threads < 0)
+        break;
+    }
+    else
+      break;
+  }
+  if (i < argc)
+  {
+    fprintf(stderr, "usage: compression [--level 0-19] [--threads N]\n");
+    return 1;
+  }
+  gLevel = level;
+  gThreads = threads;
+  if (argc == 1)
+  {
+    OutPrintf("level %d%s\n", gLevel, gLevel == 0 ? " (the compressor's default)" : "");
+    OutPrintf("threads %d%s\n", gThreads, gThreads == 0 ? " (one per core)" : "");
+  }
+  return 0;
+}
+
+/*The compressor for a file, -1 if it is not compressed*/
+static int compressorOf(char* file)
+{
+  size_t len = strlen(file), n;
+  int i;
+
+  for (i = 0; i < sizeof(kSuffixes) / sizeof(kSuffixes[0]); i++)
+  {
+    n = strlen(kSuffixes[i]);
+    if (len > n && strcmp(file + len - n, kSuffixes[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
+/*Exec the compressor, from stdin to stdout*/
+static void runCompressor(int type)
+{
+  char level[16], threads[16];
+  char* argv[8];
+  int n = 0;
+
+  snprintf(level, sizeof(level), "-%d", gLevel);
+  if (type == COMPRESS_GZ && gThreads != 1)
+  {
+    //pigz is gzip with threads, where it is installed
+    argv[n++] = "pigz";
+    argv[n++] = "-c";
+    if (gThreads > 0)
+    {
+      snprintf(threads, sizeof(threads), "-p%d", gThreads);
+      argv[n++] = threads;
+    }
+    if (gLevel > 0)
+      argv[n++] = level;
+    argv[n] = NULL;
+    execvp(argv[0], argv);
+    n = 0;
+  }
+  snprintf(threads, sizeof(threads), "-T%d", gThreads);
+  argv[n++] = type == COMPRESS_GZ ? "gzip" : type == COMPRESS_ZST ? "zstd" : "xz";
+  argv[n++] = "-c";
+  if (type == COMPRESS_ZST)
+    argv[n++] = "-q";
+  if (type != COMPRESS_GZ)
+    argv[n++] = threads;
+  if (gLevel > 0)
+    argv[n++] = level;
+  argv[n] = NULL;
+  execvp(argv[0], argv);
+  fprintf(stderr, "%s: command not found\n", argv[0]);
+  _exit(127);
+}
+
+static void waitFor(pid_t pid, int* status)
+{
+  pid_t got;
+
+  while ((got = waitpid(pid, status, 0)) == -1 && errno == EINTR);
+  if (got == -1)
+    *status = 0;
+}
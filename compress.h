@@ -0,0 +1,89 @@
+/***************************************************************************
+ *  Title: Compressed output
+ * -------------------------------------------------------------------------
+ *    Purpose: Redirections to .gz, .zst and .xz files through a compressor
+ *    File: compress.h
+ ***************************************************************************/
+
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <sys/types.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __COMPRESS_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Checks for a compressed redirection
+ * ---------------------------------------------------------------------
+ *    Purpose: Checks whether output redirected to a file goes through
+ *    a compressor: gzip (pigz with more than one thread) for .gz,
+ *    zstd for .zst and xz for .xz
+ *    Input: the file name
+ *    Output: true if it does
+ ***********************************************************************/
+EXTERN bool CompressedFile(char*);
+
+/***********************************************************************
+ *  Title: Compress the output of a job
+ * ---------------------------------------------------------------------
+ *    Purpose: Called in the child of Exec() right before it runs the
+ *    program. Returns in a new process whose stdout is a pipe to the
+ *    compressor writing the file. The calling process, the one the
+ *    shell knows as the job, never returns: it waits for the program
+ *    and the compressor, so that the job is done only once the file
+ *    is complete, and exits the way the program did. It ignores
+ *    ctrl-c, so that an interrupted job still leaves a valid file.
+ *    Input: the file
+ *    Output: void
+ ***********************************************************************/
+EXTERN void CompressOutput(char*);
+
+/***********************************************************************
+ *  Title: Start a compressor
+ * ---------------------------------------------------------------------
+ *    Purpose: Starts the compressor for a file, reading from a pipe
+ *    Input: the file and where the write end of the pipe goes
+ *    Output: the pid of the compressor, -1 if it could not be started
+ ***********************************************************************/
+EXTERN pid_t CompressPipe(char*, int*);
+
+/***********************************************************************
+ *  Title: Configure compression
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "compression [--level N] [--threads N]": the
+ *    level passed to the compressors (0 for their default) and the
+ *    threads they may use (0 for one per core). Shows the settings
+ *    without arguments.
+ *    Input: argc/argv of the builtin
+ *    Output: the exit status
+ ***********************************************************************/
+EXTERN int CompressConfigure(int, char**);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __COMPRESS_H__ */
@@ -0,0 +1,274 @@
+/***************************************************************************
+ *  Title: Output fan-out
+ * -------------------------------------------------------------------------
+ *    Purpose: cmd > a > b, the output of a job copied to several files
+ *    File: fanout.c
+ ***************************************************************************/
+#define __FANOUT_IMPL__
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "fanout.h"
+#include "compress.h"
+#include "runtime.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* pipe size asked for, fewer round trips between the program and the relay */
+#define FANOUT_PIPE (1 << 20)
+
+/* one file the output goes to */
+typedef struct fanout_target_t
+{
+  int fd;             /* -1 once writing to it failed */
+  pid_t compressor;   /* what fd goes to for a compressed file, 0 for none */
+  bool copy;          /* splice() does not work on it, read() and write() do */
+  bool failed;        /* writing to it failed */
+} fanoutTargetT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+static void relay(int, fanoutTargetT*, int);
+static ssize_t moveData(int, fanoutTargetT*, size_t, int);
+static void dropTarget(fanoutTargetT*);
+static bool writeAll(int, char*, size_t);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void FanOutput(char** files)
+{
+  fanoutTargetT* targets;
+  pid_t program;
+  int fds[2], i, n, status, compressorStatus;
+  bool failed = FALSE;
+
+  //The handlers of the shell must not run here, and ctrl-c is for the program alone
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+  signal(SIGINT, SIG_IGN);
+  //A file that went away is given up on, not a reason to stop
+  signal(SIGPIPE, SIG_IGN);
+
+  for (n = 0; files[n] != NULL; n++);
+  targets = calloc(n, sizeof(fanoutTargetT));
+  for (i = 0; i < n; i++)
+  {
+    if (CompressedFile(files[i]))
+      targets[i].compressor = CompressPipe(files[i], &targets[i].fd);
+    else
+      targets[i].fd = OpenRedirect(files[i], O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC);
+    //Like a redirection that fails, the program does not run at all
+    if (targets[i].fd == -1 || targets[i].compressor == -1)
+    {
+      if (targets[i].fd == -1 && targets[i].compressor != -1)
+        fprintf(stderr, "%s: %s\n", files[i], strerror(errno));
+      _exit(1);
+    }
+  }
+
+  if (pipe2(fds, O_CLOEXEC) == -1)
+  {
+    perror("tsh: pipe");
+    _exit(1);
+  }
+  fcntl(fds[1], F_SETPIPE_SZ, FANOUT_PIPE);
+  if ((program = fork()) == 0)
+  {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    dup2(fds[1], STDOUT_FILENO);
+    //A builtin does not exec, the files must not stay open in it
+    for (i = 0; i < n; i++)
+      close(targets[i].fd);
+    close(fds[0]);
+    close(fds[1]);
+    free(targets);
+    return;
+  }
+  if (program == -1)
+  {
+    perror("tsh: fork");
+    _exit(1);
+  }
+  close(fds[1]);
+
+  //Until the program closes its end, and whatever it left in the pipe is out
+  relay(fds[0], targets, n);
+  close(fds[0]);
+  for (i = 0; i < n; i++)
+  {
+    if (targets[i].fd != -1)
+      close(targets[i].fd);
+    failed = failed || targets[i].failed;
+  }
+  for (i = 0; i < n; i++)
+    if (targets[i].compressor > 0)
+    {
+      while (waitpid(targets[i].compressor, &compressorStatus, 0) == -1 && errno == EINTR);
+      if (!WIFEXITED(compressorStatus) || WEXITSTATUS(compressorStatus) != 0)
+        failed = TRUE;
+    }
+  while (waitpid(program, &status, 0) == -1 && errno == EINTR);
+
+  //Killed is reported as killed, by the same signal
+  if (WIFSIGNALED(status))
+  {
+    signal(WTERMSIG(status), SIG_DFL);
+    kill(getpid(), WTERMSIG(status));
+  }
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && failed)
+    _exit(1);
+  _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
+
+/*Copy what arrives on the pipe to every target: tee() duplicates it into a
+  second pipe for all but the last, which gets it spliced from the pipe itself*/
+static void relay(int in, fanoutTargetT* targets, int n)
+{
+  int mid[2], devnull, i, size;
+  ssize_t len, got;
+
+  devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (pipe2(mid, O_CLOEXEC) == -1)
+    mid[0] = mid[1] = -1;
+  //tee() only duplicates what fits, the second pipe takes as much as the first
+  size = fcntl(in, F_GETPIPE_SZ);
+  if (size <= 0)
+    size = 65536;
+  if (mid[1] != -1)
+    fcntl(mid[1], F_SETPIPE_SZ, size);
+
+  for (;;)
+  {
+    //How much this round moves, known from the first tee() or the final splice()
+    len = -1;
+    for (i = 0; i < n - 1; i++)
+    {
+      if (targets[i].fd == -1)
+        continue;
+      got = mid[1] == -1 ? -1 : tee(in, mid[1], len == -1 ? size : len, 0);
+      if (got == -1 && errno == EINTR)
+      {
+        i--;
+        continue;
+      }
+      if (got == -1)
+      {
+        dropTarget(&targets[i]);
+        continue;
+      }
+      //The program is gone and the pipe is empty
+      if (got == 0)
+        goto done;
+      if (len == -1)
+        len = got;
+      if (moveData(mid[0], &targets[i], got, devnull) != got)
+        goto done;
+    }
+    //The last target, or /dev/null when it failed, takes the data out of the pipe
+    if (targets[n - 1].fd == -1)
+    {
+      fanoutTargetT sink = { devnull, 0, FALSE, FALSE };
+      got = moveData(in, &sink, len == -1 ? size : len, devnull);
+    }
+    else
+      got = moveData(in, &targets[n - 1], len == -1 ? size : len, devnull);
+    if (got <= 0 || (len != -1 && got != len))
+      break;
+  }
+done:
+  if (mid[0] != -1)
+  {
+    close(mid[0]);
+    close(mid[1]);
+  }
+  if (devnull != -1)
+    close(devnull);
+}
+
+/*Move len bytes out of a pipe to a target, or up to len when it is not known
+  how much is there. A target that fails is given up on and the rest thrown
+  away, so the pipes stay in step. Returns the bytes taken out, 0 at its end*/
+static ssize_t moveData(int from, fanoutTargetT* target, size_t len, int devnull)
+{
+  char buf[65536];
+  ssize_t n, moved = 0;
+
+  while (len > 0)
+  {
+    if (target->fd == -1)
+      n = splice(from, NULL, devnull, NULL, len, SPLICE_F_MOVE);
+    else if (!target->copy)
+    {
+      n = splice(from, NULL, target->fd, NULL, len, SPLICE_F_MOVE);
+      //Not every file takes splice(), those are written the usual way
+      if (n == -1 && errno == EINVAL)
+      {
+        target->copy = TRUE;
+        continue;
+      }
+    }
+    else
+    {
+      n = read(from, buf, len < sizeof(buf) ? len : sizeof(buf));
+      if (n > 0 && !writeAll(target->fd, buf, n))
+        dropTarget(target);
+    }
+    if (n == -1 && errno == EINTR)
+      continue;
+    //Writing failed, what is left of this round goes to /dev/null
+    if (n == -1 && target->fd != -1)
+    {
+      dropTarget(target);
+      continue;
+    }
+    if (n <= 0)
+      break;
+    moved += n;
+    len -= n;
+  }
+  return moved;
+}
+
+/*Give up on a target, its compressor sees the end of its input*/
+static void dropTarget(fanoutTargetT* target)
+{
+  close(target->fd);
+  target->fd = -1;
+  target->failed = TRUE;
+}
+
+static bool writeAll(int fd, char* buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+  {
+    if ((n = write(fd, buf, len)) == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return FALSE;
+    buf += n;
+    len -= n;
+  }
+  return TRUE;
+}
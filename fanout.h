@@ -0,0 +1,58 @@
+/***************************************************************************
+ *  Title: Output fan-out
+ * -------------------------------------------------------------------------
+ *    Purpose: cmd > a > b, the output of a job copied to several files
+ *    File: fanout.h
+ ***************************************************************************/
+
+#ifndef __FANOUT_H__
+#define __FANOUT_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __FANOUT_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Fan the output of a job out to several files
+ * ---------------------------------------------------------------------
+ *    Purpose: Called in the child of Exec() right before it runs the
+ *    program, like CompressOutput(). Opens the files, compressed ones
+ *    through their compressor, and returns in a new process whose
+ *    stdout is a pipe. The calling process stays the job: it relays
+ *    the pipe to every file with tee(2) and splice(2), so the data is
+ *    never copied through user space, then waits for the program and
+ *    exits the way it did. A file that cannot be written to is given
+ *    up on, the others still get everything; the job then fails if
+ *    the program did not.
+ *    Input: the files, NULL terminated, at least two
+ *    Output: void
+ ***********************************************************************/
+EXTERN void FanOutput(char**);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __FANOUT_H__ */
@@ -22,6 +22,8 @@
 
 /************System include***********************************************/
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -30,6 +32,8 @@
 #include "interpreter.h"
 #include "io.h"
 #include "runtime.h"
+#include "probes.h"
+#include "compress.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -42,6 +46,95 @@ typedef struct string_l {
   struct string_l* next;
 } stringL;
 
+/* keywords of compound commands, in the order of the keywords table */
+#define KW_NONE  0
+#define KW_IF    1
+#define KW_THEN  2
+#define KW_ELIF  3
+#define KW_ELSE  4
+#define KW_FI    5
+#define KW_WHILE 6
+#define KW_DO    7
+#define KW_DONE  8
+#define KW_FOR    9
+#define KW_LBRACE 10
+#define KW_RBRACE 11
+#define KW_LPAREN 12
+#define KW_RPAREN 13
+#define KW_AND    14
+#define KW_OR     15
+#define KW(x) (1 << (x))
+
+static const char* keywords[] = { NULL, "if", "then", "elif", "else", "fi", "while", "do", "done", "for",
+                                  "{", "}", "(", ")", "&&", "||" };
+
+/* a simple command or a keyword of a compound command */
+typedef struct token_t {
+  int kw;
+  char* text;  /* the simple command, the header of a for loop or what follows the end of a group */
+} tokenT;
+
+typedef struct token_list_t {
+  tokenT* t;
+  int n, size;
+} tokenListT;
+
+/* node types of a command tree */
+#define NODE_SIMPLE   1
+#define NODE_ASSIGN   2
+#define NODE_IF       3
+#define NODE_WHILE    4
+#define NODE_FOR      5
+#define NODE_BREAK    6
+#define NODE_CONTINUE 7
+#define NODE_EXIT     8
+#define NODE_GROUP    9
+#define NODE_SUBSHELL 10
+#define NODE_AND      11
+#define NODE_OR       12
+
+/* pending break or continue */
+#define LOOP_BREAK    1
+#define LOOP_CONTINUE 2
+
+typedef struct node_t {
+  int type;
+  char* text;            /* SIMPLE, GROUP, SUBSHELL: the command line, ASSIGN/FOR: the variable */
+  commandT** cmds;       /* SIMPLE: parsed once, NULL if it needs Interpret() */
+  int ncmds;
+  bool vars;             /* words refer to variables */
+  char** words;          /* FOR: the words to loop over, ASSIGN: the value */
+  int nwords;
+  struct node_t *cond;   /* IF, WHILE: the condition, AND, OR: the command on the left */
+  struct node_t *body;   /* IF: then part, WHILE, FOR: loop body, GROUP, SUBSHELL: the list,
+                            AND, OR: the command run depending on how the left one ended */
+  struct node_t *alt;    /* IF: else part, an elif is an IF here */
+  struct node_t *next;   /* next command of the same list */
+  char* in;              /* GROUP, SUBSHELL: redirections of the whole list, NULL for none */
+  char* out;
+  bool bg;               /* GROUP, SUBSHELL: run as a background job */
+} nodeT;
+
+/************Global Variables*********************************************/
+
+/* break or continue waiting to be handled by the innermost loop */
+static int gLoopCtl = 0;
+/* number of loops being run */
+static int gLoopDepth = 0;
+
+/************Function Prototypes******************************************/
+static char* expandVars(char*);
+static char* assignValue(char*, int*);
+static bool ambiguousRedirect(char*);
+static bool ambiguousCmds(commandT**, int);
+static void tokenize(char*, tokenListT*);
+static void freeTokens(tokenListT*);
+static nodeT* parseList(tokenListT*, int*, int);
+static void freeTree(nodeT*);
+static void runList(nodeT*);
+static void runNode(nodeT*);
+static void RunCompound(char*);
+
 /*Parse a single word from the param. Get rid of '"' or '''*/
 char* single_param(char *st)
 {
@@ -71,10 +164,12 @@ char* single_param(char *st)
 /*Parse the single command and call single_param to parse each word in the command*/
 void parser_single(char *c, int sz, commandT** cd, int bg)
 {
-  int i, task_argc = 0, quot1 = 0, quot2 = 0;
-  char *in = NULL, * out = NULL, *tmp;
+  int i, task_argc = 0, quot1 = 0, quot2 = 0, nout = 0;
+  char *in = NULL, **out, *tmp;
   int cmd_length;
   c[sz] = '\0';
+  //Every > target, cmd > a > b writes to all of them
+  out = malloc(sizeof(char*) * (sz + 1));
   for(i = 0; i < sz; i++)
     if(c[i] != ' ') break;
   c = &(c[i]);
@@ -103,7 +198,7 @@ void parser_single(char *c, int sz, commandT** cd, int bg)
     if(c[i] == '>' && quot1 != 1 && quot2 != 1){
       if(cmd_length == sz) cmd_length = i;
       while(i < (sz - 1) && c[i+1] == ' ') i++;
-      out = &(c[i+1]);
+      out[nout++] = &(c[i+1]);
     }
     if(c[i] == ' ' && quot1 != 1 && quot2 != 1){
       if(cmd_length == sz) task_argc++;
@@ -125,10 +220,17 @@ void parser_single(char *c, int sz, commandT** cd, int bg)
     (*cd) -> is_redirect_in = 1;
     (*cd) -> redirect_in = strdup(single_param(in));
   }
-  if(out){
+  if(nout > 0){
     (*cd) -> is_redirect_out = 1;
-    (*cd) -> redirect_out = strdup(single_param(out));
+    (*cd) -> redirect_out = strdup(single_param(out[0]));
   }
+  if(nout > 1){
+    (*cd) -> redirect_tee = malloc(sizeof(char*) * nout);
+    for(i = 1; i < nout; i++)
+      (*cd) -> redirect_tee[i - 1] = strdup(single_param(out[i]));
+    (*cd) -> redirect_tee[nout - 1] = NULL;
+  }
+  free(out);
 }
 
 
@@ -136,14 +238,13 @@ void parser_single(char *c, int sz, commandT** cd, int bg)
 
 /**************Implementation***********************************************/
 /*Parse the whole command line and split commands if a piped command is sent.*/
-//bool secondRun stops the interpreter from recursing more than 1 level into itself
-void Interpret(char* cmdLine,bool secondRun)
+commandT** ParseCmdLine(char* cmdLine, int* n)
 {
   int task = 1;
   int bg = 0, i,k,j = 0, quotation1 = 0, quotation2 = 0;
   commandT **command;
 
-  if(cmdLine[0] == '\0') return;
+  if(cmdLine[0] == '\0') return NULL;
 
   for(i = 0; i < strlen(cmdLine); i++){
     if(cmdLine[i] == '\''){
@@ -170,7 +271,10 @@ void Interpret(char* cmdLine,bool secondRun)
   i = strlen(cmdLine) - 1;
   while(i >= 0 && cmdLine[i] == ' ') i--;
   if(cmdLine[i] == '&'){
-    if(i == 0) return;
+    if(i == 0){
+      free(command);
+      return NULL;
+    }
     bg = 1;
     cmdLine[i] = '\0';
   }
@@ -200,6 +304,95 @@ void Interpret(char* cmdLine,bool secondRun)
     }
   }
   parser_single(&(cmdLine[i-j]), j, &(command[task]),bg);
+  *n = task + 1;
+  return command;
+}
+
+/*Check whether Interpret would rewrite the first command through tilde or alias expansion*/
+static bool needsAliasOrTilde(commandT** command)
+{
+  int idx;
+  for(idx = 0; idx < command[0]->argc; idx++){
+    if(command[0]->argv[idx][0] == '~')
+      return TRUE;
+    if(strcmp(command[0]->argv[0],"unalias") != 0 && IsAlias(command[0]->argv[idx]))
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/*Check whether Interpret would rewrite the commands through any expansion*/
+bool NeedsExpansion(commandT** command)
+{
+  return needsAliasOrTilde(command) || strchr(command[0]->cmdline, '$') != NULL;
+}
+
+//bool secondRun stops the interpreter from recursing more than 1 level into itself
+void Interpret(char* cmdLine,bool secondRun)
+{
+  int task, i, j;
+  commandT **command;
+  char *value, *tmp;
+  long long start = ProbeClock(PROBE_ENABLED(parse__done));
+
+  PROBE1(parse__start, cmdLine);
+  //if/while/for are parsed into a tree and run from there
+  if(IsCompound(cmdLine)){
+    RunCompound(cmdLine);
+    return;
+  }
+  //NAME=value sets a shell variable
+  if((value = assignValue(cmdLine, &i)) != NULL){
+    cmdLine[i] = '\0';
+    tmp = expandVars(value);
+    SetVar(cmdLine, tmp);
+    free(tmp);
+    free(value);
+    lastExitStatus = 0;
+    return;
+  }
+
+  command = ParseCmdLine(cmdLine, &task);
+  if(command == NULL) return;
+
+  //
+  // VARIABLE EXPANSION
+  //
+  if(!secondRun){
+    for(i = 0; i < task; i++){
+      for(j = 0; j < command[i]->argc; j++){
+        tmp = expandVars(command[i]->argv[j]);
+        free(command[i]->argv[j]);
+        command[i]->argv[j] = tmp;
+      }
+      if(command[i]->redirect_in != NULL){
+        tmp = expandVars(command[i]->redirect_in);
+        free(command[i]->redirect_in);
+        command[i]->redirect_in = tmp;
+      }
+      if(command[i]->redirect_out != NULL){
+        tmp = expandVars(command[i]->redirect_out);
+        free(command[i]->redirect_out);
+        command[i]->redirect_out = tmp;
+      }
+      for(j = 0; command[i]->redirect_tee != NULL && command[i]->redirect_tee[j] != NULL; j++){
+        tmp = expandVars(command[i]->redirect_tee[j]);
+        free(command[i]->redirect_tee[j]);
+        command[i]->redirect_tee[j] = tmp;
+      }
+    }
+  }
+  //A redirection that expanded to a bare & opens nothing, and the line does not run
+  if(ambiguousCmds(command, task)){
+    for(i = 0; i < task; i++)
+      ReleaseCmdT(&command[i]);
+    free(command);
+    lastExitStatus = 1;
+    return;
+  }
+  PROBE3(parse__done, command[0]->argv[0], task,
+         ProbeClock(PROBE_ENABLED(parse__done)) - start);
+  task--;
 
   //
   // TILDE EXPANSION
@@ -287,3 +480,964 @@ void Interpret(char* cmdLine,bool secondRun)
     free(command);
   }
 }
+
+
+//////////////////////////////////////////////////////////////
+//  Variables
+//////////////////////////////////////////////////////////////
+
+/*Append a block of text to a growing string*/
+static void append(char** out, size_t* used, size_t* size, const char* s, size_t len)
+{
+  if(*used + len + 1 > *size){
+    *size = (*used + len + 1) * 2;
+    *out = realloc(*out, *size);
+  }
+  memcpy(*out + *used, s, len);
+  *used += len;
+  (*out)[*used] = '\0';
+}
+
+/*Replace $NAME, ${NAME} and $? by their values, returns a new string*/
+static char* expandVars(char* word)
+{
+  size_t used = 0, size = strlen(word) + 1, len;
+  char *out, *p, *name, *value;
+  char status[16];
+
+  if(strchr(word, '$') == NULL)
+    return strdup(word);
+  out = malloc(size);
+  out[0] = '\0';
+  for(p = word; *p != '\0';){
+    if(*p != '$'){
+      for(len = 0; p[len] != '\0' && p[len] != '$'; len++);
+      append(&out, &used, &size, p, len);
+      p += len;
+      continue;
+    }
+    if(p[1] == '{' && strchr(p, '}') != NULL){
+      len = strchr(p, '}') - (p + 2);
+      name = strndup(p + 2, len);
+      p += len + 3;
+    }
+    else if(p[1] == '?'){
+      name = strdup("?");
+      p += 2;
+    }
+    else if(p[1] == '_' || (p[1] >= 'a' && p[1] <= 'z') || (p[1] >= 'A' && p[1] <= 'Z')){
+      for(len = 1; p[len + 1] == '_' || (p[len + 1] >= 'a' && p[len + 1] <= 'z') ||
+                   (p[len + 1] >= 'A' && p[len + 1] <= 'Z') || (p[len + 1] >= '0' && p[len + 1] <= '9'); len++);
+      name = strndup(p + 1, len);
+      p += len + 1;
+    }
+    else{
+      //a lone $ is taken literally
+      append(&out, &used, &size, p, 1);
+      p++;
+      continue;
+    }
+    //$? is the exit status of the last command
+    if(strcmp(name, "?") == 0){
+      snprintf(status, sizeof(status), "%d", lastExitStatus);
+      append(&out, &used, &size, status, strlen(status));
+    }
+    else if((value = GetVar(name)) != NULL)
+      append(&out, &used, &size, value, strlen(value));
+    free(name);
+  }
+  return out;
+}
+
+/*&N is descriptor N. & alone or before anything but digits, as from an unset
+  ${H[1]}, is reported instead of becoming a file named after it*/
+static bool ambiguousRedirect(char* file)
+{
+  char* p;
+
+  if(file == NULL || file[0] != '&')
+    return FALSE;
+  for(p = file + 1; *p >= '0' && *p <= '9'; p++);
+  if(p > file + 1 && *p == '\0')
+    return FALSE;
+  fprintf(stderr, "tsh: %s: ambiguous redirect\n", file);
+  return TRUE;
+}
+
+/*Whether a redirection of any of the commands is ambiguous, reported if so*/
+static bool ambiguousCmds(commandT** cmds, int n)
+{
+  int i, j;
+
+  for(i = 0; i < n; i++){
+    if(ambiguousRedirect(cmds[i]->redirect_in) || ambiguousRedirect(cmds[i]->redirect_out))
+      return TRUE;
+    for(j = 0; cmds[i]->redirect_tee != NULL && cmds[i]->redirect_tee[j] != NULL; j++)
+      if(ambiguousRedirect(cmds[i]->redirect_tee[j]))
+        return TRUE;
+  }
+  return FALSE;
+}
+
+/*If the line is NAME=value, returns the value without its quotes and where the name ends*/
+static char* assignValue(char* line, int* nameEnd)
+{
+  char *p, *value, *out;
+  char quote = 0;
+  int used = 0;
+
+  for(p = line; *p == ' '; p++);
+  if(!(*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')))
+    return NULL;
+  while(*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9'))
+    p++;
+  if(*p != '=')
+    return NULL;
+  *nameEnd = p - line;
+
+  //the value has to be a single word, quotes may hide spaces in it
+  value = p + 1;
+  out = malloc(strlen(value) + 1);
+  for(p = value; *p != '\0'; p++){
+    if(quote == 0 && (*p == '\'' || *p == '"'))
+      quote = *p;
+    else if(quote != 0 && *p == quote)
+      quote = 0;
+    else if(quote == 0 && *p == ' ')
+      break;
+    else
+      out[used++] = *p;
+  }
+  for(; *p == ' '; p++);
+  if(*p != '\0' || quote != 0){
+    free(out);
+    return NULL;
+  }
+  out[used] = '\0';
+  return out;
+}
+
+bool IsAssignment(char* line)
+{
+  int nameEnd;
+  char* value = assignValue(line, &nameEnd);
+  free(value);
+  return value != NULL;
+}
+
+
+//////////////////////////////////////////////////////////////
+//  Compound Commands
+//////////////////////////////////////////////////////////////
+
+/*Find the keyword a word of the given length is, KW_NONE if it is none*/
+static int keyword(char* word, int len)
+{
+  int kw;
+  for(kw = KW_IF; kw <= KW_RBRACE; kw++)
+    if(strlen(keywords[kw]) == len && strncmp(word, keywords[kw], len) == 0)
+      return kw;
+  return KW_NONE;
+}
+
+/*Length of the && or || at p, 0 if there is none*/
+static int listOperator(char* p)
+{
+  return ((p[0] == '&' && p[1] == '&') || (p[0] == '|' && p[1] == '|')) ? 2 : 0;
+}
+
+/*Check whether a line is more than one pipeline: it has an unquoted ';', '&&' or '||'*/
+static bool isList(char* line)
+{
+  int quot1 = 0, quot2 = 0;
+
+  for(; *line != '\0'; line++){
+    if(*line == '\'' && !quot2)
+      quot1 = !quot1;
+    else if(*line == '"' && !quot1)
+      quot2 = !quot2;
+    else if(!quot1 && !quot2 && (*line == ';' || *line == '\n' || listOperator(line) != 0))
+      return TRUE;
+  }
+  return FALSE;
+}
+
+bool IsCompound(char* line)
+{
+  int len;
+  for(; *line == ' '; line++);
+  if(*line == '(')
+    return TRUE;
+  for(len = 0; line[len] != '\0' && line[len] != ' ' && line[len] != ';' && line[len] != '\n'; len++);
+  return keyword(line, len) != KW_NONE || isList(line);
+}
+
+static void addToken(tokenListT* list, int kw, char* text)
+{
+  if(list->n == list->size){
+    list->size = list->size * 2 + 16;
+    list->t = realloc(list->t, sizeof(tokenT) * list->size);
+  }
+  list->t[list->n].kw = kw;
+  list->t[list->n].text = text;
+  list->n++;
+}
+
+/*Drop the blanks around a piece of a line, returns its new length*/
+static int trim(char** seg, int len)
+{
+  while(len > 0 && (**seg == ' ' || **seg == '\t')){
+    (*seg)++;
+    len--;
+  }
+  while(len > 0 && ((*seg)[len - 1] == ' ' || (*seg)[len - 1] == '\t'))
+    len--;
+  return len;
+}
+
+/*Copy what follows the end of a group, NULL if there is nothing*/
+static char* groupSuffix(char* seg, int len)
+{
+  len = trim(&seg, len);
+  return len == 0 ? NULL : strndup(seg, len);
+}
+
+/*Add one command of a compound command; a leading keyword becomes a token of its own*/
+static void addSegment(tokenListT* list, char* seg, int len)
+{
+  int w, kw;
+
+  if((len = trim(&seg, len)) == 0)
+    return;
+  for(w = 0; w < len && seg[w] != ' ' && seg[w] != '\t'; w++);
+  kw = keyword(seg, w);
+  if(kw == KW_NONE)
+    addToken(list, KW_NONE, strndup(seg, len));
+  else if(kw == KW_FOR)
+    addToken(list, KW_FOR, strndup(seg + w, len - w));
+  else if(kw == KW_RBRACE)
+    addToken(list, KW_RBRACE, groupSuffix(seg + w, len - w));
+  else{
+    addToken(list, kw, NULL);
+    addSegment(list, seg + w, len - w);
+  }
+}
+
+/*Check whether a '(' after this much of a command opens a subshell: only a keyword may come before it*/
+static bool opensSubshell(char* seg, int len)
+{
+  int kw;
+
+  if((len = trim(&seg, len)) == 0)
+    return TRUE;
+  kw = keyword(seg, len);
+  return kw != KW_NONE && kw != KW_FOR;
+}
+
+/*Split a compound command at unquoted ';', newlines, '&&' and '||', and around the parentheses of subshells*/
+static void tokenize(char* text, tokenListT* list)
+{
+  int i, end, start = 0, quot1 = 0, quot2 = 0;
+
+  for(i = 0; ; i++){
+    if(text[i] == '\'' && !quot2)
+      quot1 = !quot1;
+    else if(text[i] == '"' && !quot1)
+      quot2 = !quot2;
+    else if(text[i] == '(' && !quot1 && !quot2 && opensSubshell(text + start, i - start)){
+      addSegment(list, text + start, i - start);
+      addToken(list, KW_LPAREN, NULL);
+      start = i + 1;
+    }
+    else if(text[i] == ')' && !quot1 && !quot2){
+      addSegment(list, text + start, i - start);
+      //the redirections and & of the subshell run up to the end of the command
+      for(end = i + 1; text[end] != '\0' && text[end] != ';' && text[end] != '\n' && text[end] != ')' &&
+                       listOperator(text + end) == 0; end++);
+      addToken(list, KW_RPAREN, groupSuffix(text + i + 1, end - i - 1));
+      start = end;
+      i = end - 1;
+    }
+    else if(listOperator(text + i) != 0 && !quot1 && !quot2){
+      addSegment(list, text + start, i - start);
+      addToken(list, text[i] == '&' ? KW_AND : KW_OR, NULL);
+      start = i + 2;
+      i++;
+    }
+    else if(text[i] == '\0' || ((text[i] == ';' || text[i] == '\n') && !quot1 && !quot2)){
+      addSegment(list, text + start, i - start);
+      start = i + 1;
+      if(text[i] == '\0')
+        break;
+    }
+  }
+}
+
+static void freeTokens(tokenListT* list)
+{
+  int i;
+  for(i = 0; i < list->n; i++)
+    free(list->t[i].text);
+  free(list->t);
+}
+
+bool IsIncomplete(char* text)
+{
+  tokenListT list = { NULL, 0, 0 };
+  int i, depth = 0;
+
+  if(!IsCompound(text))
+    return FALSE;
+  tokenize(text, &list);
+  for(i = 0; i < list.n; i++){
+    if(list.t[i].kw == KW_IF || list.t[i].kw == KW_WHILE || list.t[i].kw == KW_FOR ||
+       list.t[i].kw == KW_LBRACE || list.t[i].kw == KW_LPAREN)
+      depth++;
+    else if(list.t[i].kw == KW_FI || list.t[i].kw == KW_DONE ||
+            list.t[i].kw == KW_RBRACE || list.t[i].kw == KW_RPAREN)
+      depth--;
+  }
+  //a line that ends in && or || goes on on the next one
+  if(list.n > 0 && (list.t[list.n - 1].kw == KW_AND || list.t[list.n - 1].kw == KW_OR))
+    depth++;
+  freeTokens(&list);
+  return depth > 0;
+}
+
+static void syntaxError(tokenListT* list, int i)
+{
+  if(i >= list->n)
+    fprintf(stderr, "syntax error: unexpected end of input\n");
+  else if(list->t[i].kw == KW_NONE)
+    fprintf(stderr, "syntax error near `%s'\n", list->t[i].text);
+  else
+    fprintf(stderr, "syntax error near `%s'\n", keywords[list->t[i].kw]);
+  lastExitStatus = 2;
+}
+
+static bool expect(tokenListT* list, int* i, int kw)
+{
+  if(*i < list->n && list->t[*i].kw == kw){
+    (*i)++;
+    return TRUE;
+  }
+  syntaxError(list, *i);
+  return FALSE;
+}
+
+static nodeT* newNode(int type)
+{
+  nodeT* node = calloc(1, sizeof(nodeT));
+  node->type = type;
+  return node;
+}
+
+/*Parse a simple command once, so that loops only have to copy it*/
+static nodeT* simpleNode(char* text)
+{
+  nodeT* node = newNode(NODE_SIMPLE);
+  char *copy, *value;
+  int i, nameEnd;
+
+  node->vars = strchr(text, '$') != NULL;
+  if((value = assignValue(text, &nameEnd)) != NULL){
+    node->type = NODE_ASSIGN;
+    node->text = strndup(text, nameEnd);
+    while(node->text[0] == ' ')
+      memmove(node->text, node->text + 1, strlen(node->text));
+    node->words = malloc(sizeof(char*));
+    node->words[0] = value;
+    node->nwords = 1;
+    return node;
+  }
+
+  node->text = strdup(text);
+  copy = strdup(text);
+  node->cmds = ParseCmdLine(copy, &node->ncmds);
+  free(copy);
+  if(node->cmds == NULL)
+    return node;
+  if(node->ncmds == 1 && node->cmds[0]->argc == 1){
+    if(strcmp(node->cmds[0]->argv[0], "break") == 0)
+      node->type = NODE_BREAK;
+    else if(strcmp(node->cmds[0]->argv[0], "continue") == 0)
+      node->type = NODE_CONTINUE;
+    else if(strcmp(node->cmds[0]->argv[0], "exit") == 0)
+      node->type = NODE_EXIT;
+  }
+  //aliases and tildes are left to Interpret()
+  if(node->type != NODE_SIMPLE || node->cmds[0]->argc <= 0 || needsAliasOrTilde(node->cmds)){
+    for(i = 0; i < node->ncmds; i++)
+      ReleaseCmdT(&node->cmds[i]);
+    free(node->cmds);
+    node->cmds = NULL;
+  }
+  return node;
+}
+
+/*Parse an if after its keyword; an elif is parsed as a nested if*/
+static nodeT* parseIf(tokenListT* list, int* i)
+{
+  nodeT* node = newNode(NODE_IF);
+
+  if((node->cond = parseList(list, i, KW(KW_THEN))) == NULL || !expect(list, i, KW_THEN) ||
+     (node->body = parseList(list, i, KW(KW_ELIF) | KW(KW_ELSE) | KW(KW_FI))) == NULL){
+    freeTree(node);
+    return NULL;
+  }
+  if(*i < list->n && list->t[*i].kw == KW_ELIF){
+    (*i)++;
+    if((node->alt = parseIf(list, i)) == NULL){
+      freeTree(node);
+      return NULL;
+    }
+    return node;
+  }
+  if(*i < list->n && list->t[*i].kw == KW_ELSE){
+    (*i)++;
+    if((node->alt = parseList(list, i, KW(KW_FI))) == NULL){
+      freeTree(node);
+      return NULL;
+    }
+  }
+  if(!expect(list, i, KW_FI)){
+    freeTree(node);
+    return NULL;
+  }
+  return node;
+}
+
+/*Parse "do ... done" into the body of a loop*/
+static bool parseLoopBody(tokenListT* list, int* i, nodeT* node)
+{
+  return expect(list, i, KW_DO) &&
+         (node->body = parseList(list, i, KW(KW_DONE))) != NULL &&
+         expect(list, i, KW_DONE);
+}
+
+/*Parse a for loop whose header is "NAME in WORDS"*/
+static nodeT* parseFor(tokenListT* list, int* i)
+{
+  nodeT* node = newNode(NODE_FOR);
+  char* header = strdup(list->t[*i].text);
+  commandT** cmds;
+  int n, j;
+
+  cmds = ParseCmdLine(header, &n);
+  free(header);
+  if(cmds == NULL || n != 1 || cmds[0]->argc < 2 || strcmp(cmds[0]->argv[1], "in") != 0){
+    fprintf(stderr, "syntax error: for NAME in WORDS\n");
+    lastExitStatus = 2;
+    if(cmds != NULL){
+      for(j = 0; j < n; j++)
+        ReleaseCmdT(&cmds[j]);
+      free(cmds);
+    }
+    free(node);
+    return NULL;
+  }
+  node->text = strdup(cmds[0]->argv[0]);
+  node->nwords = cmds[0]->argc - 2;
+  node->words = malloc(sizeof(char*) * (node->nwords + 1));
+  for(j = 0; j < node->nwords; j++){
+    node->words[j] = strdup(cmds[0]->argv[j + 2]);
+    if(strchr(node->words[j], '$') != NULL)
+      node->vars = TRUE;
+  }
+  ReleaseCmdT(&cmds[0]);
+  free(cmds);
+
+  (*i)++;
+  if(!parseLoopBody(list, i, node)){
+    freeTree(node);
+    return NULL;
+  }
+  return node;
+}
+
+/*Parse the redirections and & after the end of a group*/
+static bool parseGroupSuffix(nodeT* node, char* text)
+{
+  char *p = text, *word, **target;
+  int len;
+
+  while(*p != '\0'){
+    if(*p == ' ' || *p == '\t'){
+      p++;
+      continue;
+    }
+    if(node->bg)
+      return FALSE;
+    if(*p == '&'){
+      node->bg = TRUE;
+      p++;
+      continue;
+    }
+    if(*p != '<' && *p != '>')
+      return FALSE;
+    target = *p == '<' ? &node->in : &node->out;
+    for(p++; *p == ' ' || *p == '\t'; p++);
+    if(*p == '"' || *p == '\''){
+      word = p + 1;
+      if((p = strchr(word, *p)) == NULL)
+        return FALSE;
+      len = p++ - word;
+    }
+    else{
+      word = p;
+      for(len = 0; p[len] != '\0' && strchr(" \t&<>", p[len]) == NULL; len++);
+      p += len;
+    }
+    if(len == 0 || *target != NULL)
+      return FALSE;
+    *target = strndup(word, len);
+  }
+  return TRUE;
+}
+
+/*Put the tokens of a group back together, for the job table*/
+static char* groupText(tokenListT* list, int first, int last)
+{
+  char *text = NULL, *amp;
+  size_t size = 0;
+  FILE* f = open_memstream(&text, &size);
+  int i, kw, prev = KW_LPAREN;
+
+  for(i = first; i <= last; i++){
+    kw = list->t[i].kw;
+    if(i > first)
+      fputs(kw != KW_RPAREN && kw != KW_AND && kw != KW_OR && (prev == KW_NONE || prev == KW_FOR || prev == KW_FI || prev == KW_DONE ||
+                                prev == KW_RBRACE || prev == KW_RPAREN) ? "; " : " ", f);
+    if(kw != KW_NONE)
+      fputs(keywords[kw], f);
+    if(list->t[i].text != NULL)
+      fprintf(f, kw == KW_NONE || kw == KW_FOR ? "%s" : " %s", list->t[i].text);
+    prev = kw;
+  }
+  fclose(f);
+  //the job table adds the & itself
+  if(list->t[last].text != NULL && (amp = strrchr(text, '&')) != NULL && amp[1] == '\0'){
+    for(; amp > text && amp[-1] == ' '; amp--);
+    *amp = '\0';
+  }
+  return text;
+}
+
+/*Parse a brace group or a subshell after its opening token*/
+static nodeT* parseGroup(tokenListT* list, int* i)
+{
+  int first = *i;
+  int close = list->t[first].kw == KW_LBRACE ? KW_RBRACE : KW_RPAREN;
+  nodeT* node = newNode(close == KW_RBRACE ? NODE_GROUP : NODE_SUBSHELL);
+  char* suffix;
+
+  (*i)++;
+  if((node->body = parseList(list, i, KW(close))) == NULL){
+    freeTree(node);
+    return NULL;
+  }
+  suffix = *i < list->n ? list->t[*i].text : NULL;
+  if(!expect(list, i, close)){
+    freeTree(node);
+    return NULL;
+  }
+  if(suffix != NULL && !parseGroupSuffix(node, suffix)){
+    fprintf(stderr, "syntax error near `%s'\n", suffix);
+    lastExitStatus = 2;
+    freeTree(node);
+    return NULL;
+  }
+  node->text = groupText(list, first, *i - 1);
+  return node;
+}
+
+static nodeT* parseNode(tokenListT* list, int* i)
+{
+  nodeT* node;
+
+  switch(list->t[*i].kw){
+  case KW_NONE:
+    return simpleNode(list->t[(*i)++].text);
+  case KW_IF:
+    (*i)++;
+    return parseIf(list, i);
+  case KW_WHILE:
+    (*i)++;
+    node = newNode(NODE_WHILE);
+    if((node->cond = parseList(list, i, KW(KW_DO))) == NULL || !parseLoopBody(list, i, node)){
+      freeTree(node);
+      return NULL;
+    }
+    return node;
+  case KW_FOR:
+    return parseFor(list, i);
+  case KW_LBRACE:
+  case KW_LPAREN:
+    return parseGroup(list, i);
+  default:
+    syntaxError(list, *i);
+    return NULL;
+  }
+}
+
+/*Parse a command and the ones chained to it with && and ||, which bind from the left*/
+static nodeT* parseAndOr(tokenListT* list, int* i)
+{
+  nodeT *node, *left;
+  int kw;
+
+  if((node = parseNode(list, i)) == NULL)
+    return NULL;
+  while(*i < list->n && (list->t[*i].kw == KW_AND || list->t[*i].kw == KW_OR)){
+    kw = list->t[(*i)++].kw;
+    left = node;
+    node = newNode(kw == KW_AND ? NODE_AND : NODE_OR);
+    node->cond = left;
+    if(*i >= list->n || (node->body = parseNode(list, i)) == NULL){
+      if(*i >= list->n)
+        syntaxError(list, *i);
+      freeTree(node);
+      return NULL;
+    }
+  }
+  return node;
+}
+
+/*Parse commands up to one of the stop keywords, which is not consumed*/
+static nodeT* parseList(tokenListT* list, int* i, int stop)
+{
+  nodeT *head = NULL, *node;
+  nodeT **tail = &head;
+
+  while(*i < list->n && !(stop & KW(list->t[*i].kw))){
+    if((node = parseAndOr(list, i)) == NULL){
+      freeTree(head);
+      return NULL;
+    }
+    *tail = node;
+    tail = &node->next;
+  }
+  if(head == NULL)
+    syntaxError(list, *i);
+  return head;
+}
+
+static void freeTree(nodeT* node)
+{
+  nodeT* next;
+  int i;
+
+  for(; node != NULL; node = next){
+    next = node->next;
+    free(node->text);
+    for(i = 0; i < node->ncmds && node->cmds != NULL; i++)
+      ReleaseCmdT(&node->cmds[i]);
+    free(node->cmds);
+    for(i = 0; i < node->nwords; i++)
+      free(node->words[i]);
+    free(node->words);
+    freeTree(node->cond);
+    freeTree(node->body);
+    freeTree(node->alt);
+    free(node->in);
+    free(node->out);
+    free(node);
+  }
+}
+
+/*Copy a parsed command, expanding variables if it uses any*/
+static commandT* copyCmd(commandT* cmd, bool vars)
+{
+  commandT* c = CreateCmdT(cmd->argc);
+  int i;
+
+  for(i = 0; i < cmd->argc; i++)
+    c->argv[i] = vars ? expandVars(cmd->argv[i]) : strdup(cmd->argv[i]);
+  c->cmdline = vars ? expandVars(cmd->cmdline) : strdup(cmd->cmdline);
+  c->bg = cmd->bg;
+  c->is_redirect_in = cmd->is_redirect_in;
+  c->is_redirect_out = cmd->is_redirect_out;
+  if(cmd->redirect_in != NULL)
+    c->redirect_in = vars ? expandVars(cmd->redirect_in) : strdup(cmd->redirect_in);
+  if(cmd->redirect_out != NULL)
+    c->redirect_out = vars ? expandVars(cmd->redirect_out) : strdup(cmd->redirect_out);
+  if(cmd->redirect_tee != NULL){
+    for(i = 0; cmd->redirect_tee[i] != NULL; i++);
+    c->redirect_tee = malloc(sizeof(char*) * (i + 1));
+    for(i = 0; cmd->redirect_tee[i] != NULL; i++)
+      c->redirect_tee[i] = vars ? expandVars(cmd->redirect_tee[i]) : strdup(cmd->redirect_tee[i]);
+    c->redirect_tee[i] = NULL;
+  }
+  return c;
+}
+
+static void runSimple(nodeT* node)
+{
+  commandT** cmds;
+  char* line;
+  int i;
+
+  if(node->cmds == NULL){
+    line = strdup(node->text);
+    Interpret(line, FALSE);
+    free(line);
+    return;
+  }
+  cmds = malloc(sizeof(commandT*) * node->ncmds);
+  for(i = 0; i < node->ncmds; i++)
+    cmds[i] = copyCmd(node->cmds[i], node->vars);
+  if(ambiguousCmds(cmds, node->ncmds))
+    lastExitStatus = 1;
+  else
+    RunCmd(cmds, node->ncmds);
+  for(i = 0; i < node->ncmds; i++)
+    ReleaseCmdT(&cmds[i]);
+  free(cmds);
+}
+
+/*Run one iteration of a loop body, returns false when the loop has to end*/
+static bool runBody(nodeT* body)
+{
+  runList(body);
+  if(gLoopCtl == LOOP_BREAK){
+    gLoopCtl = 0;
+    return FALSE;
+  }
+  gLoopCtl = 0;
+  return !forceExit;
+}
+
+static void runFor(nodeT* node)
+{
+  char **words = node->words, *value, *w;
+  int i, n = node->nwords, size;
+
+  //words with variables are expanded and split at spaces on every run
+  if(node->vars){
+    size = node->nwords + 1;
+    words = malloc(sizeof(char*) * size);
+    for(i = 0, n = 0; i < node->nwords; i++){
+      value = expandVars(node->words[i]);
+      for(w = strtok(value, " "); w != NULL; w = strtok(NULL, " ")){
+        if(n == size){
+          size *= 2;
+          words = realloc(words, sizeof(char*) * size);
+        }
+        words[n++] = strdup(w);
+      }
+      free(value);
+    }
+  }
+
+  lastExitStatus = 0;
+  gLoopDepth++;
+  for(i = 0; i < n; i++){
+    SetVar(node->text, words[i]);
+    if(!runBody(node->body))
+      break;
+  }
+  gLoopDepth--;
+
+  if(words != node->words){
+    for(i = 0; i < n; i++)
+      free(words[i]);
+    free(words);
+  }
+}
+
+/*Point stdin and stdout of the shell at the redirections of a group, the old ones go to saved*/
+static bool redirectGroup(nodeT* node, int saved[2])
+{
+  char *files[2] = { node->in, node->out }, *file;
+  int fd, i;
+
+  OutFlush();
+  for(i = 0; i < 2; i++){
+    if(files[i] == NULL)
+      continue;
+    file = expandVars(files[i]);
+    if(ambiguousRedirect(file)){
+      free(file);
+      return FALSE;
+    }
+    fd = i == 0 ? OpenRedirect(file, O_RDONLY) : OpenRedirect(file, O_WRONLY | O_CREAT | O_TRUNC);
+    if(fd == -1){
+      fprintf(stderr, "%s: %s\n", file, strerror(errno));
+      free(file);
+      return FALSE;
+    }
+    free(file);
+    saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+    dup2(fd, i);
+    close(fd);
+  }
+  return TRUE;
+}
+
+static void restoreGroup(int saved[2])
+{
+  int i;
+
+  OutFlush();
+  for(i = 0; i < 2; i++)
+    if(saved[i] != -1){
+      dup2(saved[i], i);
+      close(saved[i]);
+    }
+}
+
+/*Run a brace group in the shell itself; its redirections are opened once for all of its commands*/
+static void runGroup(nodeT* node)
+{
+  int saved[2] = { -1, -1 };
+
+  if(redirectGroup(node, saved))
+    runList(node->body);
+  else
+    lastExitStatus = 1;
+  restoreGroup(saved);
+}
+
+/*The list of a subshell, in the subshell: its last simple command replaces the subshell*/
+static void subshellBody(void* arg)
+{
+  nodeT* node = arg;
+  commandT* cmd;
+
+  for(; node->next != NULL && gLoopCtl == 0 && !forceExit; node = node->next)
+    runNode(node);
+  if(gLoopCtl != 0 || forceExit)
+    return;
+  if(node->type == NODE_SIMPLE && node->cmds != NULL && node->ncmds == 1){
+    cmd = copyCmd(node->cmds[0], node->vars);
+    RunLastCmd(cmd);
+    ReleaseCmdT(&cmd);
+  }
+  else
+    runNode(node);
+}
+
+/*Run a subshell, or a group in the background, as a job of its own*/
+static void runSubshell(nodeT* node)
+{
+  commandT* cmd = CreateCmdT(0);
+
+  cmd->name = strdup("tsh");
+  cmd->cmdline = strdup(node->text);
+  if(node->in != NULL){
+    cmd->redirect_in = expandVars(node->in);
+    cmd->is_redirect_in = 1;
+  }
+  if(node->out != NULL){
+    cmd->redirect_out = expandVars(node->out);
+    cmd->is_redirect_out = 1;
+  }
+  cmd->bg = node->bg;
+  if(ambiguousCmds(&cmd, 1))
+    lastExitStatus = 1;
+  else
+    RunSubshell(cmd, subshellBody, node->body);
+  ReleaseCmdT(&cmd);
+}
+
+static void runNode(nodeT* node)
+{
+  int status;
+  char* value;
+
+  switch(node->type){
+  case NODE_SIMPLE:
+    runSimple(node);
+    break;
+  case NODE_ASSIGN:
+    value = expandVars(node->words[0]);
+    SetVar(node->text, value);
+    free(value);
+    lastExitStatus = 0;
+    break;
+  case NODE_IF:
+    runList(node->cond);
+    if(gLoopCtl != 0 || forceExit)
+      break;
+    if(lastExitStatus == 0)
+      runList(node->body);
+    else if(node->alt != NULL)
+      runList(node->alt);
+    else
+      lastExitStatus = 0;
+    break;
+  case NODE_WHILE:
+    status = 0;
+    gLoopDepth++;
+    while(!forceExit){
+      runList(node->cond);
+      if(gLoopCtl != 0 || lastExitStatus != 0){
+        gLoopCtl = 0;
+        break;
+      }
+      runList(node->body);
+      status = lastExitStatus;
+      if(gLoopCtl == LOOP_BREAK){
+        gLoopCtl = 0;
+        break;
+      }
+      gLoopCtl = 0;
+    }
+    gLoopDepth--;
+    lastExitStatus = status;
+    break;
+  case NODE_FOR:
+    runFor(node);
+    break;
+  case NODE_BREAK:
+  case NODE_CONTINUE:
+    if(gLoopDepth > 0)
+      gLoopCtl = node->type == NODE_BREAK ? LOOP_BREAK : LOOP_CONTINUE;
+    lastExitStatus = 0;
+    break;
+  case NODE_EXIT:
+    cleanExit();
+    forceExit = TRUE;
+    break;
+  case NODE_GROUP:
+    //a compressor needs a process that waits for it
+    if(node->bg || (node->out != NULL && CompressedFile(node->out)))
+      runSubshell(node);
+    else
+      runGroup(node);
+    break;
+  case NODE_SUBSHELL:
+    runSubshell(node);
+    break;
+  case NODE_AND:
+  case NODE_OR:
+    runNode(node->cond);
+    if(gLoopCtl != 0 || forceExit)
+      break;
+    if((lastExitStatus == 0) == (node->type == NODE_AND))
+      runNode(node->body);
+    break;
+  }
+}
+
+static void runList(nodeT* node)
+{
+  for(; node != NULL && gLoopCtl == 0 && !forceExit; node = node->next)
+    runNode(node);
+}
+
+/*Parse a compound command into a tree and run it*/
+static void RunCompound(char* text)
+{
+  tokenListT list = { NULL, 0, 0 };
+  nodeT* tree;
+  int i = 0;
+
+  tokenize(text, &list);
+  tree = parseList(&list, &i, 0);
+  freeTokens(&list);
+  if(tree == NULL)
+    return;
+  runList(tree);
+  freeTree(tree);
+}
@@ -59,6 +59,59 @@
  ***********************************************************************/
 EXTERN void Interpret(char*,bool);
 
+/***********************************************************************
+ *  Title: Parses a command line
+ * ---------------------------------------------------------------------
+ *    Purpose: Splits a command line into its commands without
+ *    expanding tildes or aliases. The line is modified.
+ *    Input: a command line and where to store the number of commands
+ *    Output: the commands, NULL for an empty line
+ ***********************************************************************/
+EXTERN struct command_t** ParseCmdLine(char*, int*);
+
+/***********************************************************************
+ *  Title: Checks whether a parsed line needs expansion
+ * ---------------------------------------------------------------------
+ *    Purpose: Checks whether Interpret() would rewrite the commands
+ *    through tilde, alias or variable expansion
+ *    Input: the commands returned by ParseCmdLine()
+ *    Output: true if the line has to go through Interpret()
+ ***********************************************************************/
+EXTERN bool NeedsExpansion(struct command_t**);
+
+/***********************************************************************
+ *  Title: Checks for a compound command
+ * ---------------------------------------------------------------------
+ *    Purpose: Checks whether a line starts with one of the keywords
+ *    if, then, elif, else, fi, while, do, done or for, or is a list
+ *    of commands joined by ;, && or ||. Such lines are parsed into a
+ *    tree once and run from it.
+ *    Input: a command line
+ *    Output: true if it is a compound command
+ ***********************************************************************/
+EXTERN bool IsCompound(char*);
+
+/***********************************************************************
+ *  Title: Checks whether a compound command goes on
+ * ---------------------------------------------------------------------
+ *    Purpose: Checks whether an if, while or for is still open at the
+ *    end of the text, or it ends in && or ||, so that the next line
+ *    has to be appended
+ *    Input: the lines read so far, separated by newlines
+ *    Output: true if more lines are needed
+ ***********************************************************************/
+EXTERN bool IsIncomplete(char*);
+
+/***********************************************************************
+ *  Title: Checks for a variable assignment
+ * ---------------------------------------------------------------------
+ *    Purpose: Checks whether a line is NAME=value with a single word
+ *    as value
+ *    Input: a command line
+ *    Output: true if it is an assignment
+ ***********************************************************************/
+EXTERN bool IsAssignment(char*);
+
 /************External Declaration*****************************************/
 
 /**************Definition***************************************************/
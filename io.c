@@ -31,6 +31,9 @@
 #define __IO_IMPL__
 
 /************System include***********************************************/
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,10 +41,12 @@
 #include <unistd.h>
 #include <termios.h>
 #include <assert.h>
+#include <sys/uio.h>
 
 /************Private include**********************************************/
 #include "io.h"
 #include "runtime.h"
+#include "prefetch.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -50,12 +55,31 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
+/* size of the pieces buffered output is kept in */
+#define OUT_CHUNK 8192
+
+/* iovecs a writev takes, limits.h only has it with _XOPEN_SOURCE */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef struct out_chunk_t
+{
+  char* data;
+  size_t len, size;
+} outChunkT;
+
 /************Global Variables*********************************************/
 
 /* indicates that the standard input stream is currently read  */
 bool isReading = FALSE;
 
+/* output waiting for OutFlush(), one iovec per chunk */
+static outChunkT* gOut = NULL;
+static int gOutCount = 0, gOutMax = 0;
+
 /************Function Prototypes******************************************/
+static outChunkT* outRoom(size_t);
 
 /************External Declaration*****************************************/
 
@@ -63,13 +87,96 @@ bool isReading = FALSE;
 
 void PrintNewline()
 {
-  putchar('\n');
+  OutPrintf("\n");
 }
 
 void Print(char* msg)
 {
   assert(msg != NULL);
-  puts(msg);
+  OutPrintf("%s\n", msg);
+}
+
+/*Get a chunk with at least len bytes free*/
+static outChunkT* outRoom(size_t len)
+{
+  outChunkT* chunk;
+
+  if (gOutCount > 0 && gOut[gOutCount - 1].size - gOut[gOutCount - 1].len >= len)
+    return &gOut[gOutCount - 1];
+  if (gOutCount == gOutMax)
+  {
+    gOutMax = gOutMax * 2 + 16;
+    gOut = realloc(gOut, sizeof(outChunkT) * gOutMax);
+  }
+  chunk = &gOut[gOutCount++];
+  chunk->size = len > OUT_CHUNK ? len : OUT_CHUNK;
+  chunk->data = malloc(chunk->size);
+  chunk->len = 0;
+  return chunk;
+}
+
+void OutPrintf(const char* format, ...)
+{
+  va_list ap;
+  outChunkT* chunk;
+  int len;
+
+  va_start(ap, format);
+  chunk = outRoom(1);
+  len = vsnprintf(chunk->data + chunk->len, chunk->size - chunk->len, format, ap);
+  va_end(ap);
+  if (len < 0)
+    return;
+  //Too long for what is left of the chunk, format it again into a new one
+  if (len >= chunk->size - chunk->len)
+  {
+    chunk = outRoom(len + 1);
+    va_start(ap, format);
+    vsnprintf(chunk->data + chunk->len, chunk->size - chunk->len, format, ap);
+    va_end(ap);
+  }
+  chunk->len += len;
+}
+
+void OutFlush()
+{
+  struct iovec iov[IOV_MAX];
+  int first = 0, n, i;
+  ssize_t written;
+
+  while (first < gOutCount)
+  {
+    for (n = 0; n < IOV_MAX && first + n < gOutCount; n++)
+    {
+      iov[n].iov_base = gOut[first + n].data;
+      iov[n].iov_len = gOut[first + n].len;
+    }
+    written = writev(STDOUT_FILENO, iov, n);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written == -1)
+      break;
+    //Drop what was written, a short write leaves the rest of a chunk in place
+    for (i = first; i < gOutCount && written >= gOut[i].len; i++)
+    {
+      written -= gOut[i].len;
+      gOut[i].len = 0;
+    }
+    if (i < gOutCount && written > 0)
+    {
+      memmove(gOut[i].data, gOut[i].data + written, gOut[i].len - written);
+      gOut[i].len -= written;
+    }
+    first = i;
+  }
+  //Keep the first chunk for the next cycle
+  for (i = 1; i < gOutCount; i++)
+    free(gOut[i].data);
+  if (gOutCount > 0)
+  {
+    gOut[0].len = 0;
+    gOutCount = 1;
+  }
 }
 
 void PrintPError(char* msg)
@@ -97,6 +204,9 @@ void getCommandLine(char** buf, int size)
   char* cmd = *buf;
   cmd[0] = '\0';
 
+  OutFlush();
+  //The user is about to type, read the likely next command ahead meanwhile
+  PrefetchIdle();
   isReading = TRUE;
   while (((ch = getc(stdin)) != EOF) &&
       (ch != '\n'))
@@ -110,6 +220,7 @@ void getCommandLine(char** buf, int size)
     used++;
     cmd[used] = '\0';
   }
+  *buf = cmd;
   isReading = FALSE;
 }
 
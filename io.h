@@ -82,6 +82,30 @@ EXTERN void PrintNewline();
  ***********************************************************************/
 EXTERN void PrintPError(char*);
 
+/***********************************************************************
+ *  Title: Buffer shell output
+ * ---------------------------------------------------------------------
+ *    Purpose: Formats a message like printf and keeps it for
+ *    OutFlush(), so that output the shell generates itself goes out
+ *    in one writev instead of one write per line. All of the shell's
+ *    own standard output goes through here to stay in order.
+ *    Input: a printf format and its arguments
+ *    Output: void
+ ***********************************************************************/
+EXTERN void OutPrintf(const char*, ...) __attribute__ ((format (printf, 1, 2)));
+
+/***********************************************************************
+ *  Title: Write out buffered shell output
+ * ---------------------------------------------------------------------
+ *    Purpose: Writes what OutPrintf() kept to standard output with
+ *    writev. Called before the shell forks, blocks on input or on a
+ *    child, and exits, so that its output stays in order with the
+ *    output of the programs it runs.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void OutFlush();
+
 /***********************************************************************
  *  Title: Checks whether input is read from stdin 
  * ---------------------------------------------------------------------
@@ -0,0 +1,457 @@
+/***************************************************************************
+ *  Title: Job scheduling policies
+ * -------------------------------------------------------------------------
+ *    Purpose: Decides where on the machine jobs run
+ *    File: jobsched.c
+ ***************************************************************************/
+#define __JOBSCHED_IMPL__
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/************Private include**********************************************/
+#include "jobsched.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define MAXCPUS CPU_SETSIZE
+
+typedef enum { POLICY_OFF, POLICY_RR, POLICY_LEAST } policyT;
+
+/* nice value added to background jobs */
+#define BG_NICE 10
+
+/* ioprio_set(2) has no glibc wrapper or header */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PGRP 2
+#define IOPRIO_PRIO_VALUE(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+
+/************Global Variables*********************************************/
+
+static policyT gPolicy = POLICY_OFF;
+/* cpus the shell was allowed to use when it started */
+static cpu_set_t gAllowed;
+/* cpus kept free for the shell and foreground jobs */
+static cpu_set_t gReserved;
+/* NUMA node of every cpu, 0 without NUMA information */
+static int gNode[MAXCPUS];
+static int gNodeCount = 1;
+/* number of live background jobs pinned to each node */
+static int gLoad[MAXCPUS];
+/* position of the round robin over the nodes */
+static int gNext = 0;
+static bool gInitialized = FALSE;
+
+/* whether jobs change priority when moving between foreground and background */
+static bool gPriorityPolicy = FALSE;
+
+/************Function Prototypes******************************************/
+/* reads the allowed cpus and the NUMA topology */
+static void initTopology();
+/* parses a cpu list such as "0-3,8" */
+static bool parseCpuList(char* list, cpu_set_t* set);
+/* prints a cpu set as a cpu list */
+static void printCpuSet(cpu_set_t* set);
+/* writes a cpu set as a cpu list */
+static void formatCpuSet(cpu_set_t* set, char* buf, int len);
+/* cpus of a node a background job may run on */
+static void nodeCpus(int node, cpu_set_t* set);
+/* sets the I/O priority of a process group */
+static void setIoPriority(pid_t pgid, int class, int level);
+/* calls a function on every thread of every process in a process group */
+static void forEachTask(pid_t pgid, void (*fn)(pid_t, void*), void* arg);
+/* sched_setaffinity() for forEachTask() */
+static void pinTask(pid_t tid, void* set);
+/* sched_setscheduler() for forEachTask() */
+static void scheduleTask(pid_t tid, void* policy);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void AffinityConfigure(int argc, char** argv)
+{
+  int i;
+
+  initTopology();
+  if (argc == 1)
+  {
+    OutPrintf("policy: %s\n", gPolicy == POLICY_RR ? "rr" : gPolicy == POLICY_LEAST ? "least" : "off");
+    OutPrintf("reserved: ");
+    printCpuSet(&gReserved);
+    OutPrintf("\nnodes: %d\n", gNodeCount);
+    for (i = 0; i < gNodeCount; i++)
+    {
+      cpu_set_t set;
+      nodeCpus(i, &set);
+      if (CPU_COUNT(&set) == 0)
+        continue;
+      OutPrintf("node%d cpus ", i);
+      printCpuSet(&set);
+      OutPrintf(" jobs %d\n", gLoad[i]);
+    }
+    return;
+  }
+  if (argc == 3 && strcmp(argv[1], "policy") == 0)
+  {
+    if (strcmp(argv[2], "rr") == 0)
+      gPolicy = POLICY_RR;
+    else if (strcmp(argv[2], "least") == 0)
+      gPolicy = POLICY_LEAST;
+    else if (strcmp(argv[2], "off") == 0)
+      gPolicy = POLICY_OFF;
+    else
+    {
+      fprintf(stderr, "affinity: unknown policy %s\n", argv[2]);
+      return;
+    }
+    //Keep the first core for the shell unless the user reserved something else
+    if (gPolicy != POLICY_OFF && CPU_COUNT(&gReserved) == 0 && CPU_COUNT(&gAllowed) > 1)
+    {
+      for (i = 0; !CPU_ISSET(i, &gAllowed); i++);
+      CPU_SET(i, &gReserved);
+    }
+  }
+  else if (argc == 3 && strcmp(argv[1], "reserve") == 0)
+  {
+    cpu_set_t set;
+    if (!parseCpuList(argv[2], &set))
+    {
+      fprintf(stderr, "affinity: invalid cpu list %s\n", argv[2]);
+      return;
+    }
+    CPU_AND(&gReserved, &set, &gAllowed);
+  }
+  else
+  {
+    fprintf(stderr, "usage: affinity [policy rr|least|off] [reserve CPUS] [pin JOB CPUS]\n");
+    return;
+  }
+
+  //The shell and its foreground jobs live on the reserved cores
+  if (gPolicy != POLICY_OFF && CPU_COUNT(&gReserved) > 0)
+    sched_setaffinity(0, sizeof(cpu_set_t), &gReserved);
+  else
+    sched_setaffinity(0, sizeof(cpu_set_t), &gAllowed);
+}
+
+int AffinityPick()
+{
+  int nodes[MAXCPUS], sizes[MAXCPUS];
+  int n = 0, node, i, best;
+  cpu_set_t set;
+
+  if (gPolicy == POLICY_OFF)
+    return -1;
+  //Nodes with a cpu left after the reserved ones
+  for (node = 0; node < gNodeCount; node++)
+  {
+    nodeCpus(node, &set);
+    if (CPU_COUNT(&set) == 0)
+      continue;
+    nodes[n] = node;
+    sizes[n++] = CPU_COUNT(&set);
+  }
+  if (n == 0)
+    return -1;
+
+  if (gPolicy == POLICY_RR)
+    best = gNext++ % n;
+  else
+  {
+    //Fewest jobs per cpu, a big node takes more than a small one
+    best = 0;
+    for (i = 1; i < n; i++)
+      if (gLoad[nodes[i]] * sizes[best] < gLoad[nodes[best]] * sizes[i])
+        best = i;
+  }
+  gLoad[nodes[best]]++;
+  return nodes[best];
+}
+
+void AffinityCpus(int node, char* buf, int len)
+{
+  cpu_set_t set;
+
+  nodeCpus(node, &set);
+  formatCpuSet(&set, buf, len);
+}
+
+void AffinityApply(char* list)
+{
+  cpu_set_t set;
+
+  if (parseCpuList(list, &set))
+    sched_setaffinity(0, sizeof(cpu_set_t), &set);
+}
+
+void AffinityRelease(int node)
+{
+  if (node >= 0 && gLoad[node] > 0)
+    gLoad[node]--;
+}
+
+bool AffinityPin(pid_t pid, char* list)
+{
+  cpu_set_t set;
+
+  initTopology();
+  if (list == NULL)
+  {
+    if (gPolicy != POLICY_OFF && CPU_COUNT(&gReserved) > 0)
+      set = gReserved;
+    else
+      set = gAllowed;
+  }
+  else if (!parseCpuList(list, &set))
+  {
+    fprintf(stderr, "affinity: invalid cpu list %s\n", list);
+    return FALSE;
+  }
+  //Affinity is per thread, the leader alone would leave the rest of the job where it was
+  if (sched_setaffinity(pid, sizeof(cpu_set_t), &set) == -1)
+  {
+    perror("affinity");
+    return FALSE;
+  }
+  forEachTask(pid, pinTask, &set);
+  return TRUE;
+}
+
+void PriorityConfigure(int argc, char** argv)
+{
+  if (argc == 1)
+    OutPrintf("priority: %s\n", gPriorityPolicy ? "on" : "off");
+  else if (argc == 2 && strcmp(argv[1], "on") == 0)
+    gPriorityPolicy = TRUE;
+  else if (argc == 2 && strcmp(argv[1], "off") == 0)
+    gPriorityPolicy = FALSE;
+  else
+    fprintf(stderr, "usage: priority [on|off]\n");
+}
+
+void PriorityBackground(pid_t pgid)
+{
+  struct sched_param param;
+  int shellNice;
+
+  if (!gPriorityPolicy)
+    return;
+  //The shell's nice value is the baseline for its jobs
+  errno = 0;
+  shellNice = getpriority(PRIO_PROCESS, getpid());
+  if (errno != 0)
+    shellNice = 0;
+  setpriority(PRIO_PGRP, pgid, shellNice + BG_NICE);
+  //Scheduling policy is per thread: a new job is only its leader, which passes it on to later
+  //children, a job stopped in the foreground may already have more
+  if (pgid == 0)
+  {
+    param.sched_priority = 0;
+    sched_setscheduler(0, SCHED_BATCH, &param);
+  }
+  else
+    forEachTask(pgid, scheduleTask, &(int){ SCHED_BATCH });
+  setIoPriority(pgid, IOPRIO_CLASS_IDLE, 0);
+}
+
+void PriorityForeground(pid_t pgid)
+{
+  int shellNice;
+
+  if (!gPriorityPolicy)
+    return;
+  errno = 0;
+  shellNice = getpriority(PRIO_PROCESS, getpid());
+  if (errno != 0)
+    shellNice = 0;
+  //Lowering the nice value again needs CAP_SYS_NICE or a matching RLIMIT_NICE,
+  //without them the job keeps its background nice value but still gets
+  //SCHED_OTHER and normal I/O priority back
+  setpriority(PRIO_PGRP, pgid, shellNice);
+  //Every thread of every process the job started in the background, not just the leader
+  forEachTask(pgid, scheduleTask, &(int){ SCHED_OTHER });
+  setIoPriority(pgid, IOPRIO_CLASS_BE, 4);
+}
+
+//////////////////////////////////////////////////////////////
+//  Support Functions
+//////////////////////////////////////////////////////////////
+
+//Processes are found by the group in /proc/PID/stat, their threads in /proc/PID/task
+static void forEachTask(pid_t pgid, void (*fn)(pid_t, void*), void* arg)
+{
+  char path[300], line[512];
+  struct dirent *proc, *task;
+  DIR *procs, *tasks;
+  char* paren;
+  int group;
+  FILE* f;
+
+  if ((procs = opendir("/proc")) == NULL)
+  {
+    fn(pgid, arg);
+    return;
+  }
+  while ((proc = readdir(procs)) != NULL)
+  {
+    if (proc->d_name[0] < '0' || proc->d_name[0] > '9')
+      continue;
+    snprintf(path, sizeof(path), "/proc/%s/stat", proc->d_name);
+    if ((f = fopen(path, "r")) == NULL)
+      continue;
+    //The name in parentheses may hold spaces, the group is the third field after it
+    group = -1;
+    if (fgets(line, sizeof(line), f) != NULL && (paren = strrchr(line, ')')) != NULL)
+      sscanf(paren + 1, " %*c %*d %d", &group);
+    fclose(f);
+    if (group != pgid)
+      continue;
+    snprintf(path, sizeof(path), "/proc/%s/task", proc->d_name);
+    if ((tasks = opendir(path)) == NULL)
+      continue;
+    while ((task = readdir(tasks)) != NULL)
+      if (task->d_name[0] >= '0' && task->d_name[0] <= '9')
+        fn(atoi(task->d_name), arg);
+    closedir(tasks);
+  }
+  closedir(procs);
+}
+
+static void pinTask(pid_t tid, void* set)
+{
+  sched_setaffinity(tid, sizeof(cpu_set_t), (cpu_set_t*)set);
+}
+
+static void scheduleTask(pid_t tid, void* policy)
+{
+  struct sched_param param;
+
+  param.sched_priority = 0;
+  sched_setscheduler(tid, *(int*)policy, &param);
+}
+
+static void initTopology()
+{
+  char path[64], list[1024];
+  cpu_set_t set;
+  int node, i;
+  FILE* f;
+
+  if (gInitialized)
+    return;
+  gInitialized = TRUE;
+
+  CPU_ZERO(&gReserved);
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &gAllowed) == -1)
+  {
+    CPU_ZERO(&gAllowed);
+    for (i = 0; i < sysconf(_SC_NPROCESSORS_ONLN) && i < MAXCPUS; i++)
+      CPU_SET(i, &gAllowed);
+  }
+
+  //Nodes are numbered densely, stop at the first one that does not exist
+  for (node = 0; ; node++)
+  {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    f = fopen(path, "r");
+    if (f == NULL)
+      break;
+    if (fgets(list, sizeof(list), f) != NULL && parseCpuList(list, &set))
+      for (i = 0; i < MAXCPUS; i++)
+        if (CPU_ISSET(i, &set))
+          gNode[i] = node;
+    fclose(f);
+  }
+  if (node > 1)
+    gNodeCount = node;
+}
+
+static bool parseCpuList(char* list, cpu_set_t* set)
+{
+  char* p = list;
+  long first, last;
+
+  CPU_ZERO(set);
+  while (*p != '\0' && *p != '\n')
+  {
+    first = strtol(p, &p, 10);
+    last = first;
+    if (*p == '-')
+      last = strtol(p + 1, &p, 10);
+    if (first < 0 || last < first || last >= MAXCPUS)
+      return FALSE;
+    for (; first <= last; first++)
+      CPU_SET(first, set);
+    if (*p == ',')
+      p++;
+    else if (*p != '\0' && *p != '\n')
+      return FALSE;
+  }
+  return CPU_COUNT(set) > 0;
+}
+
+static void printCpuSet(cpu_set_t* set)
+{
+  char list[AFFINITY_LISTLEN];
+
+  formatCpuSet(set, list, sizeof(list));
+  OutPrintf("%s", list[0] != '\0' ? list : "none");
+}
+
+static void formatCpuSet(cpu_set_t* set, char* buf, int len)
+{
+  int i, first = -1, used = 0;
+
+  buf[0] = '\0';
+  for (i = 0; i <= MAXCPUS && used < len; i++)
+  {
+    if (i < MAXCPUS && CPU_ISSET(i, set))
+    {
+      if (first == -1)
+        first = i;
+      continue;
+    }
+    if (first == -1)
+      continue;
+    used += snprintf(buf + used, len - used, used > 0 ? ",%d" : "%d", first);
+    if (i - 1 > first && used < len)
+      used += snprintf(buf + used, len - used, "-%d", i - 1);
+    first = -1;
+  }
+}
+
+//A job gets a whole node outside the reserved set, its threads share the node's cores and memory
+static void nodeCpus(int node, cpu_set_t* set)
+{
+  int i;
+
+  CPU_ZERO(set);
+  for (i = 0; i < MAXCPUS; i++)
+    if (gNode[i] == node && CPU_ISSET(i, &gAllowed) && !CPU_ISSET(i, &gReserved))
+      CPU_SET(i, set);
+}
+
+static void setIoPriority(pid_t pgid, int class, int level)
+{
+#ifdef SYS_ioprio_set
+  syscall(SYS_ioprio_set, IOPRIO_WHO_PGRP, pgid, IOPRIO_PRIO_VALUE(class, level));
+#endif
+}
@@ -0,0 +1,138 @@
+/***************************************************************************
+ *  Title: Job scheduling policies
+ * -------------------------------------------------------------------------
+ *    Purpose: Decides where on the machine jobs run
+ *    File: jobsched.h
+ ***************************************************************************/
+
+#ifndef __JOBSCHED_H__
+#define __JOBSCHED_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <sys/types.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __JOBSCHED_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* room for the cpu list of a node */
+#define AFFINITY_LISTLEN 8192
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Configure the affinity policy
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "affinity reserve CPUS" and
+ *    "affinity policy rr|least|off"; prints the current setup when
+ *    called without arguments.
+ *    Input: argc/argv of the affinity builtin
+ *    Output: void
+ ***********************************************************************/
+EXTERN void AffinityConfigure(int, char**);
+
+/***********************************************************************
+ *  Title: Pick a NUMA node for a background job
+ * ---------------------------------------------------------------------
+ *    Purpose: Chooses a node with cores outside the reserved set
+ *    according to the policy and counts the job against it. Without
+ *    NUMA there is one node, all the cores that are not reserved.
+ *    Input: void
+ *    Output: the node number, -1 if the policy is off
+ ***********************************************************************/
+EXTERN int AffinityPick();
+
+/***********************************************************************
+ *  Title: The cpus of a node
+ * ---------------------------------------------------------------------
+ *    Purpose: Lists the cores of a node that background jobs may use,
+ *    for AffinityApply() in a child or in the spawn server.
+ *    Input: the node number, a buffer of AFFINITY_LISTLEN and its size
+ *    Output: void
+ ***********************************************************************/
+EXTERN void AffinityCpus(int, char*, int);
+
+/***********************************************************************
+ *  Title: Pin the calling process to a set of cpus
+ * ---------------------------------------------------------------------
+ *    Purpose: Called in the child between fork and exec.
+ *    Input: a cpu list from AffinityCpus()
+ *    Output: void
+ ***********************************************************************/
+EXTERN void AffinityApply(char*);
+
+/***********************************************************************
+ *  Title: Release a node
+ * ---------------------------------------------------------------------
+ *    Purpose: Stops counting a finished job against its node.
+ *    Input: the node number (-1 is ignored)
+ *    Output: void
+ ***********************************************************************/
+EXTERN void AffinityRelease(int);
+
+/***********************************************************************
+ *  Title: Pin a running process
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets the affinity of every thread of an existing job to
+ *    a cpu list such as "2-3,6", or back to the shell's set when the
+ *    list is NULL.
+ *    Input: the pid of the job, which leads its process group, and
+ *    the cpu list
+ *    Output: true on success
+ ***********************************************************************/
+EXTERN bool AffinityPin(pid_t, char*);
+
+/***********************************************************************
+ *  Title: Configure the priority policy
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "priority on|off"; prints the current setting
+ *    when called without arguments.
+ *    Input: argc/argv of the priority builtin
+ *    Output: void
+ ***********************************************************************/
+EXTERN void PriorityConfigure(int, char**);
+
+/***********************************************************************
+ *  Title: Lower the priority of a background job
+ * ---------------------------------------------------------------------
+ *    Purpose: Gives a process group a higher nice value, SCHED_BATCH
+ *    on every thread and idle I/O priority when the priority policy
+ *    is on.
+ *    Input: the process group id, 0 for the caller's own group
+ *    Output: void
+ ***********************************************************************/
+EXTERN void PriorityBackground(pid_t);
+
+/***********************************************************************
+ *  Title: Restore the priority of a foreground job
+ * ---------------------------------------------------------------------
+ *    Purpose: Gives a process group, every thread of it, the shell's
+ *    interactive priority back when the priority policy is on.
+ *    Input: the process group id
+ *    Output: void
+ ***********************************************************************/
+EXTERN void PriorityForeground(pid_t);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __JOBSCHED_H__ */
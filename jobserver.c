@@ -0,0 +1,249 @@
+/***************************************************************************
+ *  Title: Jobserver
+ * -------------------------------------------------------------------------
+ *    Purpose: GNU make jobserver shared by the shell and its children
+ *    File: jobserver.c
+ ***************************************************************************/
+#define __JOBSERVER_IMPL__
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+/************Private include**********************************************/
+#include "jobserver.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define JOBSERVER_PATHLEN 256
+
+/*
+ * A token is the byte read from the FIFO, or JOBSERVER_IMPLICIT for the
+ * slot the shell holds itself (make's convention: N slots are N - 1
+ * bytes in the FIFO). The generation above it keeps jobs started under
+ * an earlier jobserver from returning tokens to the current one.
+ */
+#define JOBSERVER_IMPLICIT 256
+#define TOKEN(gen, byte)   ((gen) * 512 + (byte))
+#define TOKEN_GEN(token)   ((token) / 512)
+#define TOKEN_BYTE(token)  ((token) % 512)
+
+/************Global Variables*********************************************/
+
+/* the FIFO, non-blocking, -1 while the jobserver is off */
+static int gFd = -1;
+/* the blocking descriptor children inherit with -p, -1 otherwise */
+static int gChildFd = -1;
+static char gDir[JOBSERVER_PATHLEN] = "";
+static char gFifo[JOBSERVER_PATHLEN + 8] = "";
+static int gSlots = 0;
+static int gGen = 0;
+/* the shell that made the FIFO, a subshell leaves it alone */
+static pid_t gOwner = 0;
+static volatile sig_atomic_t gImplicitFree = 0;
+static volatile sig_atomic_t gCancelled = 0;
+/* MAKEFLAGS before the jobserver replaced it, NULL if it was not set */
+static char* gOldMakeflags = NULL;
+
+/************Function Prototypes******************************************/
+static bool start(int slots, bool pipeStyle);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void JobserverConfigure(int argc, char** argv)
+{
+  int slots, idle = 0;
+  bool pipeStyle = FALSE;
+  char* end;
+
+  if (argc == 1)
+  {
+    if (gFd == -1)
+      OutPrintf("jobserver: off\n");
+    else
+    {
+      ioctl(gFd, FIONREAD, &idle);
+      OutPrintf("jobserver: %d slots, %d free\n", gSlots, idle + (gImplicitFree ? 1 : 0));
+      OutPrintf("MAKEFLAGS=%s\n", getenv("MAKEFLAGS"));
+    }
+    return;
+  }
+  if (argc == 2 && strcmp(argv[1], "off") == 0)
+  {
+    JobserverStop();
+    return;
+  }
+  if (argc == 3 && strcmp(argv[1], "-p") == 0)
+    pipeStyle = TRUE;
+  else if (argc != 2)
+  {
+    fprintf(stderr, "usage: jobserver [-p] SLOTS | off\n");
+    return;
+  }
+  slots = strtol(argv[argc - 1], &end, 10);
+  if (*end != '\0' || slots < 1 || slots > 4096)
+  {
+    fprintf(stderr, "jobserver: %s: not a number of slots\n", argv[argc - 1]);
+    return;
+  }
+  JobserverStop();
+  if (!start(slots, pipeStyle))
+  {
+    PrintPError("jobserver");
+    JobserverStop();
+  }
+}
+
+int JobserverAcquire(void (*reap)())
+{
+  sigset_t block, old;
+  struct pollfd ready;
+  unsigned char byte;
+  int token = JOBSERVER_NONE;
+
+  if (gFd == -1)
+    return JOBSERVER_NONE;
+
+  //Hold the signals that hand slots back or cancel, ppoll() lets them in while it sleeps
+  sigemptyset(&block);
+  sigaddset(&block, SIGCHLD);
+  sigaddset(&block, SIGINT);
+  sigprocmask(SIG_BLOCK, &block, &old);
+  gCancelled = 0;
+  while (token == JOBSERVER_NONE)
+  {
+    if (reap != NULL)
+      reap();
+    if (gImplicitFree)
+    {
+      gImplicitFree = 0;
+      token = TOKEN(gGen, JOBSERVER_IMPLICIT);
+    }
+    else if (read(gFd, &byte, 1) == 1)
+      token = TOKEN(gGen, byte);
+    else if (errno != EAGAIN && errno != EINTR)
+      break;
+    else if (gCancelled)
+      token = JOBSERVER_CANCELLED;
+    else
+    {
+      ready.fd = gFd;
+      ready.events = POLLIN;
+      ppoll(&ready, 1, NULL, &old);
+    }
+  }
+  sigprocmask(SIG_SETMASK, &old, NULL);
+  return token;
+}
+
+void JobserverRelease(int token)
+{
+  int saved = errno;
+  unsigned char byte;
+
+  if (token < 0 || gFd == -1 || TOKEN_GEN(token) != gGen)
+    return;
+  if (TOKEN_BYTE(token) == JOBSERVER_IMPLICIT)
+    gImplicitFree = 1;
+  else
+  {
+    byte = TOKEN_BYTE(token);
+    while (write(gFd, &byte, 1) == -1 && errno == EINTR);
+  }
+  errno = saved;
+}
+
+void JobserverCancel()
+{
+  gCancelled = 1;
+}
+
+void JobserverStop()
+{
+  if (gFd == -1)
+    return;
+  close(gFd);
+  gFd = -1;
+  if (gChildFd != -1)
+    close(gChildFd);
+  gChildFd = -1;
+  if (getpid() == gOwner)
+  {
+    unlink(gFifo);
+    rmdir(gDir);
+  }
+  if (gOldMakeflags != NULL)
+    setenv("MAKEFLAGS", gOldMakeflags, 1);
+  else
+    unsetenv("MAKEFLAGS");
+  free(gOldMakeflags);
+  gOldMakeflags = NULL;
+  gSlots = 0;
+}
+
+/*Create the FIFO, fill it with tokens and announce it in MAKEFLAGS*/
+static bool start(int slots, bool pipeStyle)
+{
+  char makeflags[2 * JOBSERVER_PATHLEN];
+  unsigned char tokens[4096];
+  char* tmp = getenv("TMPDIR");
+
+  if (tmp == NULL || tmp[0] == '\0')
+    tmp = "/tmp";
+  if (snprintf(gDir, sizeof(gDir), "%s/tsh-jobserver.XXXXXX", tmp) >= sizeof(gDir) ||
+      mkdtemp(gDir) == NULL)
+    return FALSE;
+  snprintf(gFifo, sizeof(gFifo), "%s/fifo", gDir);
+  if (mkfifo(gFifo, 0600) == -1)
+  {
+    rmdir(gDir);
+    return FALSE;
+  }
+  gOwner = getpid();
+  //Read-write so the shell never sees the end of the FIFO nor blocks opening it
+  gFd = open(gFifo, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (gFd == -1)
+  {
+    unlink(gFifo);
+    rmdir(gDir);
+    return FALSE;
+  }
+  if (getenv("MAKEFLAGS") != NULL)
+    gOldMakeflags = strdup(getenv("MAKEFLAGS"));
+  gGen++;
+  gSlots = slots;
+  gImplicitFree = 1;
+  memset(tokens, '+', slots - 1);
+  if (slots > 1 && write(gFd, tokens, slots - 1) != slots - 1)
+    return FALSE;
+
+  //Older make only knows descriptors it inherits, they have to block
+  if (pipeStyle)
+  {
+    gChildFd = open(gFifo, O_RDWR);
+    if (gChildFd == -1)
+      return FALSE;
+    snprintf(makeflags, sizeof(makeflags), " -j%d --jobserver-auth=%d,%d", slots, gChildFd, gChildFd);
+  }
+  else
+    snprintf(makeflags, sizeof(makeflags), " -j%d --jobserver-auth=fifo:%s", slots, gFifo);
+  setenv("MAKEFLAGS", makeflags, 1);
+  return TRUE;
+}
@@ -0,0 +1,100 @@
+/***************************************************************************
+ *  Title: Jobserver
+ * -------------------------------------------------------------------------
+ *    Purpose: GNU make jobserver shared by the shell and its children
+ *    File: jobserver.h
+ ***************************************************************************/
+
+#ifndef __JOBSERVER_H__
+#define __JOBSERVER_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __JOBSERVER_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* JobserverAcquire() results besides a token */
+#define JOBSERVER_NONE      -1   /* no jobserver, run without a token */
+#define JOBSERVER_CANCELLED -2   /* ctrl-c while waiting, do not run */
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Configure the jobserver
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "jobserver [-p] SLOTS" and "jobserver off";
+ *    prints the current setup when called without arguments. The
+ *    token FIFO is announced to children in MAKEFLAGS, as
+ *    fifo:PATH or, with -p, as an inherited descriptor pair for
+ *    make before 4.4.
+ *    Input: argc/argv of the jobserver builtin
+ *    Output: void
+ ***********************************************************************/
+EXTERN void JobserverConfigure(int, char**);
+
+/***********************************************************************
+ *  Title: Take a token for a background job
+ * ---------------------------------------------------------------------
+ *    Purpose: Waits until a slot is free. The shell's own implicit
+ *    slot is used first, then tokens from the FIFO. Must be called
+ *    with SIGCHLD unblocked, finished jobs hand their tokens back
+ *    from the handler.
+ *    Input: a function called with SIGCHLD held after every wakeup,
+ *    for jobs reported outside the handler (NULL for none)
+ *    Output: the token, JOBSERVER_NONE or JOBSERVER_CANCELLED
+ ***********************************************************************/
+EXTERN int JobserverAcquire(void (*)());
+
+/***********************************************************************
+ *  Title: Give a token back
+ * ---------------------------------------------------------------------
+ *    Purpose: Returns the token of a finished job. Safe in a signal
+ *    handler; tokens of a jobserver that was stopped since are dropped.
+ *    Input: the token (negative values are ignored)
+ *    Output: void
+ ***********************************************************************/
+EXTERN void JobserverRelease(int);
+
+/***********************************************************************
+ *  Title: Stop waiting for a token
+ * ---------------------------------------------------------------------
+ *    Purpose: Makes a JobserverAcquire() in progress give up, called
+ *    from the SIGINT handler.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void JobserverCancel();
+
+/***********************************************************************
+ *  Title: Shut the jobserver down
+ * ---------------------------------------------------------------------
+ *    Purpose: Removes the FIFO and restores MAKEFLAGS.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void JobserverStop();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __JOBSERVER_H__ */
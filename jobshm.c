@@ -0,0 +1,180 @@
+/***************************************************************************
+ *  Title: Shared job table
+ * -------------------------------------------------------------------------
+ *    Purpose: Publishes the jobs of the shell in /dev/shm for tshtop
+ *    File: jobshm.c
+ ***************************************************************************/
+#define __JOBSHM_IMPL__
+
+/************System include***********************************************/
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "jobshm.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+/* the mapped segment, NULL when there is none */
+static jobShmT* gShm = NULL;
+static char gPath[64];
+/* the shell that created it, a subshell only unmaps it */
+static pid_t gOwner = 0;
+/* jobs put so far in the current update */
+static int gN = 0;
+
+/************Function Prototypes******************************************/
+static long long now();
+static void reclaim();
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void JobShmOpen()
+{
+  char* tty;
+  void* map;
+  int fd;
+
+  reclaim();
+  snprintf(gPath, sizeof(gPath), "%s/%s%d", JOBSHM_DIR, JOBSHM_PREFIX, (int)getpid());
+  //A shell that died without cleaning up may have had our pid
+  fd = open(gPath, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd == -1 && errno == EEXIST && unlink(gPath) == 0)
+    fd = open(gPath, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd == -1)
+    return;
+  if (ftruncate(fd, sizeof(jobShmT)) == -1 ||
+      (map = mmap(NULL, sizeof(jobShmT), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    close(fd);
+    unlink(gPath);
+    return;
+  }
+  close(fd);
+
+  //The file is zeroed, seq is even and the table empty until the header is valid
+  gShm = map;
+  gShm->pid = getpid();
+  gShm->started = gShm->updated = now();
+  if ((tty = ttyname(0)) != NULL)
+    snprintf(gShm->tty, sizeof(gShm->tty), "%s", strncmp(tty, "/dev/", 5) == 0 ? tty + 5 : tty);
+  gShm->version = JOBSHM_VERSION;
+  __atomic_store_n(&gShm->magic, JOBSHM_MAGIC, __ATOMIC_RELEASE);
+  gOwner = getpid();
+}
+
+void JobShmClose()
+{
+  if (gShm == NULL)
+    return;
+  munmap(gShm, sizeof(jobShmT));
+  gShm = NULL;
+  if (getpid() == gOwner)
+    unlink(gPath);
+}
+
+void JobShmUnlink()
+{
+  if (gShm != NULL && getpid() == gOwner)
+    unlink(gPath);
+}
+
+bool JobShmBegin()
+{
+  if (gShm == NULL)
+    return FALSE;
+  //Odd: readers keep off until JobShmEnd(); the fence keeps the jobs from being written before
+  __atomic_store_n(&gShm->seq, gShm->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  gN = 0;
+  gShm->more = 0;
+  return TRUE;
+}
+
+void JobShmPut(pid_t pid, int jobNumber, char* status, char* command, long long started,
+               long long ended, int exitStatus, struct rusage* usage)
+{
+  jobShmJobT* job;
+
+  if (gN == JOBSHM_JOBS)
+  {
+    gShm->more++;
+    return;
+  }
+  job = &gShm->jobs[gN++];
+  job->pid = pid;
+  job->jobNumber = jobNumber;
+  job->status = status[0];
+  job->exitStatus = exitStatus;
+  job->started = started;
+  job->ended = ended;
+  if (usage != NULL)
+  {
+    job->utime = usage->ru_utime.tv_sec * 1000000LL + usage->ru_utime.tv_usec;
+    job->stime = usage->ru_stime.tv_sec * 1000000LL + usage->ru_stime.tv_usec;
+    job->maxrss = usage->ru_maxrss;
+  }
+  else
+    job->utime = job->stime = job->maxrss = 0;
+  strncpy(job->command, command != NULL ? command : "", JOBSHM_CMDLEN - 1);
+  job->command[JOBSHM_CMDLEN - 1] = '\0';
+}
+
+void JobShmEnd()
+{
+  gShm->njobs = gN;
+  gShm->updated = now();
+  __atomic_store_n(&gShm->seq, gShm->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*Remove the segments of shells that were killed without a chance to clean up*/
+static void reclaim()
+{
+  char path[sizeof(JOBSHM_DIR) + 256];
+  struct dirent* d;
+  DIR* dir;
+  char* end;
+  long pid;
+
+  if ((dir = opendir(JOBSHM_DIR)) == NULL)
+    return;
+  while ((d = readdir(dir)) != NULL)
+  {
+    if (strncmp(d->d_name, JOBSHM_PREFIX, strlen(JOBSHM_PREFIX)) != 0)
+      continue;
+    pid = strtol(d->d_name + strlen(JOBSHM_PREFIX), &end, 10);
+    if (*end != '\0' || pid <= 0 || pid == getpid())
+      continue;
+    if (kill(pid, 0) == -1 && errno == ESRCH)
+    {
+      snprintf(path, sizeof(path), "%s/%s", JOBSHM_DIR, d->d_name);
+      unlink(path);
+    }
+  }
+  closedir(dir);
+}
+
+static long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -0,0 +1,167 @@
+/***************************************************************************
+ *  Title: Shared job table
+ * -------------------------------------------------------------------------
+ *    Purpose: Publishes the jobs of the shell in /dev/shm for tshtop
+ *    File: jobshm.h
+ ***************************************************************************/
+
+#ifndef __JOBSHM_H__
+#define __JOBSHM_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <stdint.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __JOBSHM_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* every shell has /dev/shm/tsh-jobs.PID */
+#define JOBSHM_DIR      "/dev/shm"
+#define JOBSHM_PREFIX   "tsh-jobs."
+#define JOBSHM_MAGIC    0x4a485354   /* "TSHJ" */
+/* bump whenever the layout of the segment changes */
+#define JOBSHM_VERSION  1
+#define JOBSHM_JOBS     64
+#define JOBSHM_CMDLEN   112
+
+/* one job; times are CLOCK_MONOTONIC ns, resources are only known once it is Done */
+typedef struct jobshm_job_t
+{
+  int32_t pid;
+  int32_t jobNumber;    /* 0 for the foreground job */
+  char status;          /* 'R'unning, 'S'topped or 'D'one */
+  char pad[3];
+  int32_t exitStatus;   /* once Done */
+  int64_t started;
+  int64_t ended;        /* once Done */
+  int64_t utime;        /* us */
+  int64_t stime;        /* us */
+  int64_t maxrss;       /* kB */
+  char command[JOBSHM_CMDLEN];
+} jobShmJobT;
+
+/*
+ * The segment is a seqlock: seq is odd while the shell rewrites the
+ * table and goes up by two with every update. The shell never waits
+ * for readers; a reader copies the table and tries again when seq was
+ * odd or changed meanwhile.
+ */
+typedef struct jobshm_t
+{
+  uint32_t magic;       /* JOBSHM_MAGIC */
+  uint32_t version;     /* JOBSHM_VERSION */
+  uint32_t seq;
+  int32_t pid;          /* the shell */
+  int32_t njobs;
+  int32_t more;         /* jobs left out, the table was full */
+  int64_t started;      /* when the shell started */
+  int64_t updated;      /* last update */
+  char tty[32];         /* terminal of the shell, "" for none */
+  jobShmJobT jobs[JOBSHM_JOBS];
+} jobShmT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Create the shared job table
+ * ---------------------------------------------------------------------
+ *    Purpose: Creates and maps the segment of this shell. Segments
+ *    that shells killed by a signal left behind are removed first, and
+ *    one with our own pid is replaced. Without /dev/shm the table is
+ *    silently not published.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void JobShmOpen();
+
+/***********************************************************************
+ *  Title: Remove the shared job table
+ * ---------------------------------------------------------------------
+ *    Purpose: Unmaps the segment, and removes it in the shell that
+ *    created it. A subshell calls it to stop publishing its copy of the
+ *    job table over the one of the shell.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void JobShmClose();
+
+/***********************************************************************
+ *  Title: Remove the shared job table on a fatal signal
+ * ---------------------------------------------------------------------
+ *    Purpose: Removes the segment in the shell that created it but
+ *    leaves it mapped. Safe in a signal handler, for the signals that
+ *    end the shell.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void JobShmUnlink();
+
+/***********************************************************************
+ *  Title: Rewrite the shared job table
+ * ---------------------------------------------------------------------
+ *    Purpose: JobShmBegin() starts an update, JobShmPut() adds the jobs
+ *    one by one and JobShmEnd() publishes them. Safe in a signal
+ *    handler, but an update must not be interrupted by another one:
+ *    callers block SIGCHLD around it.
+ *    Input: JobShmPut(): pid, job number, status, command line, start
+ *    and end time, exit status and the resources used (NULL while it
+ *    runs)
+ *    Output: JobShmBegin(): false when there is no table
+ ***********************************************************************/
+EXTERN bool JobShmBegin();
+EXTERN void JobShmPut(pid_t, int, char*, char*, long long, long long, int, struct rusage*);
+EXTERN void JobShmEnd();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+/***********************************************************************
+ *  Title: Read a shared job table
+ * ---------------------------------------------------------------------
+ *    Purpose: Copies a consistent snapshot of a mapped segment, for
+ *    readers such as tshtop
+ *    Input: the mapping and where to copy it
+ *    Output: false if the shell kept rewriting it or it is not a table
+ ***********************************************************************/
+static inline bool JobShmRead(const jobShmT* shm, jobShmT* copy)
+{
+  uint32_t seq;
+  int tries;
+
+  for (tries = 0; tries < 100; tries++)
+  {
+    seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+    memcpy(copy, shm, sizeof(*copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+      return copy->magic == JOBSHM_MAGIC && copy->version == JOBSHM_VERSION &&
+             copy->njobs >= 0 && copy->njobs <= JOBSHM_JOBS;
+  }
+  return FALSE;
+}
+
+#endif /* __JOBSHM_H__ */
@@ -0,0 +1,169 @@
+/***************************************************************************
+ *  Title: Loadable builtins
+ * -------------------------------------------------------------------------
+ *    Purpose: Builtins loaded from shared objects with "enable -f"
+ *    File: loadable.c
+ ***************************************************************************/
+#define __LOADABLE_IMPL__
+
+/************System include***********************************************/
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "loadable.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* a loaded builtin; each holds a reference of its own to the shared object */
+typedef struct loadable_t
+{
+  char* name;
+  char* path;
+  void* handle;
+  tshBuiltinT* builtin;
+  struct loadable_t* next;
+} loadableT;
+
+/************Global Variables*********************************************/
+
+static loadableT* gLoaded = NULL;
+
+/************Function Prototypes******************************************/
+static loadableT** findEntry(char*);
+static int load(char*, char*, bool (*)(char*));
+static int unload(char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+int LoadableEnable(int argc, char** argv, bool (*taken)(char*))
+{
+  loadableT* l;
+  int i, status = 0;
+
+  if (argc == 1)
+  {
+    for (l = gLoaded; l != NULL; l = l->next)
+      OutPrintf("%-12s %s  %s\n", l->name, l->path, l->builtin->usage != NULL ? l->builtin->usage : "");
+    return 0;
+  }
+  if (argc >= 4 && strcmp(argv[1], "-f") == 0)
+  {
+    for (i = 3; i < argc; i++)
+      status |= load(argv[2], argv[i], taken);
+    return status;
+  }
+  if (argc >= 3 && strcmp(argv[1], "-d") == 0)
+  {
+    for (i = 2; i < argc; i++)
+      status |= unload(argv[i]);
+    return status;
+  }
+  fprintf(stderr, "usage: enable [-f FILE NAME... | -d NAME...]\n");
+  return 1;
+}
+
+tshBuiltinT* LoadableFind(char* name)
+{
+  loadableT* l;
+
+  for (l = gLoaded; l != NULL; l = l->next)
+    if (strcmp(l->name, name) == 0)
+      return l->builtin;
+  return NULL;
+}
+
+int LoadableRun(tshBuiltinT* builtin, int argc, char** argv, int in, int out, int err)
+{
+  int status;
+
+  //0 makes glibc start over completely, also with what a previous caller left half parsed
+  optind = 0;
+  status = builtin->run(argc, argv, in, out, err);
+  //In case it wrote to stdout after all
+  fflush(stdout);
+  return status & 0xff;
+}
+
+/*Where the entry of a builtin is in the list, or where a new one would go*/
+static loadableT** findEntry(char* name)
+{
+  loadableT** l;
+
+  for (l = &gLoaded; *l != NULL && strcmp((*l)->name, name) != 0; l = &(*l)->next);
+  return l;
+}
+
+static int load(char* path, char* name, bool (*taken)(char*))
+{
+  char symbol[256];
+  tshBuiltinT* builtin;
+  loadableT *l, **at;
+  void* handle;
+
+  at = findEntry(name);
+  if (*at == NULL && taken(name))
+  {
+    fprintf(stderr, "enable: %s is a builtin of the shell\n", name);
+    return 1;
+  }
+  if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL)
+  {
+    fprintf(stderr, "enable: %s\n", dlerror());
+    return 1;
+  }
+  snprintf(symbol, sizeof(symbol), "%s_builtin", name);
+  if ((builtin = dlsym(handle, symbol)) == NULL)
+  {
+    fprintf(stderr, "enable: %s: no builtin %s in it\n", path, name);
+    dlclose(handle);
+    return 1;
+  }
+  if (builtin->abi != TSH_BUILTIN_ABI || builtin->run == NULL)
+  {
+    fprintf(stderr, "enable: %s: %s is built for interface %d, this shell has %d\n", path, name,
+            builtin->abi, TSH_BUILTIN_ABI);
+    dlclose(handle);
+    return 1;
+  }
+
+  //Loading a name again replaces it
+  if (*at != NULL)
+    unload(name);
+  l = malloc(sizeof(loadableT));
+  l->name = strdup(name);
+  l->path = strdup(path);
+  l->handle = handle;
+  l->builtin = builtin;
+  l->next = NULL;
+  *findEntry(name) = l;
+  return 0;
+}
+
+static int unload(char* name)
+{
+  loadableT **at = findEntry(name), *l = *at;
+
+  if (l == NULL)
+  {
+    fprintf(stderr, "enable: %s is not loaded\n", name);
+    return 1;
+  }
+  *at = l->next;
+  dlclose(l->handle);
+  free(l->name);
+  free(l->path);
+  free(l);
+  return 0;
+}
@@ -0,0 +1,75 @@
+/***************************************************************************
+ *  Title: Loadable builtins
+ * -------------------------------------------------------------------------
+ *    Purpose: Builtins loaded from shared objects with "enable -f"
+ *    File: loadable.h
+ ***************************************************************************/
+
+#ifndef __LOADABLE_H__
+#define __LOADABLE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "tshbuiltin.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __LOADABLE_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: The enable builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: "enable -f FILE NAME..." loads the builtins NAME from
+ *    the shared object FILE (see tshbuiltin.h), "enable -d NAME..."
+ *    unloads them and "enable" lists the loaded ones. A name that is
+ *    already a builtin of the shell cannot be loaded.
+ *    Input: argc/argv of the builtin and a test for names that are
+ *    taken by the shell
+ *    Output: the exit status
+ ***********************************************************************/
+EXTERN int LoadableEnable(int, char**, bool (*)(char*));
+
+/***********************************************************************
+ *  Title: Find a loaded builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Looks a command name up among the loaded builtins; cheap
+ *    when none are loaded, it is asked about every command
+ *    Input: the command name
+ *    Output: the builtin, NULL if none is loaded under that name
+ ***********************************************************************/
+EXTERN tshBuiltinT* LoadableFind(char*);
+
+/***********************************************************************
+ *  Title: Run a loaded builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Calls a loaded builtin in this process
+ *    Input: the builtin, argc/argv and the descriptors for its stdin,
+ *    stdout and stderr
+ *    Output: its exit status
+ ***********************************************************************/
+EXTERN int LoadableRun(tshBuiltinT*, int, char**, int, int, int);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __LOADABLE_H__ */
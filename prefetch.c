@@ -0,0 +1,204 @@
+/***************************************************************************
+ *  Title: Executable prefetch
+ * -------------------------------------------------------------------------
+ *    Purpose: Guesses the next command and reads it ahead while idle
+ *    File: prefetch.c
+ ***************************************************************************/
+#define __PREFETCH_IMPL__
+
+/************System include***********************************************/
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "prefetch.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+typedef struct pf_name_t
+{
+  char* name;        /* NULL while the slot is free */
+  char* path;        /* where the PATH lookup found it last time */
+  unsigned count;    /* times it ran */
+} pfNameT;
+
+/************Global Variables*********************************************/
+
+static bool gEnabled = TRUE;
+/* the commands seen, and how often one followed the other: gNext[a][b] */
+static pfNameT gNames[PREFETCH_NAMES];
+static unsigned short gNext[PREFETCH_NAMES][PREFETCH_NAMES];
+/* slot of the command that ran last, and of the one read ahead for the next */
+static int gLast = -1;
+static int gPredicted = -1;
+/* hit-rate counters */
+static unsigned long gPredictions = 0, gHits = 0, gPrefetched = 0;
+static unsigned long long gBytes = 0;
+
+/************Function Prototypes******************************************/
+static int findName(char*);
+static int addName(char*, char*);
+static void age();
+static int predict();
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void PrefetchRecord(char* name, char* path)
+{
+  int slot;
+
+  if (!gEnabled)
+    return;
+  slot = findName(name);
+  if (slot == -1)
+    slot = addName(name, path);
+  else if (strcmp(gNames[slot].path, path) != 0)
+  {
+    free(gNames[slot].path);
+    gNames[slot].path = strdup(path);
+  }
+
+  if (gPredicted != -1 && slot == gPredicted)
+    gHits++;
+  gPredicted = -1;
+
+  gNames[slot].count++;
+  if (gLast != -1 && ++gNext[gLast][slot] == USHRT_MAX)
+    age();
+  gLast = slot;
+}
+
+void PrefetchIdle()
+{
+  struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+  struct stat st;
+  int slot, fd;
+
+  if (!gEnabled || gLast == -1)
+    return;
+  //Input that is already there means the user is not idle (or this is not a terminal)
+  if (poll(&input, 1, 0) != 0)
+    return;
+  slot = predict();
+  if (slot == -1)
+    return;
+  gPredictions++;
+  gPredicted = slot;
+
+  fd = open(gNames[slot].path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+      posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0)
+  {
+    gPrefetched++;
+    gBytes += st.st_size;
+  }
+  close(fd);
+}
+
+void PrefetchConfigure(int argc, char** argv)
+{
+  if (argc == 1)
+  {
+    OutPrintf("prefetch: %s\n", gEnabled ? "on" : "off");
+    OutPrintf("predictions: %lu, hits: %lu (%lu%%)\n", gPredictions, gHits,
+              gPredictions == 0 ? 0 : gHits * 100 / gPredictions);
+    OutPrintf("prefetched: %lu files, %llu KB\n", gPrefetched, gBytes / 1024);
+  }
+  else if (argc == 2 && strcmp(argv[1], "on") == 0)
+    gEnabled = TRUE;
+  else if (argc == 2 && strcmp(argv[1], "off") == 0)
+  {
+    gEnabled = FALSE;
+    gPredicted = -1;
+  }
+  else
+    fprintf(stderr, "usage: prefetch [on|off]\n");
+}
+
+static int findName(char* name)
+{
+  int i;
+
+  for (i = 0; i < PREFETCH_NAMES; i++)
+    if (gNames[i].name != NULL && strcmp(gNames[i].name, name) == 0)
+      return i;
+  return -1;
+}
+
+/*Take a free slot, or the one of the command that ran least*/
+static int addName(char* name, char* path)
+{
+  int i, slot = 0;
+
+  for (i = 0; i < PREFETCH_NAMES; i++)
+  {
+    if (gNames[i].name == NULL)
+    {
+      slot = i;
+      break;
+    }
+    if (gNames[i].count < gNames[slot].count)
+      slot = i;
+  }
+  if (gNames[slot].name != NULL)
+  {
+    free(gNames[slot].name);
+    free(gNames[slot].path);
+    for (i = 0; i < PREFETCH_NAMES; i++)
+      gNext[i][slot] = 0;
+    memset(gNext[slot], 0, sizeof(gNext[slot]));
+    if (gLast == slot)
+      gLast = -1;
+    if (gPredicted == slot)
+      gPredicted = -1;
+  }
+  gNames[slot].name = strdup(name);
+  gNames[slot].path = strdup(path);
+  gNames[slot].count = 0;
+  return slot;
+}
+
+/*Halve all counts so that recent habits outweigh old ones*/
+static void age()
+{
+  int i, j;
+
+  for (i = 0; i < PREFETCH_NAMES; i++)
+  {
+    gNames[i].count /= 2;
+    for (j = 0; j < PREFETCH_NAMES; j++)
+      gNext[i][j] /= 2;
+  }
+}
+
+/*The command that most often followed the last one, else the most frequent one*/
+static int predict()
+{
+  int i, best = -1;
+
+  for (i = 0; i < PREFETCH_NAMES; i++)
+    if (gNext[gLast][i] > 0 && (best == -1 || gNext[gLast][i] > gNext[gLast][best]))
+      best = i;
+  if (best != -1)
+    return best;
+  for (i = 0; i < PREFETCH_NAMES; i++)
+    if (gNames[i].name != NULL && (best == -1 || gNames[i].count > gNames[best].count))
+      best = i;
+  return best;
+}
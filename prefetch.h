@@ -0,0 +1,78 @@
+/***************************************************************************
+ *  Title: Executable prefetch
+ * -------------------------------------------------------------------------
+ *    Purpose: Guesses the next command and reads it ahead while idle
+ *    File: prefetch.h
+ ***************************************************************************/
+
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __PREFETCH_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* number of commands the predictor keeps track of */
+#define PREFETCH_NAMES 64
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Record a command
+ * ---------------------------------------------------------------------
+ *    Purpose: Feeds an external command that is about to run to the
+ *    predictor, which counts how often each command follows the one
+ *    before it, and scores the last prediction.
+ *    Input: the command name and the path it was found at
+ *    Output: void
+ ***********************************************************************/
+EXTERN void PrefetchRecord(char*, char*);
+
+/***********************************************************************
+ *  Title: Prefetch the likely next command
+ * ---------------------------------------------------------------------
+ *    Purpose: Called before the shell blocks for input. When no input
+ *    is waiting, asks the kernel to read the executable of the most
+ *    likely next command into the page cache (posix_fadvise
+ *    WILLNEED, which does not block).
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void PrefetchIdle();
+
+/***********************************************************************
+ *  Title: Configure prefetching
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "prefetch on|off"; prints whether it is on
+ *    and the hit rate of the predictions when called without
+ *    arguments.
+ *    Input: argc/argv of the prefetch builtin
+ *    Output: void
+ ***********************************************************************/
+EXTERN void PrefetchConfigure(int, char**);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __PREFETCH_H__ */
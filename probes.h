@@ -0,0 +1,123 @@
+/***************************************************************************
+ *  Title: Static tracepoints
+ * -------------------------------------------------------------------------
+ *    Purpose: USDT probes (provider tsh) for bpftrace and SystemTap
+ *    File: probes.h
+ ***************************************************************************/
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <time.h>
+
+/*
+ * The probes need <sys/sdt.h> (systemtap-sdt-dev); without it they
+ * compile to nothing. A probe is a single nop in the binary, so the
+ * only cost when nothing is attached is working out its arguments.
+ * Probes with a duration read the clock only while their semaphore is
+ * raised, which tracers do when they attach. Build with
+ * -D TSH_NO_PROBES to leave them out on a system that has the header.
+ */
+#if !defined(TSH_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define TSH_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef TSH_HAVE_PROBES
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#endif
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#ifdef TSH_HAVE_PROBES
+
+/* every probe has a semaphore, tsh.c defines them */
+#ifdef __PROBES_IMPL__
+#define PROBE_SEMAPHORE(name) \
+  unsigned short tsh_##name##_semaphore __attribute__ ((section (".probes"))) = 0
+#else
+#define PROBE_SEMAPHORE(name) extern unsigned short tsh_##name##_semaphore
+#endif
+
+#define PROBE0(name)                DTRACE_PROBE(tsh, name)
+#define PROBE1(name, a)             DTRACE_PROBE1(tsh, name, a)
+#define PROBE2(name, a, b)          DTRACE_PROBE2(tsh, name, a, b)
+#define PROBE3(name, a, b, c)       DTRACE_PROBE3(tsh, name, a, b, c)
+#define PROBE_ENABLED(name)         __builtin_expect(tsh_##name##_semaphore, 0)
+
+#else
+
+/* the arguments are never evaluated, only kept from looking unused */
+#define PROBE_SEMAPHORE(name)       struct probe_unused_##name
+#define PROBE0(name)                do { } while (0)
+#define PROBE1(name, a)             do { if (0) { (void)(a); } } while (0)
+#define PROBE2(name, a, b)          do { if (0) { (void)(a); (void)(b); } } while (0)
+#define PROBE3(name, a, b, c)       do { if (0) { (void)(a); (void)(b); (void)(c); } } while (0)
+#define PROBE_ENABLED(name)         0
+
+#endif
+
+/*
+ *  probe                arguments
+ *  parse__start         line
+ *  parse__done          command name, number of commands, ns spent parsing
+ *  builtin__start       builtin name
+ *  builtin__done        builtin name, exit status, ns spent running it
+ *  fork__start          command name, 1 for a background job
+ *  fork__done           child pid, command name, ns spent in fork
+ *  exec__start          command name, ns since fork__start (in the child)
+ *  exec__fail           command name, errno (in the child)
+ *  reap                 pid, wait status, job number (0 for the foreground job)
+ *  job__state           pid, job number, new status ("Running", "Stopped", "Done")
+ */
+PROBE_SEMAPHORE(parse__start);
+PROBE_SEMAPHORE(parse__done);
+PROBE_SEMAPHORE(builtin__start);
+PROBE_SEMAPHORE(builtin__done);
+PROBE_SEMAPHORE(fork__start);
+PROBE_SEMAPHORE(fork__done);
+PROBE_SEMAPHORE(exec__start);
+PROBE_SEMAPHORE(exec__fail);
+PROBE_SEMAPHORE(reap);
+PROBE_SEMAPHORE(job__state);
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Clock for probe durations
+ * ---------------------------------------------------------------------
+ *    Purpose: Reads the monotonic clock when the probe is attached
+ *    Input: PROBE_ENABLED() of the probe the time is for
+ *    Output: nanoseconds, 0 when the probe is not attached
+ ***********************************************************************/
+static inline long long ProbeClock(int enabled)
+{
+  struct timespec ts;
+
+  if (!enabled)
+    return 0;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __PROBES_H__ */
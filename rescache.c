@@ -0,0 +1,441 @@
+/***************************************************************************
+ *  Title: Result cache
+ * -------------------------------------------------------------------------
+ *    Purpose: Stored output and exit status of deterministic commands
+ *    File: rescache.c
+ ***************************************************************************/
+#define __RESCACHE_IMPL__
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "rescache.h"
+#include "io.h"
+#include "script.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define RESCACHE_PATHLEN 1024
+/* bump whenever the layout of an entry changes */
+#define RESCACHE_VERSION 1
+
+#define FNV128_BASIS (((unsigned __int128)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL)
+#define FNV128_PRIME (((unsigned __int128)0x0000000001000000ULL << 64) | 0x000000000000013bULL)
+
+/* an entry is this header followed by the stdout and the stderr of the command */
+typedef struct result_hdr_t
+{
+  char magic[4];       /* "TSHR" */
+  uint32_t version;    /* RESCACHE_VERSION */
+  int32_t status;      /* exit status */
+  uint32_t pad;
+  uint64_t outLen;
+  uint64_t errLen;
+  int64_t runNs;       /* how long the command took */
+} resultHdrT;
+
+/* an entry seen while trimming the cache */
+typedef struct result_entry_t
+{
+  char name[40];
+  struct timespec used;
+  off_t size;
+} resultEntryT;
+
+/************Global Variables*********************************************/
+
+static long long gLimit = RESCACHE_LIMIT;
+/* what this shell did with the cache */
+static unsigned long gHits = 0, gMisses = 0, gStored = 0, gEvicted = 0;
+static long long gSaved = 0;   /* ns of run time the hits took originally */
+
+/************Function Prototypes******************************************/
+static void addBytes(resultKeyT*, const void*, size_t);
+static bool resultDir(char*, size_t);
+static bool entryPath(resultKeyT*, char*, size_t);
+static bool copyRange(int, off_t, size_t, int);
+static void markUsed(int);
+static int scanEntries(resultEntryT**, long long*);
+static int cmpUsed(const void*, const void*);
+static void evict();
+static void printSize(long long);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void ResultKeyInit(resultKeyT* key)
+{
+  key->h = FNV128_BASIS;
+}
+
+void ResultKeyAdd(resultKeyT* key, const char* s)
+{
+  uint64_t len = strlen(s);
+  addBytes(key, &len, sizeof(len));
+  addBytes(key, s, len);
+}
+
+void ResultKeyFile(resultKeyT* key, const char* path, bool byMtime)
+{
+  struct stat st;
+  uint64_t id[5];
+  void* data;
+  int fd;
+
+  ResultKeyAdd(key, path);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1 || fstat(fd, &st) == -1)
+  {
+    ResultKeyAdd(key, "\001missing");
+    if (fd != -1)
+      close(fd);
+    return;
+  }
+  //Directories and devices have no contents to go by
+  if (byMtime || !S_ISREG(st.st_mode))
+  {
+    id[0] = st.st_dev;
+    id[1] = st.st_ino;
+    id[2] = st.st_size;
+    id[3] = st.st_mtim.tv_sec;
+    id[4] = st.st_mtim.tv_nsec;
+    addBytes(key, id, sizeof(id));
+  }
+  else
+  {
+    id[0] = st.st_size;
+    addBytes(key, id, sizeof(id[0]));
+    if (st.st_size > 0 && (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+    {
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      addBytes(key, data, st.st_size);
+      munmap(data, st.st_size);
+    }
+  }
+  close(fd);
+}
+
+bool ResultReplay(resultKeyT* key, int outFd, int errFd, int* status)
+{
+  char path[RESCACHE_PATHLEN];
+  resultHdrT hdr;
+  struct stat st;
+  int fd;
+
+  if (!entryPath(key, path, sizeof(path)) || (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+  {
+    gMisses++;
+    return FALSE;
+  }
+  if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr.magic, "TSHR", 4) != 0 ||
+      hdr.version != RESCACHE_VERSION || fstat(fd, &st) == -1 ||
+      st.st_size != sizeof(hdr) + hdr.outLen + hdr.errLen)
+  {
+    close(fd);
+    unlink(path);
+    gMisses++;
+    return FALSE;
+  }
+  copyRange(fd, sizeof(hdr), hdr.outLen, outFd);
+  copyRange(fd, sizeof(hdr) + hdr.outLen, hdr.errLen, errFd);
+  markUsed(fd);
+  close(fd);
+  gHits++;
+  gSaved += hdr.runNs;
+  *status = hdr.status;
+  return TRUE;
+}
+
+bool ResultCapture(int* fds)
+{
+  char dir[RESCACHE_PATHLEN];
+  char tmp[RESCACHE_PATHLEN + 16];
+  int i;
+
+  if (!resultDir(dir, sizeof(dir)))
+    return FALSE;
+  for (i = 0; i < 2; i++)
+  {
+    fds[i] = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    //File systems without O_TMPFILE get a named file that is gone right away
+    if (fds[i] == -1)
+    {
+      snprintf(tmp, sizeof(tmp), "%s/.capture.XXXXXX", dir);
+      if ((fds[i] = mkostemp(tmp, O_CLOEXEC)) != -1)
+        unlink(tmp);
+    }
+    if (fds[i] == -1)
+    {
+      if (i == 1)
+        close(fds[0]);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+void ResultStore(resultKeyT* key, int* fds, int status, long long runNs, bool keep, int outFd, int errFd)
+{
+  char path[RESCACHE_PATHLEN];
+  char tmp[RESCACHE_PATHLEN + 16];
+  resultHdrT hdr;
+  bool ok;
+  int fd;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, "TSHR", 4);
+  hdr.version = RESCACHE_VERSION;
+  hdr.status = status;
+  hdr.outLen = lseek(fds[0], 0, SEEK_END);
+  hdr.errLen = lseek(fds[1], 0, SEEK_END);
+  hdr.runNs = runNs;
+  copyRange(fds[0], 0, hdr.outLen, outFd);
+  copyRange(fds[1], 0, hdr.errLen, errFd);
+
+  //Written under a temporary name, so other shells never see half an entry
+  if (keep && entryPath(key, path, sizeof(path)))
+  {
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) != -1)
+    {
+      ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+           copyRange(fds[0], 0, hdr.outLen, fd) && copyRange(fds[1], 0, hdr.errLen, fd);
+      markUsed(fd);
+      close(fd);
+      if (!ok || rename(tmp, path) == -1)
+        unlink(tmp);
+      else
+      {
+        gStored++;
+        evict();
+      }
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void ResultCacheConfigure(int argc, char** argv)
+{
+  char dir[RESCACHE_PATHLEN];
+  char path[RESCACHE_PATHLEN + 48];
+  resultEntryT* entries;
+  long long total, size;
+  char* end;
+  int n, i;
+
+  if (argc == 2 && strcmp(argv[1], "--stats") == 0)
+  {
+    OutPrintf("hits %lu, misses %lu", gHits, gMisses);
+    if (gHits + gMisses > 0)
+      OutPrintf(" (%.1f%% hits)", 100.0 * gHits / (gHits + gMisses));
+    OutPrintf(", %.3fs of run time saved\n", gSaved / 1e9);
+    OutPrintf("stored %lu, evicted %lu\n", gStored, gEvicted);
+    n = scanEntries(&entries, &total);
+    free(entries);
+    OutPrintf("%d entries, ", n);
+    printSize(total);
+    OutPrintf(" of ");
+    printSize(gLimit);
+    if (resultDir(dir, sizeof(dir)))
+      OutPrintf(" in %s\n", dir);
+    else
+      OutPrintf(", no cache directory\n");
+  }
+  else if (argc == 2 && strcmp(argv[1], "--clear") == 0)
+  {
+    n = scanEntries(&entries, &total);
+    if (n > 0 && resultDir(dir, sizeof(dir)))
+      for (i = 0; i < n; i++)
+      {
+        snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+        unlink(path);
+      }
+    free(entries);
+  }
+  else if (argc == 3 && strcmp(argv[1], "--limit") == 0 &&
+           (size = strtoll(argv[2], &end, 10)) >= 0 && end != argv[2])
+  {
+    if (*end == 'K' || *end == 'k')
+      size <<= 10, end++;
+    else if (*end == 'M' || *end == 'm')
+      size <<= 20, end++;
+    else if (*end == 'G' || *end == 'g')
+      size <<= 30, end++;
+    if (*end != '\0')
+    {
+      fprintf(stderr, "cached: bad size %s\n", argv[2]);
+      return;
+    }
+    gLimit = size;
+    evict();
+  }
+  else
+    fprintf(stderr, "usage: cached [--inputs FILE,...] [--env VAR,...] [--mtime] cmd [args...]\n"
+                    "       cached --stats | --clear | --limit SIZE\n");
+}
+
+/*FNV-1a, 128 bits wide*/
+static void addBytes(resultKeyT* key, const void* data, size_t len)
+{
+  const unsigned char* p = data;
+  unsigned __int128 h = key->h;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    h = (h ^ p[i]) * FNV128_PRIME;
+  key->h = h;
+}
+
+/*The directory results are kept in, created when needed*/
+static bool resultDir(char* dir, size_t size)
+{
+  char base[RESCACHE_PATHLEN];
+
+  if (!CacheDir(base, sizeof(base)) || snprintf(dir, size, "%s/results", base) >= size)
+    return FALSE;
+  return mkdir(dir, 0700) == 0 || errno == EEXIST;
+}
+
+static bool entryPath(resultKeyT* key, char* path, size_t size)
+{
+  char dir[RESCACHE_PATHLEN];
+
+  return resultDir(dir, sizeof(dir)) &&
+         snprintf(path, size, "%s/%016llx%016llx", dir, (unsigned long long)(key->h >> 64),
+                  (unsigned long long)key->h) < size;
+}
+
+/*Copy part of a file to a descriptor, in the kernel when it can*/
+static bool copyRange(int from, off_t offset, size_t len, int to)
+{
+  char buf[65536];
+  ssize_t n;
+
+  while (len > 0)
+  {
+    n = sendfile(to, from, &offset, len);
+    if (n == -1 && (errno == EINVAL || errno == ENOSYS))
+    {
+      n = pread(from, buf, len < sizeof(buf) ? len : sizeof(buf), offset);
+      if (n > 0 && (n = write(to, buf, n)) > 0)
+        offset += n;
+    }
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return FALSE;
+    len -= n;
+  }
+  return TRUE;
+}
+
+/*The mtime of an entry is when it was last used, eviction goes by it.
+  Set from the clock: the file system would round it to a tick*/
+static void markUsed(int fd)
+{
+  struct timespec ts[2];
+
+  clock_gettime(CLOCK_REALTIME, &ts[0]);
+  ts[1] = ts[0];
+  futimens(fd, ts);
+}
+
+/*List the entries in the cache directory, returns how many there are*/
+static int scanEntries(resultEntryT** entries, long long* total)
+{
+  char dir[RESCACHE_PATHLEN];
+  DIR* d;
+  struct dirent* e;
+  struct stat st;
+  int n = 0, size = 0;
+
+  *entries = NULL;
+  *total = 0;
+  if (!resultDir(dir, sizeof(dir)) || (d = opendir(dir)) == NULL)
+    return 0;
+  while ((e = readdir(d)) != NULL)
+  {
+    //Entries are 32 hex digits, anything else is being written or not ours
+    if (strlen(e->d_name) != 32 || strspn(e->d_name, "0123456789abcdef") != 32 ||
+        fstatat(dirfd(d), e->d_name, &st, 0) == -1)
+      continue;
+    if (n == size)
+    {
+      size = size * 2 + 64;
+      *entries = realloc(*entries, sizeof(resultEntryT) * size);
+    }
+    snprintf((*entries)[n].name, sizeof((*entries)[n].name), "%s", e->d_name);
+    (*entries)[n].used = st.st_mtim;
+    (*entries)[n].size = st.st_size;
+    *total += st.st_size;
+    n++;
+  }
+  closedir(d);
+  return n;
+}
+
+static int cmpUsed(const void* a, const void* b)
+{
+  const struct timespec *x = &((const resultEntryT*)a)->used, *y = &((const resultEntryT*)b)->used;
+  if (x->tv_sec != y->tv_sec)
+    return x->tv_sec < y->tv_sec ? -1 : 1;
+  return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+/*Remove the least recently used entries until the cache fits its limit*/
+static void evict()
+{
+  char dir[RESCACHE_PATHLEN];
+  char path[RESCACHE_PATHLEN + 48];
+  resultEntryT* entries;
+  long long total;
+  int n, i;
+
+  n = scanEntries(&entries, &total);
+  if (total > gLimit && resultDir(dir, sizeof(dir)))
+  {
+    qsort(entries, n, sizeof(resultEntryT), cmpUsed);
+    for (i = 0; i < n && total > gLimit; i++)
+    {
+      snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+      if (unlink(path) == 0)
+      {
+        total -= entries[i].size;
+        gEvicted++;
+      }
+    }
+  }
+  free(entries);
+}
+
+static void printSize(long long bytes)
+{
+  if (bytes < 1024)
+    OutPrintf("%lldB", bytes);
+  else if (bytes < 1024 * 1024)
+    OutPrintf("%.1fK", bytes / 1024.0);
+  else if (bytes < 1024LL * 1024 * 1024)
+    OutPrintf("%.1fM", bytes / 1024.0 / 1024);
+  else
+    OutPrintf("%.1fG", bytes / 1024.0 / 1024 / 1024);
+}
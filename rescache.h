@@ -0,0 +1,112 @@
+/***************************************************************************
+ *  Title: Result cache
+ * -------------------------------------------------------------------------
+ *    Purpose: Stored output and exit status of deterministic commands
+ *    File: rescache.h
+ ***************************************************************************/
+
+#ifndef __RESCACHE_H__
+#define __RESCACHE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <stddef.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __RESCACHE_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* size the cache is trimmed to unless "cached --limit" says otherwise */
+#define RESCACHE_LIMIT (64 << 20)
+
+/* what a result is stored under: FNV-1a, 128 bits wide */
+typedef struct result_key_t
+{
+  unsigned __int128 h;
+} resultKeyT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Build a result key
+ * ---------------------------------------------------------------------
+ *    Purpose: ResultKeyInit() starts a key, ResultKeyAdd() adds a
+ *    string (its length goes in too, so "a" "bc" and "ab" "c" differ)
+ *    and ResultKeyFile() a file: its contents, or only its identity,
+ *    size and mtime when byMtime is set. A missing file counts as
+ *    such.
+ *    Input: the key, the string or the path and whether to go by mtime
+ *    Output: void
+ ***********************************************************************/
+EXTERN void ResultKeyInit(resultKeyT*);
+EXTERN void ResultKeyAdd(resultKeyT*, const char*);
+EXTERN void ResultKeyFile(resultKeyT*, const char*, bool);
+
+/***********************************************************************
+ *  Title: Replay a stored result
+ * ---------------------------------------------------------------------
+ *    Purpose: Writes the stdout and stderr stored under the key and
+ *    marks the entry as just used. Counts a hit or a miss.
+ *    Input: the key, where stdout and stderr go and where the exit
+ *    status goes
+ *    Output: false if there is no such result
+ ***********************************************************************/
+EXTERN bool ResultReplay(resultKeyT*, int, int, int*);
+
+/***********************************************************************
+ *  Title: Files to capture a result in
+ * ---------------------------------------------------------------------
+ *    Purpose: Creates two unnamed files in the cache directory for the
+ *    stdout and stderr of a command that missed
+ *    Input: where the two descriptors go
+ *    Output: false if there is no cache directory
+ ***********************************************************************/
+EXTERN bool ResultCapture(int*);
+
+/***********************************************************************
+ *  Title: Store a result
+ * ---------------------------------------------------------------------
+ *    Purpose: Saves the captured output with the exit status and the
+ *    time the command took, then evicts the least recently used
+ *    results until the cache fits its limit again. Also copies the
+ *    captured output to where it would have gone.
+ *    Input: the key, the two capture files, the exit status, the run
+ *    time in ns, whether to keep it, and where stdout and stderr go
+ *    Output: void
+ ***********************************************************************/
+EXTERN void ResultStore(resultKeyT*, int*, int, long long, bool, int, int);
+
+/***********************************************************************
+ *  Title: Configure the result cache
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "cached --stats", "cached --clear" and
+ *    "cached --limit SIZE" (K, M or G suffix). The stats are the hits
+ *    and misses of this shell, the run time the hits saved, and the
+ *    entries and bytes in the cache directory.
+ *    Input: argc/argv of the cached builtin
+ *    Output: void
+ ***********************************************************************/
+EXTERN void ResultCacheConfigure(int, char**);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __RESCACHE_H__ */
@@ -39,19 +39,36 @@
 /************System include***********************************************/
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <termios.h>
 
 /************Private include**********************************************/
 #include "runtime.h"
 #include "io.h"
+#include "interpreter.h"
+#include "cgroup.h"
+#include "jobsched.h"
+#include "spawn.h"
+#include "probes.h"
+#include "prefetch.h"
+#include "jobserver.h"
+#include "jobshm.h"
+#include "rescache.h"
+#include "loadable.h"
+#include "compress.h"
+#include "fanout.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -68,7 +85,14 @@ typedef struct bgjob_l {
   char *command;
   int jobNumber;
   pid_t pid;
-  char *status;
+  char *status;     /* "Running", "Stopped" or "Done", never allocated so sigchld_handler can set it */
+  char *cgroup;
+  int node;         /* NUMA node it was spread to, -1 for none */
+  int exitStatus;   /* set once the job is Done, signals as 128 + the signal number */
+  struct rusage usage;  /* resources the job used, once it is Done */
+  long long startedAt;  /* CLOCK_MONOTONIC ns when it was started */
+  long long doneAt;     /* CLOCK_MONOTONIC ns when it was reaped */
+  int token;            /* jobserver token it holds, -1 for none */
   struct bgjob_l* next;
 } bgJobL;
 
@@ -82,6 +106,42 @@ bgJobL *fgJob = NULL;
 //Boolean value used to indicate if there is a forground process we're waiting on
 bool waiting = FALSE;
 
+//When set, a child that fails to exec writes errno here (see RunBatch)
+static int execErrFd = -1;
+
+//The terminal the shell hands to foreground jobs, -1 when it is not interactive
+static int gTerminal = -1;
+//The shell's own process group and terminal modes, restored after a foreground job
+static pid_t gShellPgid;
+static struct termios gShellModes;
+//A foreground job that was just stopped, reported by waitFg()
+static pid_t gStoppedFg = 0;
+/* foreground job sigchld_handler saw finish, freed by waitFg() since a handler must not call free() */
+static bgJobL* gFgDone = NULL;
+/* set by sigchld_handler when the spawn server may have events, read by reapSpawned() */
+static volatile sig_atomic_t gSpawnReady = 0;
+/* SIGINT or SIGTSTP when ctrl-c or ctrl-z reached the shell itself, for builtins that wait */
+static volatile sig_atomic_t gInterrupt = 0;
+//How the last foreground job ended, for bench
+static struct rusage gFgUsage;
+static long long gFgDoneAt;
+//Launch jobs as our own children even when there is a spawn server
+static bool gNoSpawn = FALSE;
+//What the child of Exec() runs instead of a program when it starts a subshell
+static void (*gSubshellBody)(void*) = NULL;
+static void* gSubshellArg = NULL;
+//This process is a subshell, its last command may take it over
+static bool gSubshell = FALSE;
+
+/* a coprocess, NAME[0] reads what it prints and NAME[1] writes to its stdin */
+typedef struct coproc_l {
+  char *name;
+  pid_t pid;
+  int fds[2];
+  struct coproc_l* next;
+} coprocL;
+static coprocL* gCoprocs = NULL;
+
 /************Function Prototypes******************************************/
 /* run command */
 static void RunCmdFork(commandT*, bool);
@@ -89,8 +149,16 @@ static void RunCmdFork(commandT*, bool);
 static void RunExternalCmd(commandT*, bool);
 /* resolves the path and checks for exutable flag */
 static bool ResolveExternalCmd(commandT*);
-/* forks and runs a external program */
-static void Exec(commandT*, bool);
+/* forks and runs a external program, returns its pid */
+static pid_t Exec(commandT*, bool);
+/* runs the body of a subshell in the child of Exec() and exits */
+static void runSubshell();
+/* turns a subshell into its last command */
+static void replaceShell(commandT* cmd);
+/* checks whether the output of a command goes through a process of the job, to a compressor or several files */
+static bool relayedOutput(commandT*);
+/* starts that process, in the child of Exec() */
+static void relayOutput(commandT*);
 /* runs a builtin command */
 static void RunBuiltInCmd(commandT*);
 /* checks whether a command is a builtin command */
@@ -100,15 +168,26 @@ static void AddBgJobToList(pid_t jobId, char* command);
 /* Removes an existing background job from the list of background jobs */
 static void RemoveBgJobFromList(pid_t jobId);
 /* Print the list of background jobs (bgJobsHead) */
-static void PrintBgJobList();
+static void PrintBgJobList(bool longFormat);
 /* Print a particular background job */
 static void printBgJob(pid_t jobPid);
 /* Catch signials from child processes and reap zombie processes */
 static void sigchld_handler();
+/* Update the job lists for a child that exited or stopped */
+static void handleChildStatus(pid_t childPid, int status);
+/* Same, with the resources the child used when they are known */
+static void updateJobs(pid_t childPid, int status, struct rusage* usage);
+static void reapSpawned();
+/* Launch a command through the spawn server */
+static pid_t SpawnCmd(commandT* cmd, char* cgroup, char* cpus);
 /* Return a backgroun job to the  and notify the user */
 static void bringToForeground(int jobId);
 /* Send sigcont signal to background job */
 static void continueBgJob(int jobNumber);
+/* Copy the job table to the shared segment tshtop reads */
+static void publishJobs();
+/* Put a job at the end of the background job list */
+static void linkBgJob(bgJobL* job);
 /* Create a new bgJobL struct */
 static bgJobL* createBgJobL();
 /* Release and collect the space of a bgJobL struct */
@@ -121,9 +200,9 @@ static void waitFg();
 static void RedirIn(commandT* cmd, char* file);
 /* Put output in a file instead of stdout */
 static void RedirOut(commandT* cmd, char* file);
-/* Add an alias to the alias array */
+/* Add an alias to the alias table */
 static void AddAlias(commandT* cmd);
-/* removes alias from alias array */
+/* removes alias from alias table */
 static void RemoveAlias(char* alias);
 /* Get the command associated with an alias */
 char* GetAliasCmd(char* alias);
@@ -133,6 +212,52 @@ bool IsAlias(char* alias);
 static void PrintAliases();
 /* qsort C-string comparison function */ 
 int cstring_cmp(const void *a, const void *b);
+/* Look up where a command was found for the current PATH */
+static char* lookupPath(char* name, char* pathlist);
+/* Drop a command from the PATH cache */
+static void forgetPath(char* name);
+/* Print one entry of the PATH cache */
+static void printPath(char* name, char* path, void* arg);
+/* Remove a shell variable */
+static void UnsetVar(char* name);
+/* Find a background job by its job number */
+static bgJobL* findBgJob(int jobNumber);
+/* Run a command inside a cgroup with resource limits */
+static void RunLimited(commandT* cmd);
+/* Run a command over items read from stdin, as few times as ARG_MAX allows */
+static void RunBatch(commandT* cmd);
+/* Run a command repeatedly and report its latency */
+static void RunBench(commandT* cmd);
+/* Run a dependency graph of commands in parallel */
+static void RunGraph(commandT* cmd);
+/* Run a builtin loaded with enable -f */
+static void RunLoadable(commandT* cmd, tshBuiltinT* builtin);
+/* Replay the output of a command that already ran with the same inputs */
+static void RunCached(commandT* cmd);
+/* Add files or variables listed in a cached option to a result key */
+static void keyList(resultKeyT* key, char* list, bool files, bool byMtime);
+/* Run a command with its stdout and stderr going to other files */
+static void execWithOutput(commandT* cmd, int out, int err);
+/* Start a job with its stdin and stdout connected to the shell */
+static void RunCoproc(commandT* cmd);
+/* Whether a coprocess is still a job that is not done */
+static bool coprocRunning(coprocL* co);
+/* Read a line into a variable */
+static void RunRead(commandT* cmd);
+/* Wait until one of a set of background jobs is done */
+static int waitJobs(pid_t* pids, int n, bgJobL** done);
+/* Find a background job by its process ID */
+static bgJobL* findBgJobPid(pid_t pid);
+/* Current CLOCK_MONOTONIC time in nanoseconds */
+static long long nowNs();
+/* Wait for the cgroups of the jobs to empty at exit */
+static void drainCgroups();
+/* Shell exit status for a wait status */
+static int exitStatusOf(int status);
+/* Let a process group have the terminal */
+static void giveTerminal(pid_t pgid);
+/* Create a command from the arguments of another one */
+static commandT* ShiftCmdT(commandT* cmd, int first);
 /************External Declaration*****************************************/
 
 /**************Implementation***********************************************/
@@ -152,13 +277,34 @@ void RunCmd(commandT** cmd, int n)
   }
 }
 
+void RunLastCmd(commandT* cmd)
+{
+  RunCmdFork(cmd, !gSubshell);
+}
+
+void RunSubshell(commandT* cmd, void (*body)(void*), void* arg)
+{
+  //The spawn server only starts programs, the subshell has to be a copy of this shell
+  bool noSpawn = gNoSpawn;
+  gNoSpawn = TRUE;
+  gSubshellBody = body;
+  gSubshellArg = arg;
+  Exec(cmd, TRUE);
+  gSubshellBody = NULL;
+  gNoSpawn = noSpawn;
+}
+
 void RunCmdFork(commandT* cmd, bool fork)
 {
   if (cmd->argc<=0)
     return;
   if (IsBuiltIn(cmd->argv[0]))
   {
+    long long start = ProbeClock(PROBE_ENABLED(builtin__done));
+    PROBE1(builtin__start, cmd->argv[0]);
     RunBuiltInCmd(cmd);
+    PROBE3(builtin__done, cmd->argv[0], lastExitStatus,
+           ProbeClock(PROBE_ENABLED(builtin__done)) - start);
   }
   else
   {
@@ -174,12 +320,12 @@ void RunCmdFork(commandT* cmd, bool fork)
 static void RunExternalCmd(commandT* cmd, bool fork)
 {
   if (ResolveExternalCmd(cmd)){
+    PrefetchRecord(cmd->argv[0], cmd->name);
     Exec(cmd, fork);
   }
   else {
-    printf("%s: command not found\n", cmd->argv[0]);
-    fflush(stdout);
-    ReleaseCmdT(&cmd);
+    OutPrintf("%s: command not found\n", cmd->argv[0]);
+    lastExitStatus = 127;
   }
 }
 
@@ -203,6 +349,15 @@ static bool ResolveExternalCmd(commandT* cmd)
   }
   pathlist = getenv("PATH");
   if(pathlist == NULL) return FALSE;
+  /*Commands found before are checked where they were found last time*/
+  c = lookupPath(cmd->argv[0], pathlist);
+  if(c != NULL){
+    if(stat(c, &fs) >= 0 && S_ISDIR(fs.st_mode) == 0 && access(c, X_OK) == 0){
+      cmd->name = strdup(c);
+      return TRUE;
+    }
+    forgetPath(cmd->argv[0]);
+  }
   i = 0;
   while(i<strlen(pathlist)){
     c = strchr(&(pathlist[i]),':');
@@ -222,6 +377,7 @@ static bool ResolveExternalCmd(commandT* cmd)
       if(S_ISDIR(fs.st_mode) == 0)
         if(access(buf,X_OK) == 0){/*Whether it's an executable or the user has required permisson to run it*/
           cmd->name = strdup(buf); 
+          RememberPath(strdup(cmd->argv[0]), strdup(buf), FALSE);
           return TRUE;
         }
     }
@@ -229,10 +385,152 @@ static bool ResolveExternalCmd(commandT* cmd)
   return FALSE; /*The command is not found or the user don't have enough priority to run.*/
 }
 
-static void Exec(commandT* cmd, bool forceFork)
+//////////////////////////////////////////////////////////////
+//  PATH Cache
+//////////////////////////////////////////////////////////////
+
+typedef struct path_l {
+  char* name;
+  char* path;
+  bool mapped;  /* the strings live in the state snapshot and are not freed */
+  struct path_l* next;
+} pathL;
+
+#define PATH_BUCKETS 256
+/* how long jobs get to leave their cgroups at exit, after SIGINT and again after SIGKILL */
+#define CGROUP_GRACE_NS 500000000LL
+static pathL* pathCache[PATH_BUCKETS] = { };
+/* value of PATH the cached entries were found with */
+static char* pathCacheFor = NULL;
+
+static pathL** pathBucket(char* name)
+{
+  unsigned long h = 5381;
+  while (*name != '\0')
+    h = h * 33 + (unsigned char)*name++;
+  return &pathCache[h % PATH_BUCKETS];
+}
+
+//Empty the PATH cache
+static void forgetPaths()
+{
+  pathL *entry, *next;
+  int j;
+
+  for (j = 0; j < PATH_BUCKETS; j++)
+  {
+    for (entry = pathCache[j]; entry != NULL; entry = next)
+    {
+      next = entry->next;
+      if (!entry->mapped)
+      {
+        free(entry->name);
+        free(entry->path);
+      }
+      free(entry);
+    }
+    pathCache[j] = NULL;
+  }
+}
+
+//Drop the whole cache when PATH is not what the entries were found with
+static bool checkPathCache(char* pathlist)
+{
+  if (pathCacheFor != NULL && strcmp(pathCacheFor, pathlist) == 0)
+    return TRUE;
+  forgetPaths();
+  free(pathCacheFor);
+  pathCacheFor = strdup(pathlist);
+  return FALSE;
+}
+
+static char* lookupPath(char* name, char* pathlist)
 {
+  pathL* entry;
+  if (!checkPathCache(pathlist))
+    return NULL;
+  for (entry = *pathBucket(name); entry != NULL; entry = entry->next)
+    if (strcmp(entry->name, name) == 0)
+      return entry->path;
+  return NULL;
+}
+
+static void forgetPath(char* name)
+{
+  pathL **link = pathBucket(name);
+  pathL *entry;
+
+  while ((entry = *link) != NULL)
+  {
+    if (strcmp(entry->name, name) == 0)
+    {
+      *link = entry->next;
+      if (!entry->mapped)
+      {
+        free(entry->name);
+        free(entry->path);
+      }
+      free(entry);
+      return;
+    }
+    link = &entry->next;
+  }
+}
+
+void RememberPath(char* name, char* path, bool mapped)
+{
+  pathL *entry;
+  pathL **bucket;
+  char* pathlist = getenv("PATH");
+
+  if (pathlist == NULL)
+    return;
+  checkPathCache(pathlist);
+  forgetPath(name);
+  bucket = pathBucket(name);
+  entry = malloc(sizeof(pathL));
+  entry->name = name;
+  entry->path = path;
+  entry->mapped = mapped;
+  entry->next = *bucket;
+  *bucket = entry;
+}
+
+void ForEachPath(void (*fn)(char*, char*, void*), void* arg)
+{
+  pathL* entry;
+  char* pathlist = getenv("PATH");
+  int j;
+
+  if (pathlist == NULL || !checkPathCache(pathlist))
+    return;
+  for (j = 0; j < PATH_BUCKETS; j++)
+    for (entry = pathCache[j]; entry != NULL; entry = entry->next)
+      fn(entry->name, entry->path, arg);
+}
+
+//Print one entry of the PATH cache
+static void printPath(char* name, char* path, void* arg)
+{
+  OutPrintf("%s\t%s\n", name, path);
+}
+
+static pid_t Exec(commandT* cmd, bool forceFork)
+{
+  //Nothing is left for a subshell to do after its last command, which saves a fork
+  if (!forceFork && cmd->bg == 0 && cmd->limits == NULL)
+    replaceShell(cmd);
+
+  //A background job runs on a jobserver slot, wait for one while finished jobs can still give theirs back
+  int token = JOBSERVER_NONE;
+  if (cmd->bg == 1 && (token = JobserverAcquire(reapSpawned)) == JOBSERVER_CANCELLED)
+  {
+    lastExitStatus = 130;
+    return -1;
+  }
+
   //Initialize the SIGCHLD catcher
-  signal (SIGCHLD, sigchld_handler);
+  InstallHandler(SIGCHLD, sigchld_handler);
 
   //Block sigchld until job is added to the bgjob list or recorded in fgJob
   sigset_t x;
@@ -240,8 +538,35 @@ static void Exec(commandT* cmd, bool forceFork)
   sigaddset(&x, SIGCHLD);
   sigprocmask(SIG_BLOCK, &x, NULL);
 
-  //Create a copy of the current state
-  pid_t childPid = fork();
+  //Set up the resource envelope before forking so the child only has to join it
+  char* cgroup = NULL;
+  if (cmd->limits != NULL)
+    cgroup = CgroupCreate(cmd->limits);
+
+  //Background jobs are spread over the NUMA nodes, each gets the cores of its node the shell does not keep
+  int node = -1;
+  char cpus[AFFINITY_LISTLEN] = "";
+  if (cmd->bg == 1)
+    node = AffinityPick();
+  if (node >= 0)
+    AffinityCpus(node, cpus, sizeof(cpus));
+
+  //What the shell printed so far goes out before anything the job prints
+  OutFlush();
+
+  //Output to a compressed file or to several files needs a copy of the shell that stays to relay it
+  bool relayed = relayedOutput(cmd);
+
+  //Let the spawn server launch the job when there is one, otherwise create a copy of the current state
+  long long forkStart = ProbeClock(PROBE_ENABLED(fork__done) || PROBE_ENABLED(exec__start));
+  PROBE2(fork__start, cmd->name, cmd->bg);
+  pid_t childPid = -1;
+  if (SpawnActive() && execErrFd == -1 && !gNoSpawn && !relayed)
+    childPid = SpawnCmd(cmd, cgroup, node >= 0 ? cpus : NULL);
+  if (childPid == -1)
+    childPid = fork();
+  if (childPid > 0)
+    PROBE3(fork__done, childPid, cmd->name, ProbeClock(PROBE_ENABLED(fork__done)) - forkStart);
 
   //If there was an error when creating the child process
   if (childPid == -1)
@@ -255,15 +580,41 @@ static void Exec(commandT* cmd, bool forceFork)
     if(cmd->redirect_in != NULL){
       RedirIn(cmd, cmd->redirect_in);
     }
-    if(cmd->redirect_out != NULL){
+    if(cmd->redirect_out != NULL && !relayed){
       RedirOut(cmd, cmd->redirect_out);
     }
+    //Join the job's cgroup so the limits hold from the first instruction of the program
+    if (cgroup != NULL)
+      CgroupAttach(cgroup);
+    if (node >= 0)
+      AffinityApply(cpus);
     //Change the process group ID of the child to stop signals from affecting tsh
-    setpgid(0,0);
+    //(a subshell keeps what it runs in its own group, job control is left to the shell)
+    if (!gSubshell)
+      setpgid(0,0);
+    //A foreground job takes the terminal itself too, so it never reads it from the background
+    if (cmd->bg == 0)
+      giveTerminal(getpid());
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    //Background jobs start out with batch priority
+    if (cmd->bg == 1)
+      PriorityBackground(0);
     //Unblock sigchld signal
     sigprocmask(SIG_UNBLOCK, &x, NULL);
+    //This process becomes the one that relays the output, the program goes on in a child of it
+    if (relayed)
+      relayOutput(cmd);
+    if (gSubshellBody != NULL)
+      runSubshell();
     //Execute the program
+    PROBE2(exec__start, cmd->name, ProbeClock(PROBE_ENABLED(exec__start)) - forkStart);
     execv(cmd->name,cmd->argv);
+    //Tell the launcher why the exec failed, an argument list that is too long is not reported here
+    int err = errno;
+    PROBE2(exec__fail, cmd->name, err);
+    if (execErrFd != -1 && write(execErrFd, &err, sizeof(err)) == sizeof(err) && err == E2BIG)
+      exit(126);
     //Notify user if there is an error (won't be called if execv works)
     fprintf(stderr, "%s\n", "command not found");
     exit(0);
@@ -276,6 +627,11 @@ static void Exec(commandT* cmd, bool forceFork)
     {
       //Add the job to the background job list (bgJobsHead)
       AddBgJobToList(childPid, cmd->cmdline);
+      bgJobsTail->cgroup = cgroup;
+      bgJobsTail->node = node;
+      bgJobsTail->token = token;
+      publishJobs();
+      lastExitStatus = 0;
       //Unblock sigchld so child process can be reaped when completed
       sigprocmask(SIG_UNBLOCK, &x, NULL);
       //Do NOT tell the parent process to wait
@@ -283,29 +639,138 @@ static void Exec(commandT* cmd, bool forceFork)
     //If the command is NOT for a background job (bg in command is set to 0)...
     else
     {
+      //Set the group from this side as well, the terminal can only go to a group that exists
+      if (!gSubshell)
+        setpgid(childPid, childPid);
+      giveTerminal(childPid);
       //Record the job information in a bgJobL object in case it is interupted
       fgJob = createBgJobL();
       fgJob->command = strdup(cmd->cmdline);
       fgJob->pid = childPid;
+      fgJob->cgroup = cgroup;
+      publishJobs();
+      //Start waiting before sigchld is unblocked, a child that is already gone clears it right away
+      waiting = TRUE;
       //Unblock sigchld so child process can be reaped when completed
       sigprocmask(SIG_UNBLOCK, &x, NULL);
       //wait for the child to finish
-      waiting = TRUE;
       waitFg();
       //waiting variable set to false and fgJob is freed in sigchld_handler()
     }
   }
+  return childPid;
+}
+
+//Carry on as a copy of the shell that runs the subshell body, then exit with its status
+static void runSubshell()
+{
+  void (*body)(void*) = gSubshellBody;
+
+  gSubshellBody = NULL;
+  gSubshell = TRUE;
+  //The jobs of the shell are not ours to report or wait for
+  bgJobsHead = NULL;
+  bgJobsTail = NULL;
+  fgJob = NULL;
+  JobShmClose();
+  //No job control here: what the subshell runs shares its group, and ctrl-c or ctrl-z reach them all
+  gTerminal = -1;
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+  body(gSubshellArg);
+  OutFlush();
+  exit(lastExitStatus);
+}
+
+//Exec the last command of a subshell in place of the subshell, as its child would have
+static void replaceShell(commandT* cmd)
+{
+  OutFlush();
+  if (cmd->redirect_in != NULL)
+    RedirIn(cmd, cmd->redirect_in);
+  signal(SIGTTOU, SIG_DFL);
+  signal(SIGTTIN, SIG_DFL);
+  //The subshell stays behind to relay the output, the program runs in a child
+  if (relayedOutput(cmd))
+    relayOutput(cmd);
+  else if (cmd->redirect_out != NULL)
+    RedirOut(cmd, cmd->redirect_out);
+  PROBE2(exec__start, cmd->name, 0LL);
+  execv(cmd->name, cmd->argv);
+  PROBE2(exec__fail, cmd->name, errno);
+  fprintf(stderr, "%s\n", "command not found");
+  exit(0);
+}
+
+static bool relayedOutput(commandT* cmd)
+{
+  return cmd->redirect_tee != NULL || (cmd->redirect_out != NULL && CompressedFile(cmd->redirect_out));
+}
+
+static void relayOutput(commandT* cmd)
+{
+  char** files;
+  int i;
+
+  if (cmd->redirect_tee == NULL)
+  {
+    CompressOutput(cmd->redirect_out);
+    return;
+  }
+  for (i = 0; cmd->redirect_tee[i] != NULL; i++);
+  files = malloc(sizeof(char*) * (i + 2));
+  files[0] = cmd->redirect_out;
+  for (i = 0; cmd->redirect_tee[i] != NULL; i++)
+    files[i + 1] = cmd->redirect_tee[i];
+  files[i + 1] = NULL;
+  FanOutput(files);
+  free(files);
 }
 
-//Wait for a foreground process to terminate
+//Wait for a foreground process to terminate or stop
 static void waitFg()
 {
+  sigset_t x, old;
+
+  OutFlush();
+  //Waiting is checked with sigchld blocked so the signal cannot slip in between
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &x, &old);
+  sigdelset(&old, SIGCHLD);
   //Waiting will be set to false once foreground process terminates
+  reapSpawned();
   while(waiting)
   {
-    //Amount of time doesn't matter as long as it isn't tiny
-    sleep(1);
+    sigsuspend(&old);
+    reapSpawned();
+  }
+  if (gFgDone != NULL)
+    releaseBgJobL(&gFgDone);
+  sigprocmask(SIG_SETMASK, &old, NULL);
+
+  //Take the terminal back, the job may have left it in another mode
+  if (gTerminal != -1)
+  {
+    tcsetpgrp(gTerminal, gShellPgid);
+    tcsetattr(gTerminal, TCSADRAIN, &gShellModes);
   }
+  //Notify user that the job has been stopped
+  if (gStoppedFg != 0)
+  {
+    //It is a background job from now on, walking /proc for it is no job for the handler
+    PriorityBackground(gStoppedFg);
+    printBgJob(gStoppedFg);
+    OutFlush();
+    gStoppedFg = 0;
+  }
+}
+
+//Let a process group have the terminal
+static void giveTerminal(pid_t pgid)
+{
+  if (gTerminal != -1)
+    tcsetpgrp(gTerminal, pgid);
 }
 
 //////////////////////////////////////////////////////////////
@@ -316,18 +781,40 @@ static void waitFg()
 static bool IsBuiltIn(char* cmd)
 {
   //If the command is any of these things, it's a built in command (return true)
-  if (strncmp(cmd, "bg", 2) == 0)
+  if (strcmp(cmd, "bg") == 0)
     return TRUE;
 
-  else if (strncmp(cmd, "fg", 2) == 0) 
+  else if (strcmp(cmd, "fg") == 0) 
+    return TRUE;
+  else if (strcmp(cmd, "alias") == 0) 
+    return TRUE;
+  else if (strcmp(cmd, "unalias") == 0) 
+    return TRUE;
+  else if (strcmp(cmd, "jobs") == 0)
+    return TRUE;
+  else if (strcmp(cmd, "cd") == 0)
+    return TRUE;
+  else if (strcmp(cmd, "limit") == 0)
+    return TRUE;
+  else if (strcmp(cmd, "affinity") == 0)
+    return TRUE;
+  else if (strcmp(cmd, "priority") == 0)
     return TRUE;
-  else if (strncmp(cmd, "alias", 5) == 0) 
+  else if (strcmp(cmd, "hash") == 0)
     return TRUE;
-  else if (strncmp(cmd, "unalias", 7) == 0) 
+  else if (strcmp(cmd, "true") == 0 || strcmp(cmd, "false") == 0)
     return TRUE;
-  else if (strncmp(cmd, "jobs", 4) == 0)
+  else if (strcmp(cmd, "unset") == 0)
     return TRUE;
-  else if (strncmp(cmd, "cd", 2) == 0)
+  else if (strcmp(cmd, "xbatch") == 0 || strcmp(cmd, "bench") == 0 || strcmp(cmd, "graph") == 0)
+    return TRUE;
+  else if (strcmp(cmd, "prefetch") == 0 || strcmp(cmd, "jobserver") == 0)
+    return TRUE;
+  else if (strcmp(cmd, "cached") == 0 || strcmp(cmd, "enable") == 0 || strcmp(cmd, "compression") == 0)
+    return TRUE;
+  else if (strcmp(cmd, "coproc") == 0 || strcmp(cmd, "read") == 0)
+    return TRUE;
+  else if (LoadableFind(cmd) != NULL)
     return TRUE;
   //Otherwise it isn't (return false)
   else
@@ -337,8 +824,11 @@ static bool IsBuiltIn(char* cmd)
 //Run commands that are built-in shell functions
 static void RunBuiltInCmd(commandT* cmd)
 {
+  tshBuiltinT* builtin;
+
+  lastExitStatus = 0;
   //Send SIGCONT to a backgrounded job, but do not give it the foreground 
-  if (strncmp(cmd->argv[0], "bg", 2) == 0)
+  if (strcmp(cmd->argv[0], "bg") == 0)
   {
     //If there are two arguments in the command...
     if (cmd->argc == 2)
@@ -354,7 +844,7 @@ static void RunBuiltInCmd(commandT* cmd)
     }
   }
   //Return a backgrounded job to the foreground 
-  else if (strncmp(cmd->argv[0], "fg", 2) == 0)
+  else if (strcmp(cmd->argv[0], "fg") == 0)
   {
     //If there are two arguments in the command...
     if (cmd->argc == 2)
@@ -370,7 +860,7 @@ static void RunBuiltInCmd(commandT* cmd)
     }
   }
   //makenew alias 
-  else if (strncmp(cmd->argv[0], "alias", 5) == 0)
+  else if (strcmp(cmd->argv[0], "alias") == 0)
   {
     //If there are two arguments in the command...
     if (cmd->argc == 2)
@@ -381,11 +871,11 @@ static void RunBuiltInCmd(commandT* cmd)
       PrintAliases();
 
   }
-  else if (strncmp(cmd->argv[0], "unalias", 7) == 0)
+  else if (strcmp(cmd->argv[0], "unalias") == 0)
   {
     RemoveAlias(cmd->argv[1]);
   }
-  else if (strncmp(cmd->argv[0], "cd", 2) == 0)
+  else if (strcmp(cmd->argv[0], "cd") == 0)
   {
     int err;
     //If a directory is given, go to that directory
@@ -396,14 +886,124 @@ static void RunBuiltInCmd(commandT* cmd)
       err = chdir(getenv("HOME"));
     //If there was a problem changing directories, print an error
     if (err == -1)
+    {
+      lastExitStatus = 1;
       fprintf(stderr, "%s\n", "Invalid directory\n");
+    }
+  }
+  //Share a concurrency budget with make and the shell's own background jobs
+  else if (strcmp(cmd->argv[0], "jobserver") == 0)
+  {
+    JobserverConfigure(cmd->argc, cmd->argv);
   }
   //Print the list of background jobs (bgJobsHead)
-  else if (strncmp(cmd->argv[0], "jobs", 4) == 0){
-    PrintBgJobList();
+  else if (strcmp(cmd->argv[0], "jobs") == 0){
+    PrintBgJobList(cmd->argc == 2 && strcmp(cmd->argv[1], "-l") == 0);
   } 
+  //Run a command with cpu/memory/io limits
+  else if (strcmp(cmd->argv[0], "limit") == 0)
+  {
+    RunLimited(cmd);
+  }
+  //Pin a job to a set of cores, or configure where background jobs go
+  else if (strcmp(cmd->argv[0], "affinity") == 0)
+  {
+    if (cmd->argc == 4 && strcmp(cmd->argv[1], "pin") == 0)
+    {
+      bgJobL* job = findBgJob(strtol(cmd->argv[2], NULL, 10));
+      if (job == NULL)
+        fprintf(stderr, "affinity: no such job %s\n", cmd->argv[2]);
+      else if (AffinityPin(job->pid, cmd->argv[3]))
+      {
+        //A hand-pinned job no longer counts against the automatic spreading
+        AffinityRelease(job->node);
+        job->node = -1;
+      }
+    }
+    else
+      AffinityConfigure(cmd->argc, cmd->argv);
+  }
+  //Turn foreground/background aware priorities on or off
+  else if (strcmp(cmd->argv[0], "priority") == 0)
+  {
+    PriorityConfigure(cmd->argc, cmd->argv);
+  }
+  //Do nothing, successfully or not
+  else if (strcmp(cmd->argv[0], "true") == 0)
+  {
+  }
+  else if (strcmp(cmd->argv[0], "false") == 0)
+  {
+    lastExitStatus = 1;
+  }
+  //Remove shell variables
+  else if (strcmp(cmd->argv[0], "unset") == 0)
+  {
+    int i;
+    for (i = 1; i < cmd->argc; i++)
+      UnsetVar(cmd->argv[i]);
+  }
+  //Run a command over the items on stdin in as few invocations as possible
+  else if (strcmp(cmd->argv[0], "xbatch") == 0)
+  {
+    RunBatch(cmd);
+  }
+  //Run a command over and over and report how long it took
+  else if (strcmp(cmd->argv[0], "bench") == 0)
+  {
+    RunBench(cmd);
+  }
+  //Run a dependency graph of commands
+  else if (strcmp(cmd->argv[0], "graph") == 0)
+  {
+    RunGraph(cmd);
+  }
+  //Run a command through the result cache
+  else if (strcmp(cmd->argv[0], "cached") == 0)
+  {
+    RunCached(cmd);
+  }
+  //Load builtins from a shared object, unload or list them
+  else if (strcmp(cmd->argv[0], "enable") == 0)
+  {
+    lastExitStatus = LoadableEnable(cmd->argc, cmd->argv, IsBuiltIn);
+  }
+  //Start a job that the shell talks to through pipes
+  else if (strcmp(cmd->argv[0], "coproc") == 0)
+  {
+    RunCoproc(cmd);
+  }
+  //Read a line into a variable, from a coprocess for one
+  else if (strcmp(cmd->argv[0], "read") == 0)
+  {
+    RunRead(cmd);
+  }
+  //Set the level and threads of the compressors behind .gz, .zst and .xz redirections
+  else if (strcmp(cmd->argv[0], "compression") == 0)
+  {
+    lastExitStatus = CompressConfigure(cmd->argc, cmd->argv);
+  }
+  //A builtin loaded with enable -f
+  else if ((builtin = LoadableFind(cmd->argv[0])) != NULL)
+  {
+    RunLoadable(cmd, builtin);
+  }
+  //Turn executable prefetch on or off, or show how well it guesses
+  else if (strcmp(cmd->argv[0], "prefetch") == 0)
+  {
+    PrefetchConfigure(cmd->argc, cmd->argv);
+  }
+  //Show or forget where commands were found on PATH
+  else if (strcmp(cmd->argv[0], "hash") == 0)
+  {
+    if (cmd->argc == 2 && strcmp(cmd->argv[1], "-r") == 0)
+      forgetPaths();
+    else
+      ForEachPath(printPath, NULL);
+  }
   else
   {
+    lastExitStatus = 1;
     fprintf(stderr, "%s is an unrecognized internal command\n", cmd->argv[0]);
     fflush(stdout);
   }
@@ -414,18 +1014,28 @@ static void RunBuiltInCmd(commandT* cmd)
 //////////////////////////////////////////////////////////////
 
 //Print the list of background jobs (bgJobsHead)
-static void PrintBgJobList()
+static void PrintBgJobList(bool longFormat)
 {
   //Initialize variables
   bgJobL *bgJob = bgJobsHead;
+  char usage[128];
   //Iterate through linked list and print the job number, status, and command in every node
   while (bgJob != NULL)
   {
+    //jobs -l adds the pid and the live usage of limited jobs
+    if (longFormat)
+    {
+      usage[0] = '\0';
+      if (bgJob->cgroup != NULL)
+        CgroupUsage(bgJob->cgroup, usage, sizeof(usage));
+      OutPrintf("[%d]   %d %s                 %s  %s\n", bgJob->jobNumber, (int)bgJob->pid, bgJob->status, bgJob->command, usage);
+      bgJob = bgJob->next;
+      continue;
+    }
     if (strncmp(bgJob->status, "Stopped\0", 8) == 0)
-      fprintf(stdout, "[%d]   %s                 %s\n", bgJob->jobNumber,bgJob->status, bgJob->command);
+      OutPrintf("[%d]   %s                 %s\n", bgJob->jobNumber,bgJob->status, bgJob->command);
     else if (strncmp(bgJob->status, "Running\0", 8) == 0)
-      fprintf(stdout, "[%d]   %s                 %s &\n", bgJob->jobNumber,bgJob->status, bgJob->command);
-    fflush(stdout);
+      OutPrintf("[%d]   %s                 %s &\n", bgJob->jobNumber,bgJob->status, bgJob->command);
     bgJob = bgJob->next;
   }
 }
@@ -452,6 +1062,8 @@ static void continueBgJob(int jobNumber)
       //If the bgJob is the job you're looking for...
       if (bgJob->jobNumber == jobNumber)
       {
+        //Running in the background means running at background priority
+        PriorityBackground(bgJob->pid);
         //Tell job to continue working if it has been stopped
         kill(-(bgJob->pid),SIGCONT);
         //Change it's status in the job list to "stopped"
@@ -460,6 +1072,7 @@ static void continueBgJob(int jobNumber)
       }
       bgJob = bgJob->next;
     }
+    publishJobs();
     sigprocmask(SIG_UNBLOCK, &x, NULL);
   }
 }
@@ -486,6 +1099,10 @@ static void bringToForeground(int jobNumber)
         sigemptyset (&x);
         sigaddset(&x, SIGCHLD);
         sigprocmask(SIG_BLOCK, &x, NULL);
+        //Give the whole process group interactive priority back
+        PriorityForeground(bgJob->pid);
+        //The job gets the terminal before it is woken up
+        giveTerminal(bgJob->pid);
         //If the job is currently stopeed...
         if(strncmp(bgJob->status, "Stopped\0", 8) == 0)
           //Tell job to continue working
@@ -494,14 +1111,21 @@ static void bringToForeground(int jobNumber)
         fgJob = createBgJobL();
         fgJob->command = strdup(bgJob->command);
         fgJob->pid = bgJob->pid;
-        //Remove the status of the job so nothing prints when removing the job from the background job list
-        if((bgJob)->status != NULL)
+        fgJob->startedAt = bgJob->startedAt;
+        fgJob->cgroup = bgJob->cgroup;
+        bgJob->cgroup = NULL;
+        //Foreground jobs share the shell's cores
+        if (bgJob->node >= 0)
         {
-          free(bgJob->status);
-          bgJob->status = NULL;
+          AffinityPin(bgJob->pid, NULL);
+          AffinityRelease(bgJob->node);
+          bgJob->node = -1;
         }
+        //Remove the status of the job so nothing prints when removing the job from the background job list
+        bgJob->status = NULL;
         //Remove the job from the background job list
         RemoveBgJobFromList(bgJob->pid);
+        publishJobs();
         //wait for the job to finish
         waiting = TRUE;
         //Unblock the sigchld
@@ -518,104 +1142,1414 @@ static void bringToForeground(int jobNumber)
 }
 
 
-//////////////////////////////////////////////////////////////
-//  Alias Code (Internal Commmand)
-//////////////////////////////////////////////////////////////
-
-typedef struct binding_l{
-  char* cmd;
-  char* alias;
-} Binding;
-
-//support up to 100 aliases
-#define MAX_ALIASES 100
-Binding* bindingsArray[MAX_ALIASES] = { };
-
-//Adds an alias to the alias array
-static void AddAlias(commandT* cmd)
+//Run a command inside a cgroup: limit [--cpu N] [--mem SIZE] [--io SPEC] cmd...
+static void RunLimited(commandT* cmd)
 {
+  int first;
+  limitT* limits = ParseLimits(cmd->argc, cmd->argv, &first);
+  if (limits == NULL)
+  {
+    lastExitStatus = 1;
+    return;
+  }
+  if (first >= cmd->argc)
+  {
+    fprintf(stderr, "usage: limit [--cpu N] [--mem SIZE] [--io SPEC] cmd...\n");
+    ReleaseLimits(&limits);
+    lastExitStatus = 1;
+    return;
+  }
+  commandT* sub = ShiftCmdT(cmd, first);
+  sub->limits = limits;
+  //Builtins run inside the shell and cannot be limited on their own
+  if (IsBuiltIn(sub->argv[0]))
+  {
+    fprintf(stderr, "limit: %s is a builtin\n", sub->argv[0]);
+    ReleaseCmdT(&sub);
+    lastExitStatus = 1;
+    return;
+  }
+  //RunExternalCmd releases the command when it cannot be found
+  if (ResolveExternalCmd(sub))
+  {
+    Exec(sub, TRUE);
+    ReleaseCmdT(&sub);
+  }
+  else
+    RunExternalCmd(sub, TRUE);
+}
 
-  //fprintf(stdout, "%s is the cmdline\n", cmd->cmdline);
-  fflush(stdout);
 
+//State of one run of the xbatch builtin
+typedef struct batch_t {
+  commandT* tmpl;     /* the command the items are appended to, resolved once */
+  long budget;        /* bytes of arguments left for the items */
+  int parallel;       /* batches allowed to run at once */
+  pid_t* running;     /* batches running in the background, negative when the status does not count */
+  int nrunning;
+  int batches;        /* batches launched */
+  int splits;         /* batches split after E2BIG */
+  bool failed;        /* a batch exited with a status other than 0 */
+  bool killed;        /* a batch was killed by a signal, stop launching */
+} batchT;
 
-  //parse out the command to alias and the alias itself
-  //getthe indexes
-  int indexStart =0;
-  int indexQuoteClose = 0;
-  int indexQuoteOpen = 0;
-  int indexEqualSign = 0;
+//Bytes an argument takes of ARG_MAX: the string and its pointer
+#define ARG_COST(s) (strlen(s) + 1 + sizeof(char*))
 
-  int length = strlen(cmd->cmdline);
-  int idx = 0;
-  while(idx < length){
+extern char** environ;
 
-    if(cmd->cmdline[idx] == ' ' && indexStart==0)
-      indexStart = idx + 1;
+//Wait until at most keep batches are running and collect the ones that finished
+static void reapBatches(batchT* b, int keep)
+{
+  bgJobL* job;
+  int i, status;
 
-    if(cmd->cmdline[idx] == '\''){
+  while (b->nrunning > keep)
+  {
+    i = waitJobs(b->running, b->nrunning, &job);
+    status = job != NULL ? job->exitStatus : 0;
+    if (b->running[i] > 0 && status > 128)
+      b->killed = TRUE;
+    else if (b->running[i] > 0 && status != 0)
+      b->failed = TRUE;
+    //Batches are not reported by CheckJobs, they go away as soon as they are done
+    if (job != NULL)
+      RemoveBgJobFromList(job->pid);
+    b->running[i] = b->running[--b->nrunning];
+  }
+}
 
-      if(indexQuoteOpen == 0)
-        indexQuoteOpen = idx;
-      else
-        indexQuoteClose = idx;
+//Run the template with n items, splitting the batch in halves while the kernel says E2BIG
+static void launchBatch(batchT* b, char** items, int n)
+{
+  commandT* cmd;
+  char cmdline[256];
+  int fds[2], err, fixed, i;
+  pid_t pid;
+  long cost = 0;
+  ssize_t got;
 
-    }
-    if(cmd->cmdline[idx] == '='){
+  if (n <= 0 || b->killed)
+    return;
+  reapBatches(b, b->parallel - 1);
+  if (b->killed)
+    return;
 
-      indexEqualSign = idx;
+  fixed = b->tmpl->argc;
+  cmd = CreateCmdT(fixed + n);
+  //The arguments are borrowed and taken back before the command is released
+  for (i = 0; i < fixed; i++)
+    cmd->argv[i] = b->tmpl->argv[i];
+  for (i = 0; i < n; i++)
+  {
+    cmd->argv[fixed + i] = items[i];
+    cost += ARG_COST(items[i]);
+  }
+  cmd->name = strdup(b->tmpl->name);
+  snprintf(cmdline, sizeof(cmdline), "%s ... (%d items)", b->tmpl->argv[0], n);
+  cmd->cmdline = strdup(cmdline);
+  //Children must not eat the items or the shell's input
+  cmd->redirect_in = strdup("/dev/null");
+  cmd->bg = b->parallel > 1;
+
+  //The pipe sees EOF when the exec succeeds and errno when it fails
+  err = 0;
+  if (pipe(fds) == 0)
+  {
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    execErrFd = fds[1];
+  }
+  pid = Exec(cmd, TRUE);
+  if (execErrFd != -1)
+  {
+    close(execErrFd);
+    execErrFd = -1;
+    do
+      got = read(fds[0], &err, sizeof(err));
+    while (got == -1 && errno == EINTR);
+    if (got != sizeof(err))
+      err = 0;
+    close(fds[0]);
+  }
 
-    }
-    idx++;
+  if (cmd->bg == 1 && pid == -1)
+    b->killed = TRUE;
+  else if (cmd->bg == 1)
+    b->running[b->nrunning++] = err == E2BIG ? -pid : pid;
+  else if (err != E2BIG)
+  {
+    if (lastExitStatus > 128)
+      b->killed = TRUE;
+    else if (lastExitStatus != 0)
+      b->failed = TRUE;
   }
+  for (i = 0; i < fixed + n; i++)
+    cmd->argv[i] = NULL;
+  ReleaseCmdT(&cmd);
 
-  //use the indexes to copy to a new string
+  if (err != E2BIG)
+  {
+    b->batches++;
+    return;
+  }
+  if (n == 1)
+  {
+    fprintf(stderr, "xbatch: argument too long: %.40s...\n", items[0]);
+    b->failed = TRUE;
+    return;
+  }
+  //Pack the following batches no fuller than the half that is tried next
+  b->splits++;
+  if (b->budget > cost / 2)
+    b->budget = cost / 2;
+  launchBatch(b, items, n / 2);
+  launchBatch(b, items + n / 2, n - n / 2);
+}
 
-  //allocate newbinding
-  Binding *newBinding = (Binding*)malloc(sizeof(Binding));
-  char* newAlias = (char*) malloc(indexEqualSign + 1);
-  char* newCmd = (char*) malloc(indexQuoteClose - indexQuoteOpen + 1);
+//Run a command over items read from stdin: xbatch [-P N] [-v] cmd [args...]
+static void RunBatch(commandT* cmd)
+{
+  batchT b;
+  FILE* in = stdin;
+  char** items = NULL;
+  char** env;
+  char* line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  int first, i, nitems = 0, maxItems = 0, start;
+  long used;
+  bool verbose = FALSE;
+
+  memset(&b, 0, sizeof(b));
+  b.parallel = 1;
+  for (first = 1; first < cmd->argc && cmd->argv[first][0] == '-'; first++)
+  {
+    if (strcmp(cmd->argv[first], "-v") == 0)
+      verbose = TRUE;
+    else if (strcmp(cmd->argv[first], "-P") == 0 && first + 1 < cmd->argc)
+      b.parallel = strtol(cmd->argv[++first], NULL, 10);
+    else
+      break;
+  }
+  //-P 0 runs as many batches as there are cores
+  if (b.parallel == 0)
+    b.parallel = sysconf(_SC_NPROCESSORS_ONLN);
+  if (first >= cmd->argc || b.parallel < 0)
+  {
+    fprintf(stderr, "usage: xbatch [-P N] [-v] cmd [args...]\n");
+    lastExitStatus = 1;
+    return;
+  }
 
-  //copy contents
-  //strncpy(dest, src + beginIndex, endIndex - beginIndex);
-  strncpy(newAlias, cmd->cmdline + indexStart, indexEqualSign - indexStart);
-  strncpy(newCmd, cmd->cmdline + indexQuoteOpen + 1, indexQuoteClose - indexQuoteOpen - 1);
+  b.tmpl = ShiftCmdT(cmd, first);
+  if (IsBuiltIn(b.tmpl->argv[0]) || !ResolveExternalCmd(b.tmpl))
+  {
+    fprintf(stderr, "xbatch: %s: command not found\n", b.tmpl->argv[0]);
+    ReleaseCmdT(&b.tmpl);
+    lastExitStatus = 127;
+    return;
+  }
 
-  //add it to the struct
-  newBinding->cmd = newCmd;
-  newBinding->alias = newAlias;
+  //What is left of ARG_MAX once the environment and the fixed arguments are in
+  b.budget = sysconf(_SC_ARG_MAX) - 2048;
+  for (env = environ; *env != NULL; env++)
+    b.budget -= ARG_COST(*env);
+  for (i = 0; i < b.tmpl->argc; i++)
+    b.budget -= ARG_COST(b.tmpl->argv[i]);
 
-  //allocate it to an opening
-  int j = 0;
-  while( j < MAX_ALIASES)
+  //One item per line, from the redirected file or the shell's own input
+  OutFlush();
+  if (cmd->redirect_in != NULL && (in = fopen(cmd->redirect_in, "r")) == NULL)
+  {
+    fprintf(stderr, "xbatch: cannot open %s\n", cmd->redirect_in);
+    ReleaseCmdT(&b.tmpl);
+    lastExitStatus = 1;
+    return;
+  }
+  while ((len = getline(&line, &size, in)) != -1)
   {
-    if(bindingsArray[j] == NULL)
+    if (len > 0 && line[len - 1] == '\n')
+      line[--len] = '\0';
+    if (len == 0)
+      continue;
+    if (nitems == maxItems)
     {
-      bindingsArray[j] = newBinding;
-      break;
+      maxItems = maxItems * 2 + 1024;
+      items = realloc(items, sizeof(char*) * maxItems);
     }
-    j++;
+    items[nitems++] = strdup(line);
   }
-}
+  free(line);
+  if (in != stdin)
+    fclose(in);
+  else
+    clearerr(stdin);
 
-//removes alias from alias array
-static void RemoveAlias(char* alias)
-{
-  int j = 0;
-  while(j < MAX_ALIASES){
-    if(bindingsArray[j] != NULL)
-    {
-      if( strcmp(bindingsArray[j]-> alias , alias ) == 0)
-      {
+  //Parallel batches share the items out so that every one of them gets work
+  if (b.parallel > 1)
+  {
+    for (used = 0, i = 0; i < nitems; i++)
+      used += ARG_COST(items[i]);
+    if (used / b.parallel + 1 < b.budget)
+      b.budget = used / b.parallel + 1;
+  }
+  b.running = malloc(sizeof(pid_t) * b.parallel);
+  for (start = 0, used = 0, i = 0; i < nitems && !b.killed; i++)
+  {
+    if (i > start && used + ARG_COST(items[i]) > b.budget)
+    {
+      launchBatch(&b, items + start, i - start);
+      start = i;
+      used = 0;
+    }
+    used += ARG_COST(items[i]);
+  }
+  launchBatch(&b, items + start, nitems - start);
+  reapBatches(&b, 0);
+
+  if (verbose)
+    fprintf(stderr, "xbatch: %d items in %d batches (%d split on E2BIG)\n",
+            nitems, b.batches, b.splits);
+  //Like xargs: 125 when a batch was killed, 123 when one failed
+  lastExitStatus = b.killed ? 125 : b.failed ? 123 : 0;
+  for (i = 0; i < nitems; i++)
+    free(items[i]);
+  free(items);
+  free(b.running);
+  ReleaseCmdT(&b.tmpl);
+}
+
+//Results of the measured runs of bench
+typedef struct bench_t {
+  long long* wall;    /* ns from launch until reaped, one per measured run */
+  int runs;           /* measured runs so far */
+  int failed;         /* runs that exited with a status other than 0 */
+  bool killed;        /* a run was killed or stopped, stop launching */
+  long long user;     /* ns of cpu time over all measured runs */
+  long long sys;
+  long maxRss;        /* KB, largest of any run */
+} benchT;
+
+#define TV_NS(tv) ((tv).tv_sec * 1000000000LL + (tv).tv_usec * 1000LL)
+
+//Current CLOCK_MONOTONIC time in nanoseconds
+static long long nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//Account for one run, warmup runs only count when they fail badly
+static void benchRecord(benchT* b, bool measured, long long wall, struct rusage* usage, int status)
+{
+  if (status > 128)
+    b->killed = TRUE;
+  if (!measured)
+    return;
+  b->wall[b->runs++] = wall;
+  if (status != 0)
+    b->failed++;
+  b->user += TV_NS(usage->ru_utime);
+  b->sys += TV_NS(usage->ru_stime);
+  if (usage->ru_maxrss > b->maxRss)
+    b->maxRss = usage->ru_maxrss;
+}
+
+static int cmpLongLong(const void* a, const void* b)
+{
+  long long x = *(long long*)a, y = *(long long*)b;
+  return x < y ? -1 : x > y;
+}
+
+//Nearest-rank percentile of sorted values
+static long long percentile(long long* v, int n, int p)
+{
+  int rank = (n * p + 99) / 100;
+  return v[rank > 0 ? rank - 1 : 0];
+}
+
+//Print a string as a JSON string
+static void printJsonString(char* s)
+{
+  OutPrintf("\"");
+  for (; *s != '\0'; s++)
+  {
+    if (*s == '"' || *s == '\\')
+      OutPrintf("\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      OutPrintf("\\u%04x", *s);
+    else
+      OutPrintf("%c", *s);
+  }
+  OutPrintf("\"");
+}
+
+//Run a command repeatedly: bench [-n N] [-w WARMUP] [-j JOBS] [--json] cmd [args...]
+static void RunBench(commandT* cmd)
+{
+  benchT b;
+  commandT* tmpl;
+  pid_t* running;
+  long long* startedAt;
+  int* runOf;
+  int first, i, n = 10, warmup = 0, jobs = 1, nrunning = 0, launched;
+  long long start;
+  bool json = FALSE;
+  bgJobL* job;
+  char** arg;
+
+  for (first = 1; first < cmd->argc && cmd->argv[first][0] == '-'; first++)
+  {
+    if (strcmp(cmd->argv[first], "--json") == 0)
+      json = TRUE;
+    else if (strcmp(cmd->argv[first], "-n") == 0 && first + 1 < cmd->argc)
+      n = strtol(cmd->argv[++first], NULL, 10);
+    else if (strcmp(cmd->argv[first], "-w") == 0 && first + 1 < cmd->argc)
+      warmup = strtol(cmd->argv[++first], NULL, 10);
+    else if (strcmp(cmd->argv[first], "-j") == 0 && first + 1 < cmd->argc)
+      jobs = strtol(cmd->argv[++first], NULL, 10);
+    else
+      break;
+  }
+  if (first >= cmd->argc || n <= 0 || warmup < 0 || jobs <= 0)
+  {
+    fprintf(stderr, "usage: bench [-n N] [-w WARMUP] [-j JOBS] [--json] cmd [args...]\n");
+    lastExitStatus = 1;
+    return;
+  }
+
+  tmpl = ShiftCmdT(cmd, first);
+  if (IsBuiltIn(tmpl->argv[0]) || !ResolveExternalCmd(tmpl))
+  {
+    fprintf(stderr, "bench: %s: command not found\n", tmpl->argv[0]);
+    ReleaseCmdT(&tmpl);
+    lastExitStatus = 127;
+    return;
+  }
+  //More than one at a time run as background jobs
+  tmpl->bg = jobs > 1;
+
+  memset(&b, 0, sizeof(b));
+  b.wall = malloc(sizeof(long long) * n);
+  running = malloc(sizeof(pid_t) * jobs);
+  startedAt = malloc(sizeof(long long) * jobs);
+  runOf = malloc(sizeof(int) * jobs);
+  //Usage is only known for our own children
+  gNoSpawn = TRUE;
+  for (launched = 0; (launched < warmup + n && !b.killed) || nrunning > 0; )
+  {
+    if (jobs == 1)
+    {
+      start = nowNs();
+      Exec(tmpl, TRUE);
+      benchRecord(&b, launched >= warmup, gFgDoneAt - start, &gFgUsage, lastExitStatus);
+      launched++;
+    }
+    else if (nrunning < jobs && launched < warmup + n && !b.killed)
+    {
+      startedAt[nrunning] = nowNs();
+      running[nrunning] = Exec(tmpl, TRUE);
+      //Giving up on a jobserver slot ends the benchmark like a killed run
+      if (running[nrunning] == -1)
+      {
+        b.killed = TRUE;
+        continue;
+      }
+      runOf[nrunning++] = launched++;
+    }
+    else
+    {
+      i = waitJobs(running, nrunning, &job);
+      if (job != NULL)
+      {
+        benchRecord(&b, runOf[i] >= warmup, job->doneAt - startedAt[i], &job->usage, job->exitStatus);
+        RemoveBgJobFromList(job->pid);
+      }
+      nrunning--;
+      running[i] = running[nrunning];
+      startedAt[i] = startedAt[nrunning];
+      runOf[i] = runOf[nrunning];
+    }
+  }
+  gNoSpawn = FALSE;
+
+  if (b.runs > 0)
+  {
+    qsort(b.wall, b.runs, sizeof(long long), cmpLongLong);
+    if (json)
+    {
+      OutPrintf("{\"command\": ");
+      printJsonString(tmpl->argv[0]);
+      OutPrintf(", \"args\": [");
+      for (arg = tmpl->argv + 1; *arg != NULL; arg++)
+      {
+        printJsonString(*arg);
+        if (arg[1] != NULL)
+          OutPrintf(", ");
+      }
+      OutPrintf("], \"runs\": %d, \"warmup\": %d, \"jobs\": %d, \"failed\": %d, ",
+                b.runs, warmup, jobs, b.failed);
+      OutPrintf("\"wall_ns\": {\"min\": %lld, \"median\": %lld, \"p95\": %lld, \"p99\": %lld, \"max\": %lld}, ",
+                b.wall[0], percentile(b.wall, b.runs, 50), percentile(b.wall, b.runs, 95),
+                percentile(b.wall, b.runs, 99), b.wall[b.runs - 1]);
+      OutPrintf("\"user_ns\": %lld, \"sys_ns\": %lld, \"max_rss_kb\": %ld}\n",
+                b.user / b.runs, b.sys / b.runs, b.maxRss);
+    }
+    else
+    {
+      OutPrintf("%s: %d runs, %d warmup, %d at a time, %d failed\n",
+                tmpl->argv[0], b.runs, warmup, jobs, b.failed);
+      OutPrintf("          min     median        p95        p99        max\n");
+      OutPrintf("wall %8.3fms %8.3fms %8.3fms %8.3fms %8.3fms\n",
+                b.wall[0] / 1e6, percentile(b.wall, b.runs, 50) / 1e6,
+                percentile(b.wall, b.runs, 95) / 1e6, percentile(b.wall, b.runs, 99) / 1e6,
+                b.wall[b.runs - 1] / 1e6);
+      OutPrintf("user %8.3fms  sys %8.3fms  per run, max rss %ld KB\n",
+                b.user / b.runs / 1e6, b.sys / b.runs / 1e6, b.maxRss);
+    }
+  }
+  lastExitStatus = b.killed || b.failed > 0;
+
+  free(b.wall);
+  free(running);
+  free(startedAt);
+  free(runOf);
+  ReleaseCmdT(&tmpl);
+}
+
+//Node states of graph run
+#define GRAPH_PENDING  0
+#define GRAPH_RUNNING  1
+#define GRAPH_OK       2
+#define GRAPH_FAILED   3
+#define GRAPH_SKIPPED  4
+#define GRAPH_DETACHED 5
+static const char* kGraphStates[] = { "pending", "running", "ok", "failed", "skipped", "detached" };
+
+//A step of a pipeline run by graph run
+typedef struct graph_node_t {
+  char* id;
+  commandT* cmd;
+  char** depNames;    /* as written, resolved into deps once the whole file is read */
+  int* deps;          /* indices of the nodes it needs */
+  int ndeps;
+  int waiting;        /* dependencies that have not finished yet */
+  double weight;      /* expected seconds, from the previous report, 1 without one */
+  double path;        /* longest sum of weights from here to the end of the graph */
+  int state;
+  pid_t pid;
+  int exitStatus;
+  long long start, end;
+} graphNodeT;
+
+//Release the nodes of a graph
+static void freeGraph(graphNodeT* nodes, int n)
+{
+  int i, j;
+
+  for (i = 0; i < n; i++)
+  {
+    free(nodes[i].id);
+    for (j = 0; j < nodes[i].ndeps; j++)
+      free(nodes[i].depNames[j]);
+    free(nodes[i].depNames);
+    free(nodes[i].deps);
+    if (nodes[i].cmd != NULL)
+      ReleaseCmdT(&nodes[i].cmd);
+  }
+  free(nodes);
+}
+
+//Read "ID [DEP...] : COMMAND" lines, returns the number of nodes or -1
+static int loadGraph(char* file, graphNodeT** out)
+{
+  FILE* f = fopen(file, "r");
+  char* line = NULL;
+  size_t size = 0;
+  graphNodeT* nodes = NULL;
+  graphNodeT* node;
+  int n = 0, cap = 0, lineNo = 0, ncmds, i, j;
+  char *p, *colon, *word;
+  commandT** cmds;
+
+  if (f == NULL)
+  {
+    PrintPError(file);
+    return -1;
+  }
+  while (getline(&line, &size, f) != -1)
+  {
+    lineNo++;
+    line[strcspn(line, "\n")] = '\0';
+    for (p = line; *p == ' ' || *p == '\t'; p++);
+    if (*p == '\0' || *p == '#')
+      continue;
+    colon = strchr(p, ':');
+    if (colon == NULL || colon == p)
+    {
+      fprintf(stderr, "graph: %s:%d: expected ID [DEPS...] : COMMAND\n", file, lineNo);
+      goto fail;
+    }
+    *colon = '\0';
+    if (n == cap)
+    {
+      cap = cap * 2 + 16;
+      nodes = realloc(nodes, sizeof(graphNodeT) * cap);
+    }
+    node = &nodes[n++];
+    memset(node, 0, sizeof(*node));
+    node->weight = 1;
+    node->depNames = malloc(sizeof(char*) * (strlen(p) / 2 + 1));
+    for (word = strtok(p, " \t"); word != NULL; word = strtok(NULL, " \t"))
+    {
+      if (node->id == NULL)
+        node->id = strdup(word);
+      else
+        node->depNames[node->ndeps++] = strdup(word);
+    }
+    for (p = colon + 1; *p == ' ' || *p == '\t'; p++);
+    cmds = *p == '\0' ? NULL : ParseCmdLine(p, &ncmds);
+    if (cmds == NULL || ncmds != 1)
+    {
+      fprintf(stderr, "graph: %s:%d: node %s needs a single command\n", file, lineNo, node->id);
+      goto fail;
+    }
+    node->cmd = cmds[0];
+    free(cmds);
+    //A node is a process of its own, which a builtin is not
+    if (IsBuiltIn(node->cmd->argv[0]))
+    {
+      fprintf(stderr, "graph: %s:%d: %s: a builtin cannot be a node\n", file, lineNo, node->cmd->argv[0]);
+      goto fail;
+    }
+    if (!ResolveExternalCmd(node->cmd))
+    {
+      fprintf(stderr, "graph: %s:%d: %s: command not found\n", file, lineNo, node->cmd->argv[0]);
+      goto fail;
+    }
+    //Every node runs as a background job, which must not read the terminal
+    node->cmd->bg = 1;
+    if (node->cmd->redirect_in == NULL)
+      node->cmd->redirect_in = strdup("/dev/null");
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    for (j = 0; j < i; j++)
+      if (strcmp(nodes[i].id, nodes[j].id) == 0)
+      {
+        fprintf(stderr, "graph: node %s is defined twice\n", nodes[i].id);
+        goto fail;
+      }
+    nodes[i].deps = malloc(sizeof(int) * (nodes[i].ndeps + 1));
+    for (j = 0; j < nodes[i].ndeps; j++)
+    {
+      for (nodes[i].deps[j] = 0; nodes[i].deps[j] < n; nodes[i].deps[j]++)
+        if (strcmp(nodes[nodes[i].deps[j]].id, nodes[i].depNames[j]) == 0)
+          break;
+      if (nodes[i].deps[j] == n)
+      {
+        fprintf(stderr, "graph: node %s needs %s, which is not defined\n",
+                nodes[i].id, nodes[i].depNames[j]);
+        goto fail;
+      }
+    }
+  }
+  free(line);
+  fclose(f);
+  *out = nodes;
+  return n;
+
+fail:
+  free(line);
+  fclose(f);
+  freeGraph(nodes, n);
+  return -1;
+}
+
+//Take the expected duration of each node from the wall times of an earlier report
+static void readGraphWeights(char* report, graphNodeT* nodes, int n)
+{
+  FILE* f = fopen(report, "r");
+  char* line = NULL;
+  size_t size = 0;
+  char id[256], state[16];
+  double start, wall;
+  int i, status;
+
+  if (f == NULL)
+    return;
+  while (getline(&line, &size, f) != -1)
+  {
+    if (line[0] == '#' ||
+        sscanf(line, "%255s %15s %d %lf %lf", id, state, &status, &start, &wall) != 5 ||
+        (strcmp(state, "ok") != 0 && strcmp(state, "failed") != 0))
+      continue;
+    for (i = 0; i < n; i++)
+      if (strcmp(nodes[i].id, id) == 0)
+        nodes[i].weight = wall;
+  }
+  free(line);
+  fclose(f);
+}
+
+//Order the nodes so that dependencies come first and work out the critical path of each, false on a cycle
+static bool rankGraph(graphNodeT* nodes, int n)
+{
+  int* order = malloc(sizeof(int) * n);
+  int* left = malloc(sizeof(int) * n);
+  int i, j, k, done = 0;
+
+  for (i = 0; i < n; i++)
+  {
+    left[i] = nodes[i].ndeps;
+    if (left[i] == 0)
+      order[done++] = i;
+  }
+  for (k = 0; k < done; k++)
+    for (i = 0; i < n; i++)
+      for (j = 0; j < nodes[i].ndeps; j++)
+        if (nodes[i].deps[j] == order[k] && --left[i] == 0)
+          order[done++] = i;
+  if (done == n)
+  {
+    //Dependents come later in the order, so theirs are known when a node is reached
+    for (k = n - 1; k >= 0; k--)
+    {
+      i = order[k];
+      nodes[i].path += nodes[i].weight;
+      for (j = 0; j < nodes[i].ndeps; j++)
+        if (nodes[nodes[i].deps[j]].path < nodes[i].path)
+          nodes[nodes[i].deps[j]].path = nodes[i].path;
+    }
+  }
+  for (i = 0; i < n; i++)
+    nodes[i].waiting = nodes[i].ndeps;
+  free(order);
+  free(left);
+  return done == n;
+}
+
+//Mark everything that needs a node as skipped
+static void skipDependents(graphNodeT* nodes, int n, int failed)
+{
+  int i, j;
+
+  for (i = 0; i < n; i++)
+    for (j = 0; j < nodes[i].ndeps; j++)
+      if (nodes[i].deps[j] == failed && nodes[i].state == GRAPH_PENDING)
+      {
+        nodes[i].state = GRAPH_SKIPPED;
+        skipDependents(nodes, n, i);
+      }
+}
+
+//Wait for one of the running nodes, -1 when ctrl-c or ctrl-z came first
+static int waitGraph(graphNodeT* nodes, int* running, int n, bgJobL** done)
+{
+  sigset_t x, old;
+  bgJobL* job;
+  int i;
+
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigaddset(&x, SIGINT);
+  sigaddset(&x, SIGTSTP);
+  sigprocmask(SIG_BLOCK, &x, &old);
+  for (;;)
+  {
+    reapSpawned();
+    for (i = 0; i < n; i++)
+    {
+      job = findBgJobPid(nodes[running[i]].pid);
+      if (job == NULL || strcmp(job->status, "Done") == 0)
+      {
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        *done = job;
+        return i;
+      }
+    }
+    if (gInterrupt != 0)
+    {
+      sigprocmask(SIG_SETMASK, &old, NULL);
+      return -1;
+    }
+    sigsuspend(&old);
+  }
+}
+
+//Print or write the per-node report, times in seconds since the graph started
+static void reportGraph(graphNodeT* nodes, int n, long long t0, char* report)
+{
+  FILE* f = NULL;
+  graphNodeT* node;
+  double start, wall;
+  int i;
+
+  if (report != NULL && (f = fopen(report, "w")) == NULL)
+    PrintPError(report);
+  if (f != NULL)
+    fprintf(f, "# node status exit start wall path\n");
+  else
+    OutPrintf("%-16s %-8s %4s %9s %9s %9s\n", "node", "status", "exit", "start", "wall", "path");
+  for (i = 0; i < n; i++)
+  {
+    node = &nodes[i];
+    start = node->start == 0 ? 0 : (node->start - t0) / 1e9;
+    wall = node->end == 0 ? 0 : (node->end - node->start) / 1e9;
+    if (f != NULL)
+      fprintf(f, "%s %s %d %.3f %.3f %.3f\n", node->id, kGraphStates[node->state],
+              node->exitStatus, start, wall, node->path);
+    else
+      OutPrintf("%-16s %-8s %4d %9.3f %9.3f %9.3f\n", node->id, kGraphStates[node->state],
+                node->exitStatus, start, wall, node->path);
+  }
+  if (f != NULL)
+    fclose(f);
+}
+
+//Run a dependency graph of commands: graph run [-j N] [-k] [-o REPORT] FILE
+static void RunGraph(commandT* cmd)
+{
+  graphNodeT* nodes;
+  int* running;
+  int first, i, j, n, jobs, nrunning = 0, pick, failed = 0;
+  bool keepGoing = FALSE, stopping = FALSE, interrupted = FALSE, detached = FALSE;
+  char* report = NULL;
+  long long t0;
+  bgJobL* job;
+
+  jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  for (first = 2; first < cmd->argc && cmd->argv[first][0] == '-'; first++)
+  {
+    if (strcmp(cmd->argv[first], "-k") == 0)
+      keepGoing = TRUE;
+    else if (strcmp(cmd->argv[first], "-j") == 0 && first + 1 < cmd->argc)
+      jobs = strtol(cmd->argv[++first], NULL, 10);
+    else if (strcmp(cmd->argv[first], "-o") == 0 && first + 1 < cmd->argc)
+      report = cmd->argv[++first];
+    else
+      break;
+  }
+  if (cmd->argc < 2 || strcmp(cmd->argv[1], "run") != 0 || first != cmd->argc - 1 || jobs <= 0)
+  {
+    fprintf(stderr, "usage: graph run [-j JOBS] [-k] [-o REPORT] FILE\n");
+    lastExitStatus = 2;
+    return;
+  }
+  n = loadGraph(cmd->argv[first], &nodes);
+  if (n == -1)
+  {
+    lastExitStatus = 2;
+    return;
+  }
+  if (report != NULL)
+    readGraphWeights(report, nodes, n);
+  if (!rankGraph(nodes, n))
+  {
+    fprintf(stderr, "graph: %s: the dependencies form a cycle\n", cmd->argv[first]);
+    freeGraph(nodes, n);
+    lastExitStatus = 2;
+    return;
+  }
+
+  running = malloc(sizeof(int) * (n + 1));
+  gInterrupt = 0;
+  t0 = nowNs();
+  for (;;)
+  {
+    //Start the ready node with the longest way to go, as long as there are slots
+    while (nrunning < jobs && !stopping)
+    {
+      pick = -1;
+      for (i = 0; i < n; i++)
+        if (nodes[i].state == GRAPH_PENDING && nodes[i].waiting == 0 &&
+            (pick == -1 || nodes[i].path > nodes[pick].path))
+          pick = i;
+      if (pick == -1)
+        break;
+      nodes[pick].start = nowNs();
+      nodes[pick].pid = Exec(nodes[pick].cmd, TRUE);
+      if (nodes[pick].pid == -1)
+      {
+        interrupted = TRUE;
+        stopping = TRUE;
+        break;
+      }
+      nodes[pick].state = GRAPH_RUNNING;
+      running[nrunning++] = pick;
+    }
+    if (nrunning == 0)
+      break;
+
+    i = waitGraph(nodes, running, nrunning, &job);
+    if (i == -1)
+    {
+      //ctrl-z leaves the running nodes to the job table, ctrl-c ends them
+      if (gInterrupt == SIGTSTP)
+      {
+        for (j = 0; j < nrunning; j++)
+          nodes[running[j]].state = GRAPH_DETACHED;
+        nrunning = 0;
+        detached = TRUE;
+        break;
+      }
+      for (j = 0; j < nrunning; j++)
+        kill(-nodes[running[j]].pid, SIGINT);
+      gInterrupt = 0;
+      interrupted = TRUE;
+      stopping = TRUE;
+      continue;
+    }
+
+    pick = running[i];
+    running[i] = running[--nrunning];
+    nodes[pick].end = job != NULL ? job->doneAt : nowNs();
+    nodes[pick].exitStatus = job != NULL ? job->exitStatus : 0;
+    //Nodes are reported by the graph, not by CheckJobs
+    if (job != NULL)
+      RemoveBgJobFromList(job->pid);
+    if (nodes[pick].exitStatus == 0)
+    {
+      nodes[pick].state = GRAPH_OK;
+      for (i = 0; i < n; i++)
+        for (j = 0; j < nodes[i].ndeps; j++)
+          if (nodes[i].deps[j] == pick)
+            nodes[i].waiting--;
+    }
+    else
+    {
+      nodes[pick].state = GRAPH_FAILED;
+      failed++;
+      if (keepGoing)
+        skipDependents(nodes, n, pick);
+      else
+        stopping = TRUE;
+    }
+  }
+  gInterrupt = 0;
+
+  for (i = 0; i < n; i++)
+    if (nodes[i].state == GRAPH_PENDING || nodes[i].state == GRAPH_SKIPPED)
+    {
+      nodes[i].state = GRAPH_SKIPPED;
+      failed++;
+    }
+  reportGraph(nodes, n, t0, report);
+  if (detached)
+  {
+    for (i = 0, j = 0; i < n; i++)
+      j += nodes[i].state == GRAPH_DETACHED;
+    OutPrintf("graph: stopped waiting, %d nodes left running as jobs\n", j);
+  }
+  lastExitStatus = detached ? 148 : interrupted ? 130 : failed > 0 ? 1 : 0;
+  free(running);
+  freeGraph(nodes, n);
+}
+
+
+//The body of a subshell running a loaded builtin in the background, its redirections are in place
+static void loadableBody(void* arg)
+{
+  commandT* cmd = arg;
+  tshBuiltinT* builtin = LoadableFind(cmd->argv[0]);
+
+  lastExitStatus = LoadableRun(builtin, cmd->argc, cmd->argv, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
+}
+
+//Run a loaded builtin in the shell itself, with the redirections opened for it
+static void RunLoadable(commandT* cmd, tshBuiltinT* builtin)
+{
+  int in = STDIN_FILENO, out = STDOUT_FILENO;
+
+  //In the background, or writing through a compressor or to several files, it cannot be in the shell: it gets a subshell of its own
+  if (cmd->bg || relayedOutput(cmd))
+  {
+    if (cmd->name == NULL)
+      cmd->name = strdup("tsh");
+    RunSubshell(cmd, loadableBody, cmd);
+    return;
+  }
+  if (cmd->redirect_in != NULL && (in = OpenRedirect(cmd->redirect_in, O_RDONLY | O_CLOEXEC)) == -1)
+  {
+    PrintPError(cmd->redirect_in);
+    lastExitStatus = 1;
+    return;
+  }
+  if (cmd->redirect_out != NULL &&
+      (out = OpenRedirect(cmd->redirect_out, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC)) == -1)
+  {
+    PrintPError(cmd->redirect_out);
+    if (in != STDIN_FILENO)
+      close(in);
+    lastExitStatus = 1;
+    return;
+  }
+  OutFlush();
+  lastExitStatus = LoadableRun(builtin, cmd->argc, cmd->argv, in, out, STDERR_FILENO);
+  if (in != STDIN_FILENO)
+    close(in);
+  if (out != STDOUT_FILENO)
+    close(out);
+}
+
+//Add the comma separated items of a cached option to the key, as files or as variables
+static void keyList(resultKeyT* key, char* list, bool files, bool byMtime)
+{
+  char* copy = strdup(list);
+  char *item, *save, *value;
+
+  for (item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    if (files)
+      ResultKeyFile(key, item, byMtime);
+    else
+    {
+      //Unset and empty are not the same
+      value = getenv(item);
+      ResultKeyAdd(key, item);
+      ResultKeyAdd(key, value != NULL ? value : "\001unset");
+    }
+  free(copy);
+}
+
+//Run a command through the result cache: cached [--inputs FILE,...] [--env VAR,...] [--mtime] cmd [args...]
+static void RunCached(commandT* cmd)
+{
+  resultKeyT key;
+  commandT* sub;
+  char cwd[PATH_MAX];
+  char **inputs, **vars;
+  int first, i, ninputs = 0, nvars = 0, outFd = STDOUT_FILENO, status, fds[2];
+  bool byMtime = FALSE;
+  long long start;
+
+  if ((cmd->argc == 2 && (strcmp(cmd->argv[1], "--stats") == 0 || strcmp(cmd->argv[1], "--clear") == 0)) ||
+      (cmd->argc == 3 && strcmp(cmd->argv[1], "--limit") == 0))
+  {
+    ResultCacheConfigure(cmd->argc, cmd->argv);
+    return;
+  }
+  //The key is made once byMtime is known, whatever the order of the options
+  inputs = malloc(sizeof(char*) * cmd->argc);
+  vars = malloc(sizeof(char*) * cmd->argc);
+  for (first = 1; first < cmd->argc && cmd->argv[first][0] == '-'; first++)
+  {
+    if (strcmp(cmd->argv[first], "--inputs") == 0 && first + 1 < cmd->argc)
+      inputs[ninputs++] = cmd->argv[++first];
+    else if (strcmp(cmd->argv[first], "--env") == 0 && first + 1 < cmd->argc)
+      vars[nvars++] = cmd->argv[++first];
+    else if (strcmp(cmd->argv[first], "--mtime") == 0)
+      byMtime = TRUE;
+    else
+      break;
+  }
+  if (first >= cmd->argc || cmd->bg)
+  {
+    ResultCacheConfigure(0, NULL);
+    free(inputs);
+    free(vars);
+    lastExitStatus = 1;
+    return;
+  }
+  sub = ShiftCmdT(cmd, first);
+  //Builtins change the shell, which is not something to replay
+  if (IsBuiltIn(sub->argv[0]))
+  {
+    fprintf(stderr, "cached: %s is a builtin\n", sub->argv[0]);
+    ReleaseCmdT(&sub);
+    free(inputs);
+    free(vars);
+    lastExitStatus = 1;
+    return;
+  }
+  if (!ResolveExternalCmd(sub))
+  {
+    fprintf(stderr, "cached: %s: command not found\n", sub->argv[0]);
+    ReleaseCmdT(&sub);
+    free(inputs);
+    free(vars);
+    lastExitStatus = 127;
+    return;
+  }
+
+  //The program, its arguments, where it runs, the variables and files it reads
+  ResultKeyInit(&key);
+  ResultKeyFile(&key, sub->name, TRUE);
+  for (i = 0; i < sub->argc; i++)
+    ResultKeyAdd(&key, sub->argv[i]);
+  ResultKeyAdd(&key, getcwd(cwd, sizeof(cwd)) != NULL ? cwd : "");
+  for (i = 0; i < nvars; i++)
+    keyList(&key, vars[i], FALSE, FALSE);
+  for (i = 0; i < ninputs; i++)
+    keyList(&key, inputs[i], TRUE, byMtime);
+  if (sub->redirect_in != NULL)
+    ResultKeyFile(&key, sub->redirect_in, byMtime);
+  free(inputs);
+  free(vars);
+
+  //Output that goes through a compressor or to several files is not captured, the command just runs
+  if (relayedOutput(sub))
+  {
+    Exec(sub, TRUE);
+    ReleaseCmdT(&sub);
+    return;
+  }
+  //A result is replayed to where the command would have written it
+  if (sub->redirect_out != NULL)
+  {
+    outFd = OpenRedirect(sub->redirect_out, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC);
+    if (outFd == -1)
+    {
+      PrintPError(sub->redirect_out);
+      ReleaseCmdT(&sub);
+      lastExitStatus = 1;
+      return;
+    }
+    free(sub->redirect_out);
+    sub->redirect_out = NULL;
+    sub->is_redirect_out = 0;
+  }
+  OutFlush();
+  if (ResultReplay(&key, outFd, STDERR_FILENO, &status))
+    lastExitStatus = status;
+  else if (ResultCapture(fds))
+  {
+    gInterrupt = 0;
+    start = nowNs();
+    execWithOutput(sub, fds[0], fds[1]);
+    //Whatever was interrupted or killed is not what the command outputs
+    ResultStore(&key, fds, lastExitStatus, nowNs() - start, lastExitStatus < 128 && gInterrupt == 0,
+                outFd, STDERR_FILENO);
+  }
+  //No cache directory: just run it
+  else
+    execWithOutput(sub, outFd, STDERR_FILENO);
+  if (outFd != STDOUT_FILENO)
+    close(outFd);
+  ReleaseCmdT(&sub);
+}
+
+//Run a foreground command with fds 1 and 2 pointing elsewhere, put back afterwards
+static void execWithOutput(commandT* cmd, int out, int err)
+{
+  int saved[2];
+
+  OutFlush();
+  saved[0] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+  saved[1] = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 10);
+  dup2(out, STDOUT_FILENO);
+  dup2(err, STDERR_FILENO);
+  Exec(cmd, TRUE);
+  OutFlush();
+  dup2(saved[0], STDOUT_FILENO);
+  dup2(saved[1], STDERR_FILENO);
+  close(saved[0]);
+  close(saved[1]);
+}
+
+//Start a command in the background with its stdin and stdout on pipes to the shell
+static void RunCoproc(commandT* cmd)
+{
+  commandT* sub;
+  coprocL *co, **link;
+  char *name = "COPROC", var[256], value[32];
+  int first = 1, in[2], out[2];
+  pid_t pid;
+
+  //coproc NAME cmd [args], or coproc cmd for COPROC
+  if (cmd->argc > 2)
+  {
+    name = cmd->argv[1];
+    first = 2;
+  }
+  if (cmd->argc < 2 || strlen(name) > 200 || strspn(name, "_abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789") != strlen(name) ||
+      (name[0] >= '0' && name[0] <= '9'))
+  {
+    fprintf(stderr, "usage: coproc [NAME] command [args]\n");
+    lastExitStatus = 1;
+    return;
+  }
+  for (link = &gCoprocs; (co = *link) != NULL; link = &co->next)
+    if (strcmp(co->name, name) == 0)
+      break;
+  if (co != NULL && coprocRunning(co))
+  {
+    fprintf(stderr, "coproc: %s is still running\n", name);
+    lastExitStatus = 1;
+    return;
+  }
+  //The pipes of a coprocess stay open after it is done, what it printed last can still be read, until the name is reused
+  if (co != NULL)
+  {
+    *link = co->next;
+    close(co->fds[0]);
+    close(co->fds[1]);
+    free(co->name);
+    free(co);
+  }
+  sub = ShiftCmdT(cmd, first);
+  //A builtin has no process of its own to talk to
+  if (IsBuiltIn(sub->argv[0]))
+  {
+    fprintf(stderr, "coproc: %s is a builtin\n", sub->argv[0]);
+    ReleaseCmdT(&sub);
+    lastExitStatus = 1;
+    return;
+  }
+  if (!ResolveExternalCmd(sub))
+  {
+    fprintf(stderr, "coproc: %s: command not found\n", sub->argv[0]);
+    ReleaseCmdT(&sub);
+    lastExitStatus = 127;
+    return;
+  }
+  //Close on exec, the other jobs must not keep the coprocess from seeing the end of its input
+  if (pipe(in) == -1 || pipe(out) == -1)
+  {
+    PrintPError("coproc");
+    ReleaseCmdT(&sub);
+    lastExitStatus = 1;
+    return;
+  }
+  for (first = 0; first < 2; first++)
+  {
+    fcntl(in[first], F_SETFD, FD_CLOEXEC);
+    fcntl(out[first], F_SETFD, FD_CLOEXEC);
+  }
+  //The pipes take the place of any redirection, the job is dup2()ed onto them like onto a file
+  free(sub->redirect_in);
+  free(sub->redirect_out);
+  snprintf(value, sizeof(value), "&%d", in[0]);
+  sub->redirect_in = strdup(value);
+  snprintf(value, sizeof(value), "&%d", out[1]);
+  sub->redirect_out = strdup(value);
+  if (sub->redirect_tee != NULL)
+  {
+    for (first = 0; sub->redirect_tee[first] != NULL; first++)
+      free(sub->redirect_tee[first]);
+    free(sub->redirect_tee);
+    sub->redirect_tee = NULL;
+  }
+  sub->is_redirect_in = sub->is_redirect_out = 1;
+  sub->bg = 1;
+  PrefetchRecord(sub->argv[0], sub->name);
+  pid = Exec(sub, TRUE);
+  close(in[0]);
+  close(out[1]);
+  ReleaseCmdT(&sub);
+  //No jobserver slot came (ctrl-c while waiting), there is no coprocess to keep the other ends for
+  if (pid == -1)
+  {
+    close(in[1]);
+    close(out[0]);
+    lastExitStatus = 1;
+    return;
+  }
+
+  co = malloc(sizeof(coprocL));
+  co->name = strdup(name);
+  co->pid = pid;
+  co->fds[0] = out[0];
+  co->fds[1] = in[1];
+  co->next = gCoprocs;
+  gCoprocs = co;
+  snprintf(var, sizeof(var), "%s[0]", name);
+  snprintf(value, sizeof(value), "%d", co->fds[0]);
+  SetVar(var, value);
+  snprintf(var, sizeof(var), "%s[1]", name);
+  snprintf(value, sizeof(value), "%d", co->fds[1]);
+  SetVar(var, value);
+  snprintf(var, sizeof(var), "%s_PID", name);
+  snprintf(value, sizeof(value), "%d", (int)pid);
+  SetVar(var, value);
+  lastExitStatus = 0;
+}
+
+static bool coprocRunning(coprocL* co)
+{
+  bgJobL* job = findBgJobPid(co->pid);
+
+  return (job != NULL && strcmp(job->status, "Done") != 0) || (fgJob != NULL && fgJob->pid == co->pid);
+}
+
+//Read a line into a variable, a byte at a time so that nothing after it is taken out of a pipe
+static void RunRead(commandT* cmd)
+{
+  struct pollfd p;
+  size_t used = 0, size = 128;
+  char *line, c;
+  ssize_t n = 0;
+  int fd = STDIN_FILENO;
+
+  if (cmd->argc != 2)
+  {
+    fprintf(stderr, "usage: read NAME\n");
+    lastExitStatus = 1;
+    return;
+  }
+  if (cmd->redirect_in != NULL && (fd = OpenRedirect(cmd->redirect_in, O_RDONLY | O_CLOEXEC)) == -1)
+  {
+    PrintPError(cmd->redirect_in);
+    lastExitStatus = 1;
+    return;
+  }
+  OutFlush();
+  line = malloc(size);
+  gInterrupt = 0;
+  p.fd = fd;
+  p.events = POLLIN;
+  for (;;)
+  {
+    //Reads restart after a signal, poll() does not: ctrl-c gets out of a coprocess that does not answer
+    if (poll(&p, 1, -1) == -1)
+    {
+      if (errno == EINTR && gInterrupt != SIGINT)
+        continue;
+      break;
+    }
+    if ((n = read(fd, &c, 1)) == -1 && errno == EINTR)
+      continue;
+    if (n <= 0 || c == '\n')
+      break;
+    if (used + 1 == size)
+      line = realloc(line, size *= 2);
+    line[used++] = c;
+  }
+  line[used] = '\0';
+  if (gInterrupt == SIGINT)
+    lastExitStatus = 130;
+  //At the end of the input a last line without a newline still counts
+  else if (n <= 0 && used == 0)
+    lastExitStatus = 1;
+  else
+  {
+    SetVar(cmd->argv[1], line);
+    lastExitStatus = 0;
+  }
+  free(line);
+  if (fd != STDIN_FILENO)
+    close(fd);
+}
+
+
+//////////////////////////////////////////////////////////////
+//  Alias Code (Internal Commmand)
+//////////////////////////////////////////////////////////////
+
+typedef struct binding_l{
+  char* cmd;
+  char* alias;
+  bool mapped;  /* the strings live in the state snapshot and are not freed */
+  struct binding_l* next;
+} Binding;
+
+//aliases are kept in a hash table so that rc files can define thousands of them
+#define ALIAS_BUCKETS 1024
+static Binding* bindings[ALIAS_BUCKETS] = { };
+static int numAliases = 0;
+
+//Find the bucket of an alias
+static Binding** aliasBucket(char* alias)
+{
+  unsigned long h = 5381;
+  while (*alias != '\0')
+    h = h * 33 + (unsigned char)*alias++;
+  return &bindings[h % ALIAS_BUCKETS];
+}
+
+//Adds an alias to the alias table
+static void AddAlias(commandT* cmd)
+{
+
+  //fprintf(stdout, "%s is the cmdline\n", cmd->cmdline);
+  fflush(stdout);
+
+
+  //parse out the command to alias and the alias itself
+  //getthe indexes
+  int indexStart =0;
+  int indexQuoteClose = 0;
+  int indexQuoteOpen = 0;
+  int indexEqualSign = 0;
+
+  int length = strlen(cmd->cmdline);
+  int idx = 0;
+  while(idx < length){
+
+    if(cmd->cmdline[idx] == ' ' && indexStart==0)
+      indexStart = idx + 1;
+
+    if(cmd->cmdline[idx] == '\''){
+
+      if(indexQuoteOpen == 0)
+        indexQuoteOpen = idx;
+      else
+        indexQuoteClose = idx;
+
+    }
+    if(cmd->cmdline[idx] == '='){
+
+      indexEqualSign = idx;
+
+    }
+    idx++;
+  }
+
+  //use the indexes to copy to a new string
+
+  //allocate the strings
+  char* newAlias = (char*) malloc(indexEqualSign + 1);
+  char* newCmd = (char*) malloc(indexQuoteClose - indexQuoteOpen + 1);
+
+  //copy contents
+  //strncpy(dest, src + beginIndex, endIndex - beginIndex);
+  strncpy(newAlias, cmd->cmdline + indexStart, indexEqualSign - indexStart);
+  strncpy(newCmd, cmd->cmdline + indexQuoteOpen + 1, indexQuoteClose - indexQuoteOpen - 1);
+  newAlias[indexEqualSign - indexStart] = '\0';
+  newCmd[indexQuoteClose - indexQuoteOpen - 1] = '\0';
+
+  DefineAlias(newAlias, newCmd, FALSE);
+}
+
+//Binds an alias, replacing an earlier binding of the same name
+void DefineAlias(char* alias, char* cmd, bool mapped)
+{
+  Binding *newBinding;
+  Binding **bucket = aliasBucket(alias);
+
+  RemoveAlias(alias);
+  newBinding = (Binding*)malloc(sizeof(Binding));
+  newBinding->cmd = cmd;
+  newBinding->alias = alias;
+  newBinding->mapped = mapped;
+  newBinding->next = *bucket;
+  *bucket = newBinding;
+  numAliases++;
+}
 
-        free(bindingsArray[j]->cmd);
-        free(bindingsArray[j]->alias);
+//removes alias from alias table
+static void RemoveAlias(char* alias)
+{
+  Binding **link = aliasBucket(alias);
+  Binding *binding;
 
-        free(bindingsArray[j]);
-        bindingsArray[j] = NULL; //setis back to 0
+  while ((binding = *link) != NULL)
+  {
+    if (strcmp(binding->alias, alias) == 0)
+    {
+      *link = binding->next;
+      if (!binding->mapped)
+      {
+        free(binding->cmd);
+        free(binding->alias);
       }
-    } 
-    j++;
+      free(binding);
+      numAliases--;
+      return;
+    }
+    link = &binding->next;
   }
 }
 
@@ -632,77 +2566,173 @@ int cstring_cmp(const void *a, const void *b)
 
 static void PrintAliases()
 {
+  char** lines = malloc(sizeof(char*) * (numAliases + 1));
+  Binding* binding;
+  int j, last = 0;
 
-  //figure out how much data to allocate for the sorted data
-  int numAliases = 0;
-  int j = 0;
-  while(j < MAX_ALIASES){
-    if(bindingsArray[j] != NULL)
-      numAliases++;
-    j++;
-  }
-
-  //allocate the array
-  char* bindingsArrayCopy[numAliases];
-
-  //add data to it
-  j = 0;
-  int last = 0;
-  char str[numAliases][800];
-  while(j < MAX_ALIASES){
-    if(bindingsArray[j] != NULL)
+  //format every binding, then sort them
+  for (j = 0; j < ALIAS_BUCKETS; j++)
+  {
+    for (binding = bindings[j]; binding != NULL; binding = binding->next)
     {
-      
-      strcpy (str[last], "alias ");
-      strcat (str[last], bindingsArray[j]->alias);
-      strcat (str[last], "='");
-      strcat (str[last], bindingsArray[j]->cmd);
-      strcat (str[last], "'\n");
-
-      bindingsArrayCopy[last] = str[last];
+      lines[last] = malloc(strlen(binding->alias) + strlen(binding->cmd) + 12);
+      sprintf(lines[last], "alias %s='%s'\n", binding->alias, binding->cmd);
       last++;
     }
-    j++;
   }
 
-  qsort(bindingsArrayCopy, numAliases, sizeof(char *) , cstring_cmp);
+  qsort(lines, last, sizeof(char *) , cstring_cmp);
 
   //print it out
-  j = 0;
-  while(j < numAliases){
-    fprintf(stdout, "%s", bindingsArrayCopy[j] );
-    fflush(stdout);
-    j++;
+  for (j = 0; j < last; j++)
+  {
+    OutPrintf("%s", lines[j]);
+    free(lines[j]);
   }
+  free(lines);
+}
+
+//Calls fn for every alias
+void ForEachAlias(void (*fn)(char*, char*, void*), void* arg)
+{
+  Binding* binding;
+  int j;
+  for (j = 0; j < ALIAS_BUCKETS; j++)
+    for (binding = bindings[j]; binding != NULL; binding = binding->next)
+      fn(binding->alias, binding->cmd, arg);
 }
 
 //Test to see if this command is an alias
 bool IsAlias(char* alias)
 {
-  int j = 0;
-  while(j < MAX_ALIASES)
+  return GetAliasCmd(alias) != NULL;
+}
+
+//Hash of all alias definitions, independent of the order they were made in
+unsigned long AliasFingerprint()
+{
+  unsigned long sum = 0, h;
+  Binding* binding;
+  char* c;
+  int j;
+  for(j = 0; j < ALIAS_BUCKETS; j++)
   {
-    if(bindingsArray[j] != NULL)
+    for (binding = bindings[j]; binding != NULL; binding = binding->next)
     {
-      if( strcmp(bindingsArray[j]-> alias , alias ) == 0)
-        return TRUE;
+      h = 14695981039346656037UL;
+      for(c = binding->alias; *c != '\0'; c++)
+        h = (h ^ (unsigned char)*c) * 1099511628211UL;
+      h = (h ^ '=') * 1099511628211UL;
+      for(c = binding->cmd; *c != '\0'; c++)
+        h = (h ^ (unsigned char)*c) * 1099511628211UL;
+      sum += h;
     }
-    j++;
   }
-  return FALSE;
+  return sum;
 }
 
 char* GetAliasCmd(char* alias)
 {
-  int j = 0;
-  while(j < MAX_ALIASES)
+  Binding* binding;
+  for (binding = *aliasBucket(alias); binding != NULL; binding = binding->next)
+    if (strcmp(binding->alias, alias) == 0)
+      return binding->cmd;
+  return NULL;
+}
+
+
+//////////////////////////////////////////////////////////////
+//  Shell Variables
+//////////////////////////////////////////////////////////////
+
+typedef struct var_l {
+  char* name;
+  char* value;
+  bool mapped;  /* the strings live in the state snapshot and are not freed */
+  struct var_l* next;
+} varL;
+
+#define VAR_BUCKETS 256
+static varL* vars[VAR_BUCKETS] = { };
+
+static varL** varBucket(char* name)
+{
+  unsigned long h = 5381;
+  while (*name != '\0')
+    h = h * 33 + (unsigned char)*name++;
+  return &vars[h % VAR_BUCKETS];
+}
+
+//Removes a shell variable
+static void UnsetVar(char* name)
+{
+  varL **link = varBucket(name);
+  varL *var;
+
+  while ((var = *link) != NULL)
   {
-    if( strcmp(bindingsArray[j]-> alias , alias ) == 0)
-      return bindingsArray[j]-> cmd;
+    if (strcmp(var->name, name) == 0)
+    {
+      *link = var->next;
+      if (!var->mapped)
+      {
+        free(var->name);
+        free(var->value);
+      }
+      free(var);
+      return;
+    }
+    link = &var->next;
+  }
+}
+
+void DefineVar(char* name, char* value, bool mapped)
+{
+  varL **bucket = varBucket(name);
+  varL *var;
+
+  UnsetVar(name);
+  var = malloc(sizeof(varL));
+  var->name = name;
+  var->value = value;
+  var->mapped = mapped;
+  var->next = *bucket;
+  *bucket = var;
+}
 
-    j++;
+void SetVar(char* name, char* value)
+{
+  varL *var;
+
+  //loops set the same variable over and over, reuse its entry
+  for (var = *varBucket(name); var != NULL; var = var->next)
+  {
+    if (strcmp(var->name, name) == 0 && !var->mapped)
+    {
+      free(var->value);
+      var->value = strdup(value);
+      return;
+    }
   }
-  return NULL;
+  DefineVar(strdup(name), strdup(value), FALSE);
+}
+
+char* GetVar(char* name)
+{
+  varL *var;
+  for (var = *varBucket(name); var != NULL; var = var->next)
+    if (strcmp(var->name, name) == 0)
+      return var->value;
+  return getenv(name);
+}
+
+void ForEachVar(void (*fn)(char*, char*, void*), void* arg)
+{
+  varL* var;
+  int j;
+  for (j = 0; j < VAR_BUCKETS; j++)
+    for (var = vars[j]; var != NULL; var = var->next)
+      fn(var->name, var->value, arg);
 }
 
 
@@ -716,47 +2746,153 @@ static void sigchld_handler()
   //Initialize variables
   pid_t childPid;
   int status = 0;
-  //Check the status of all jobs and clean up jobs that are finished (waitpid does the cleaning)
-   while ((childPid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0)
+  struct rusage usage;
+  //Check the status of all jobs and clean up jobs that are finished (wait4 does the cleaning)
+  //A subshell stops along with what it runs, its children stay its foreground job meanwhile
+  while ((childPid = wait4(-1, &status, WNOHANG | (gSubshell ? 0 : WUNTRACED), &usage)) > 0)
+    updateJobs(childPid, status, &usage);
+  //Children of the spawn server are reported through its socket instead, read
+  //outside the handler since a message may have to be waited for
+  if (SpawnActive())
+    gSpawnReady = 1;
+  publishJobs();
+}
+
+//Collect what the spawn server reported since sigchld_handler last ran, with SIGCHLD blocked
+static void reapSpawned()
+{
+  if (!gSpawnReady)
+    return;
+  gSpawnReady = 0;
+  SpawnReap();
+  publishJobs();
+}
+
+// Update the job lists for a child that exited or stopped
+static void handleChildStatus(pid_t childPid, int status)
+{
+  updateJobs(childPid, status, NULL);
+}
+
+// Update the job lists, children reaped by the spawn server come without their usage
+static void updateJobs(pid_t childPid, int status, struct rusage* usage)
+{
+  long long doneAt = nowNs();
+  //If the job has 
+  //finished normally, finished due to being signaled, or stopped due to being signaled...
+  if (WIFEXITED(status) || WIFSIGNALED(status) || WIFSTOPPED(status) )
   {
-    //If the job has 
-    //finished normally, finished due to being signaled, or stopped due to being signaled...
-    if (WIFEXITED(status) || WIFSIGNALED(status) || WIFSTOPPED(status) )
+    //If the job is a foreground job
+    if(fgJob != NULL && fgJob->pid == childPid)
     {
-      //If the job is a foreground job
-      if(fgJob != NULL && fgJob->pid == childPid)
+      PROBE3(reap, childPid, status, 0);
+      //A stopped job becomes a background job, whoever stopped it
+      if (WIFSTOPPED(status))
       {
-        //Set waiting to false to escape loop in waitFg()
-        waiting = FALSE;
-        //Free the bgJobL object associated with foreground processes
-        if(fgJob != NULL) releaseBgJobL(&fgJob);
+        //The record moves to the list as it is, with its command and resource envelope
+        fgJob->status = "Stopped";
+        linkBgJob(fgJob);
+        fgJob = NULL;
+        gStoppedFg = childPid;
       }
-      //If the job is a background job
+      //Remember how it ended
+      lastExitStatus = exitStatusOf(status);
+      gFgDoneAt = doneAt;
+      if (usage != NULL)
+        gFgUsage = *usage;
       else
+        memset(&gFgUsage, 0, sizeof(gFgUsage));
+      //Set waiting to false to escape loop in waitFg()
+      waiting = FALSE;
+      //Hand the bgJobL object of a finished job to waitFg() to free
+      if (fgJob != NULL)
+        gFgDone = fgJob;
+      fgJob = NULL;
+    }
+    //A background job that was stopped can be continued with bg or fg
+    else if (WIFSTOPPED(status))
+    {
+      changeBgJobStatus(childPid, "Stopped\0");
+    }
+    //If the job is a background job
+    else
+    {
+      //Change job's status to done
+      changeBgJobStatus(childPid, "Done\0");
+      bgJobL* job = findBgJobPid(childPid);
+      if (job != NULL)
       {
-        //Change job's status to done
-        changeBgJobStatus(childPid, "Done\0");
+        PROBE3(reap, childPid, status, job->jobNumber);
+        job->exitStatus = exitStatusOf(status);
+        job->doneAt = doneAt;
+        //The slot is free as soon as the job is, not when it is reported
+        JobserverRelease(job->token);
+        job->token = -1;
+        if (usage != NULL)
+          job->usage = *usage;
       }
     }
   }
 }
 
+//Shell exit status for a wait status, signals are reported as 128 + the signal number
+static int exitStatusOf(int status)
+{
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  else if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  else
+    return 128 + WSTOPSIG(status);
+}
+
 //ctrl-z signal handler (stops a foreground process if any)
 void stopFgProc()
 {
   //If there is a foreground process...
   if (fgJob != NULL)
   {
-    //Add it to the background job list
-    AddBgJobToList(fgJob->pid, fgJob->command);
-    //Change it's status in the job list to "stopped"
-    changeBgJobStatus(fgJob->pid, "Stopped\0");
-    //Notify user that the job has been stopped
-    printBgJob(fgJob->pid);
-    //Stop it and all of its children
+    //Stop it and all of its children, handleChildStatus() moves it to the job list
     kill(-(fgJob->pid), SIGSTOP);
   } 
+  gInterrupt = SIGTSTP;
+}
+//Install a handler that restarts system calls and keeps the other job signals out while it runs
+bool InstallHandler(int signo, void (*handler)(int))
+{
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaddset(&sa.sa_mask, SIGCHLD);
+  sigaddset(&sa.sa_mask, SIGINT);
+  sigaddset(&sa.sa_mask, SIGTSTP);
+  return sigaction(signo, &sa, NULL) == 0;
+}
+
+//Take the terminal when the shell runs interactively
+void InitJobControl()
+{
+  pid_t pgid;
+
+  if (!isatty(STDIN_FILENO))
+    return;
+  //Started in the background, wait until we are brought to the foreground
+  while (tcgetpgrp(STDIN_FILENO) != (pgid = getpgrp()))
+    kill(-pgid, SIGTTIN);
+  //Handing the terminal around must not stop the shell
+  signal(SIGTTOU, SIG_IGN);
+  signal(SIGTTIN, SIG_IGN);
+  //Fails harmlessly when the shell already leads a group or a session
+  setpgid(0, 0);
+  gShellPgid = getpgrp();
+  if (tcsetpgrp(STDIN_FILENO, gShellPgid) == -1 || tcgetattr(STDIN_FILENO, &gShellModes) == -1)
+    return;
+  gTerminal = STDIN_FILENO;
 }
+
 //ctrl-c signal handler (kills a foreground process if any)
 void killFgProc()
 {
@@ -766,6 +2902,55 @@ void killFgProc()
     //Kill it and all of its children
     kill(-(fgJob->pid), SIGINT);
   } 
+  gInterrupt = SIGINT;
+  //A background launch waiting for a jobserver slot gives up
+  JobserverCancel();
+}
+
+//////////////////////////////////////////////////////////////
+//  Spawn Server
+//////////////////////////////////////////////////////////////
+
+//Put a process started outside of Exec() into the job table
+void AddJob(pid_t pid, char* command)
+{
+  AddBgJobToList(pid, command);
+  publishJobs();
+}
+
+//Take a process started outside of Exec() out of the job table
+void RemoveJob(pid_t pid)
+{
+  RemoveBgJobFromList(pid);
+  publishJobs();
+}
+
+//Start the spawn server, children it launches are reaped like our own
+bool StartSpawnServer()
+{
+  InstallHandler(SIGCHLD, sigchld_handler);
+  return SpawnStart(handleChildStatus);
+}
+
+//Launch a command through the spawn server, the redirections are opened here and passed along
+static pid_t SpawnCmd(commandT* cmd, char* cgroup, char* cpus)
+{
+  int fds[3] = { 0, 1, 2 };
+  pid_t pid;
+
+  if(cmd->redirect_in != NULL)
+    fds[0] = OpenRedirect(cmd->redirect_in, O_RDONLY);
+  if(cmd->redirect_out != NULL)
+    fds[1] = OpenRedirect(cmd->redirect_out, O_WRONLY | O_TRUNC | O_CREAT);
+  //Like dup2 in RedirIn/RedirOut, a file that cannot be opened leaves the descriptor alone
+  if(fds[0] == -1) fds[0] = 0;
+  if(fds[1] == -1) fds[1] = 1;
+
+  pid = SpawnExec(cmd->name, cmd->argv, fds, cgroup, cpus, cmd->bg == 1);
+
+  if(fds[0] != 0) close(fds[0]);
+  if(fds[1] != 1) close(fds[1]);
+  return pid;
 }
 
 //////////////////////////////////////////////////////////////
@@ -774,18 +2959,36 @@ void killFgProc()
 
 static void RedirOut(commandT* cmd, char* file)
 {
-    int out = open(file, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR);
+    int out = OpenRedirect(file, O_WRONLY | O_TRUNC | O_CREAT);
     dup2(out, 1);
     close(out);
 }
 
 static void RedirIn(commandT* cmd, char* file)
 {
-    int in = open(file, O_RDONLY);
+    int in = OpenRedirect(file, O_RDONLY);
     dup2(in, 0);
     close(in);
 }
 
+int OpenRedirect(char* target, int flags)
+{
+  char* end;
+  long fd;
+
+  //&N is a descriptor the shell has open, the pipe of a coprocess for one
+  if (target[0] == '&')
+  {
+    fd = strtol(target + 1, &end, 10);
+    if (target[1] >= '0' && target[1] <= '9' && *end == '\0')
+      return fcntl(fd, (flags & O_CLOEXEC) ? F_DUPFD_CLOEXEC : F_DUPFD, 0);
+    //Anything else after & is no file to create
+    errno = EINVAL;
+    return -1;
+  }
+  return open(target, flags, S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR);
+}
+
 
 //////////////////////////////////////////////////////////////
 //  Support Functions
@@ -798,14 +3001,20 @@ void CheckJobs()
   bgJobL *job = bgJobsHead; //This is the leading pointer
   bgJobL *prevJob = NULL; //This is the trailing pointer (one node behind leading)
   bgJobL *jobToDel = NULL; //Job pointer for deletion
+  sigset_t x, old;
+
+  //sigchld_handler must not see the list half changed
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &x, &old);
+  reapSpawned();
   //While we aren't at the end of the list (and the list still has nodes)
   while (job != NULL)
   {
     if (strncmp(job->status, "Done\0", 5) == 0)
     {
       //Print notification that the job was completed
-      fprintf(stdout, "[%d]   %s                    %s\n",job->jobNumber, job->status, job->command);
-      fflush(stdout);
+      OutPrintf("[%d]   %s                    %s\n",job->jobNumber, job->status, job->command);
       
       //If the job to be deleted is the tail of the linked list...
         if (job == bgJobsTail)
@@ -836,24 +3045,87 @@ void CheckJobs()
       job = job->next;
     }
   }
+  publishJobs();
+  sigprocmask(SIG_SETMASK, &old, NULL);
 }
 
 //Kills all background processes if any before exiting
 void cleanExit()
 {
   //Initialize variables
-  bgJobL *bgJob = bgJobsHead;
+  bgJobL *bgJob;
   bgJobL *jobToDel = NULL;
+  coprocL *co;
+  sigset_t x;
+
+  //Jobs that end now are not looked up any more
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &x, NULL);
+  //A coprocess is told with the end of its input instead
+  for (co = gCoprocs; co != NULL; co = co->next)
+  {
+    if (co->fds[0] != -1)
+      close(co->fds[0]);
+    if (co->fds[1] != -1)
+      close(co->fds[1]);
+    co->fds[0] = co->fds[1] = -1;
+  }
+  bgJob = bgJobsHead;
   //Iterate through linked list, kill every background job, and free every node
   while (bgJob != NULL)
   {
-    kill(-(bgJob->pid), SIGINT);
+    for (co = gCoprocs; co != NULL && co->pid != bgJob->pid; co = co->next);
+    if (co == NULL)
+      kill(-(bgJob->pid), SIGINT);
+    bgJob = bgJob->next;
+  }
+  //The cgroups of the jobs can only be removed once they are empty
+  drainCgroups();
+  bgJob = bgJobsHead;
+  while (bgJob != NULL)
+  {
     jobToDel = bgJob;
     bgJob = bgJob->next;
     releaseBgJobL(&jobToDel);
   }
   bgJobsHead = NULL;
   bgJobsTail = NULL;
+  CgroupRelease();
+  JobserverStop();
+  JobShmClose();
+  OutFlush();
+}
+
+//Wait for the jobs in cgroups to end after SIGINT, and kill what outlives the grace period
+static void drainCgroups()
+{
+  long long deadline = nowNs() + CGROUP_GRACE_NS;
+  bool killed = FALSE, busy;
+  bgJobL* job;
+
+  for (;;)
+  {
+    //SIGCHLD is blocked, the jobs are reaped here
+    while (waitpid(-1, NULL, WNOHANG) > 0);
+    busy = FALSE;
+    for (job = bgJobsHead; job != NULL; job = job->next)
+      if (job->cgroup != NULL && CgroupPopulated(job->cgroup))
+        busy = TRUE;
+    if (!busy)
+      return;
+    if (nowNs() > deadline)
+    {
+      if (killed)
+        return;
+      for (job = bgJobsHead; job != NULL; job = job->next)
+        if (job->cgroup != NULL && CgroupPopulated(job->cgroup))
+          CgroupKill(job->cgroup);
+      killed = TRUE;
+      deadline = nowNs() + CGROUP_GRACE_NS;
+    }
+    usleep(10000);
+  }
 }
 
 //////////////////////////////////////////////////////////////
@@ -874,13 +3146,11 @@ static void printBgJob(pid_t jobPid)
       //If the process is stopeed...
       if (strncmp(bgJob->status, "Stopped\0", 8) == 0)
         //Print inforamatino without an "&" symbol
-        fprintf(stdout, "[%d]   %s                 %s\n", bgJob->jobNumber,bgJob->status, bgJob->command);
+        OutPrintf("[%d]   %s                 %s\n", bgJob->jobNumber,bgJob->status, bgJob->command);
       //If the process is running...
       else if (strncmp(bgJob->status, "Running\0", 8) == 0)
         //Print inforamatino with an "&" symbol
-        fprintf(stdout, "[%d]   %s                 %s &\n", bgJob->jobNumber,bgJob->status, bgJob->command);
-      //Print the thing immediately
-      fflush(stdout);
+        OutPrintf("[%d]   %s                 %s &\n", bgJob->jobNumber,bgJob->status, bgJob->command);
       //Exit the loop
       break;
     }
@@ -892,6 +3162,7 @@ static void printBgJob(pid_t jobPid)
 //Add new background job to the end of the background jobs list (bgJobsTail)
 static void AddBgJobToList(pid_t jobId, char* command)
 {
+  sigset_t x, old;
   //Allocate memory for the new background job
   bgJobL *newJob = createBgJobL();
 
@@ -900,7 +3171,18 @@ static void AddBgJobToList(pid_t jobId, char* command)
   //Fill command text for new background job
   newJob->command = strdup(command);
   //Fill status text for new background job
-  newJob->status = strdup("Running\0");
+  newJob->status = "Running";
+  //sigchld_handler links stopped foreground jobs in as well
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &x, &old);
+  linkBgJob(newJob);
+  sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+//Put a job at the end of the list, allocates nothing so that sigchld_handler can use it
+static void linkBgJob(bgJobL* newJob)
+{
   //Fill in the job number for the new background job
   if (bgJobsTail !=  NULL)
     //Job number = one more than the last job number
@@ -920,6 +3202,7 @@ static void AddBgJobToList(pid_t jobId, char* command)
 
   //Make the new job the tail of the background jobs list
   bgJobsTail = newJob;
+  PROBE3(job__state, newJob->pid, newJob->jobNumber, newJob->status);
 
 }
 
@@ -929,7 +3212,12 @@ static void RemoveBgJobFromList(pid_t jobId)
   //Initialize variables to iterate through the list of background jobs
   bgJobL *job = bgJobsHead; //This is the leading pointer
   bgJobL *prevJob = NULL; //This is the trailing pointer (one node behind leading)
+  sigset_t x, old;
 
+  //sigchld_handler must not see the list half changed
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &x, &old);
   //Iterate through the job list until you reach the end or until the job to be deleted is found
   while (job != NULL)
     {
@@ -965,6 +3253,7 @@ static void RemoveBgJobFromList(pid_t jobId)
       }
     }
     //If the node to be deleted isn't found, do nothing
+  sigprocmask(SIG_SETMASK, &old, NULL);
 }
 
 
@@ -980,12 +3269,38 @@ commandT* CreateCmdT(int n)
   cd -> cmdline = NULL;
   cd -> is_redirect_in = cd -> is_redirect_out = 0;
   cd -> redirect_in = cd -> redirect_out = NULL;
+  cd -> redirect_tee = NULL;
+  cd -> limits = NULL;
+  cd -> bg = 0;
   cd -> argc = n;
   for(i = 0; i <=n; i++)
     cd -> argv[i] = NULL;
   return cd;
 }
 
+/*Create a command out of argv[first..] of another command, keeping its redirections*/
+static commandT* ShiftCmdT(commandT* cmd, int first)
+{
+  int i;
+  commandT* sub = CreateCmdT(cmd->argc - first);
+  for(i = first; i < cmd->argc; i++)
+    sub -> argv[i - first] = strdup(cmd->argv[i]);
+  sub -> bg = cmd->bg;
+  sub -> cmdline = strdup(cmd->cmdline);
+  sub -> is_redirect_in = cmd->is_redirect_in;
+  sub -> is_redirect_out = cmd->is_redirect_out;
+  if(cmd->redirect_in != NULL) sub -> redirect_in = strdup(cmd->redirect_in);
+  if(cmd->redirect_out != NULL) sub -> redirect_out = strdup(cmd->redirect_out);
+  if(cmd->redirect_tee != NULL){
+    for(i = 0; cmd->redirect_tee[i] != NULL; i++);
+    sub -> redirect_tee = malloc(sizeof(char*) * (i + 1));
+    for(i = 0; cmd->redirect_tee[i] != NULL; i++)
+      sub -> redirect_tee[i] = strdup(cmd->redirect_tee[i]);
+    sub -> redirect_tee[i] = NULL;
+  }
+  return sub;
+}
+
 /*Release and collect the space of a commandT struct*/
 void ReleaseCmdT(commandT **cmd){
   int i;
@@ -993,6 +3308,12 @@ void ReleaseCmdT(commandT **cmd){
   if((*cmd)->cmdline != NULL) free((*cmd)->cmdline);
   if((*cmd)->redirect_in != NULL) free((*cmd)->redirect_in);
   if((*cmd)->redirect_out != NULL) free((*cmd)->redirect_out);
+  if((*cmd)->redirect_tee != NULL){
+    for(i = 0; (*cmd)->redirect_tee[i] != NULL; i++)
+      free((*cmd)->redirect_tee[i]);
+    free((*cmd)->redirect_tee);
+  }
+  if((*cmd)->limits != NULL) ReleaseLimits(&(*cmd)->limits);
   for(i = 0; i < (*cmd)->argc; i++)
     if((*cmd)->argv[i] != NULL) free((*cmd)->argv[i]);
   free(*cmd);
@@ -1002,12 +3323,42 @@ void ReleaseCmdT(commandT **cmd){
 //  bgJobL Functions
 //////////////////////////////////////////////////////////////
 
+//Publish the foreground job and the job list, sigchld_handler calls it too
+static void publishJobs()
+{
+  bgJobL* job;
+  sigset_t x, old;
+
+  //An update must not be interrupted by the one of sigchld_handler
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &x, &old);
+  if (JobShmBegin())
+  {
+    if (fgJob != NULL)
+      JobShmPut(fgJob->pid, 0, "Running", fgJob->command, fgJob->startedAt, 0, 0, NULL);
+    for (job = bgJobsHead; job != NULL; job = job->next)
+      if (job->status != NULL)
+        JobShmPut(job->pid, job->jobNumber, job->status, job->command, job->startedAt,
+                  job->doneAt, job->exitStatus, job->status[0] == 'D' ? &job->usage : NULL);
+    JobShmEnd();
+  }
+  sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
 //Create a new bgJobL struct
 static bgJobL* createBgJobL()
 {
   bgJobL *newJob = malloc(sizeof(bgJobL));
   newJob->command = NULL;
   newJob->status = NULL;
+  newJob->cgroup = NULL;
+  newJob->node = -1;
+  newJob->exitStatus = 0;
+  memset(&newJob->usage, 0, sizeof(newJob->usage));
+  newJob->startedAt = nowNs();
+  newJob->doneAt = 0;
+  newJob->token = -1;
   newJob->next = NULL;
   return newJob;
 }
@@ -1015,11 +3366,64 @@ static bgJobL* createBgJobL()
 static void releaseBgJobL(bgJobL **jobToDelete)
 {
   if((*jobToDelete)->command != NULL) free((*jobToDelete)->command);
-  if((*jobToDelete)->status != NULL) free((*jobToDelete)->status);
+  if((*jobToDelete)->cgroup != NULL)
+  {
+    CgroupRemove((*jobToDelete)->cgroup);
+    free((*jobToDelete)->cgroup);
+  }
+  AffinityRelease((*jobToDelete)->node);
+  JobserverRelease((*jobToDelete)->token);
   free(*jobToDelete);
   *jobToDelete = NULL;
 }
 
+//Find a background job by its job number
+static bgJobL* findBgJob(int jobNumber)
+{
+  bgJobL *bgJob = bgJobsHead;
+  while (bgJob != NULL && bgJob->jobNumber != jobNumber)
+    bgJob = bgJob->next;
+  return bgJob;
+}
+
+//Find a background job by its process ID
+static bgJobL* findBgJobPid(pid_t pid)
+{
+  bgJobL *bgJob = bgJobsHead;
+  while (bgJob != NULL && bgJob->pid != pid)
+    bgJob = bgJob->next;
+  return bgJob;
+}
+
+//Wait until one of the given jobs is Done, returns its index (negated pids count as well)
+static int waitJobs(pid_t* pids, int n, bgJobL** done)
+{
+  sigset_t x, old;
+  bgJobL* job;
+  int i;
+
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &x, &old);
+  for (;;)
+  {
+    reapSpawned();
+    for (i = 0; i < n; i++)
+    {
+      job = findBgJobPid(abs(pids[i]));
+      //A job that is no longer listed is done as well
+      if (job == NULL || strcmp(job->status, "Done") == 0)
+      {
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        *done = job;
+        return i;
+      }
+    }
+    //sigchld_handler marks the jobs Done, sleep until it runs
+    sigsuspend(&old);
+  }
+}
+
 //Change the status of an existing job
 static void changeBgJobStatus(pid_t jobId, char* status)
 {
@@ -1031,9 +3435,8 @@ static void changeBgJobStatus(pid_t jobId, char* status)
     //If the current background job matches the provided process ID...
     if (bgJob->pid == jobId)
     {
-      //Remove the current status
-      if((bgJob)->status != NULL) free((bgJob)->status);
-      bgJob->status = strdup(status);
+      bgJob->status = status;
+      PROBE3(job__state, jobId, bgJob->jobNumber, bgJob->status);
       //Exit the loop
       break;
     }
@@ -58,8 +58,10 @@ typedef struct command_t
   char* name;
   char *cmdline;
   char *redirect_in, *redirect_out;
+  char **redirect_tee; /* the > targets after the first, NULL terminated, or NULL */
   int is_redirect_in, is_redirect_out;
   int bg;
+  struct limit_t *limits;
   int argc;
   char* argv[];
 } commandT;
@@ -73,12 +75,21 @@ typedef struct command_t
  ***********************************************************************/
 VAREXTERN(bool forceExit, FALSE);
 
+/***********************************************************************
+ *  Title: Exit status of the last command
+ * ---------------------------------------------------------------------
+ *    Purpose: Exit status of the last foreground job (128 + signal
+ *    number if it was killed or stopped), 127 if the command was not
+ *    found and 0/1 for builtins
+ ***********************************************************************/
+VAREXTERN(int lastExitStatus, 0);
+
 /************Function Prototypes******************************************/
 
 /***********************************************************************
  *  Title: Runs a command 
  * ---------------------------------------------------------------------
- *    Purpose: Runs a command.
+ *    Purpose: Runs a command. The commands stay owned by the caller.
  *    Input: a command structure
  *    Output: void
  ***********************************************************************/
@@ -93,10 +104,132 @@ EXTERN void RunCmd(commandT**,int);
  ***********************************************************************/
 EXTERN void RunCmdBg(commandT*);
 
+/***********************************************************************
+ *  Title: Runs the last command of a list
+ * ---------------------------------------------------------------------
+ *    Purpose: Runs a command like RunCmd(). In a subshell an external
+ *    command replaces the subshell instead of running in a child of it,
+ *    nothing may come after it.
+ *    Input: a command structure
+ *    Output: void
+ ***********************************************************************/
+EXTERN void RunLastCmd(commandT*);
+
+/***********************************************************************
+ *  Title: Runs a subshell
+ * ---------------------------------------------------------------------
+ *    Purpose: Starts a child that is a copy of the shell as a job and
+ *    calls the body there; the child exits with lastExitStatus. The
+ *    redirections and & of the command apply to the whole child, the
+ *    command line is what the job table shows.
+ *    Input: the command, the body and its argument
+ *    Output: void
+ ***********************************************************************/
+EXTERN void RunSubshell(commandT*, void (*)(void*), void*);
+
 EXTERN bool IsAlias(char*);
 
 EXTERN char* GetAliasCmd(char *);
 
+/***********************************************************************
+ *  Title: Fingerprint of the alias table
+ * ---------------------------------------------------------------------
+ *    Purpose: Hashes all alias definitions so that cached parses can
+ *    tell whether the aliases changed since they were made
+ *    Input: void
+ *    Output: the hash, 0 if there are no aliases
+ ***********************************************************************/
+EXTERN unsigned long AliasFingerprint();
+
+/***********************************************************************
+ *  Title: Define an alias
+ * ---------------------------------------------------------------------
+ *    Purpose: Binds an alias to a command, replacing an earlier binding
+ *    of the same name. The table takes over both strings unless they
+ *    are mapped from the state snapshot.
+ *    Input: the alias, the command and whether the strings are mapped
+ *    Output: void
+ ***********************************************************************/
+EXTERN void DefineAlias(char*, char*, bool);
+
+/***********************************************************************
+ *  Title: Walk the alias table
+ * ---------------------------------------------------------------------
+ *    Purpose: Calls a function with every alias and its command
+ *    Input: the function and an argument passed through to it
+ *    Output: void
+ ***********************************************************************/
+EXTERN void ForEachAlias(void (*)(char*, char*, void*), void*);
+
+/***********************************************************************
+ *  Title: Open a redirection
+ * ---------------------------------------------------------------------
+ *    Purpose: Opens the file of a < or > redirection. A target of &N
+ *    is a duplicate of descriptor N instead, so that >&${NAME[1]}
+ *    writes to a coprocess.
+ *    Input: the target and the flags for open()
+ *    Output: the descriptor, -1 with errno set if it failed
+ ***********************************************************************/
+EXTERN int OpenRedirect(char*, int);
+
+/***********************************************************************
+ *  Title: Set a shell variable
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets a shell variable to a copy of a value
+ *    Input: the name and the value
+ *    Output: void
+ ***********************************************************************/
+EXTERN void SetVar(char*, char*);
+
+/***********************************************************************
+ *  Title: Define a shell variable
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets a shell variable, taking over both strings unless
+ *    they are mapped from the state snapshot
+ *    Input: the name, the value and whether the strings are mapped
+ *    Output: void
+ ***********************************************************************/
+EXTERN void DefineVar(char*, char*, bool);
+
+/***********************************************************************
+ *  Title: Get a shell variable
+ * ---------------------------------------------------------------------
+ *    Purpose: Looks up a shell variable, then the environment
+ *    Input: the name
+ *    Output: the value, NULL if it is not set
+ ***********************************************************************/
+EXTERN char* GetVar(char*);
+
+/***********************************************************************
+ *  Title: Walk the shell variables
+ * ---------------------------------------------------------------------
+ *    Purpose: Calls a function with every shell variable and its value
+ *    Input: the function and an argument passed through to it
+ *    Output: void
+ ***********************************************************************/
+EXTERN void ForEachVar(void (*)(char*, char*, void*), void*);
+
+/***********************************************************************
+ *  Title: Remember where a command was found
+ * ---------------------------------------------------------------------
+ *    Purpose: Adds a command to the PATH cache. Entries hold for the
+ *    current value of PATH and are checked again when they are used.
+ *    The cache takes over both strings unless they are mapped from
+ *    the state snapshot.
+ *    Input: the command name, its full path and whether they are mapped
+ *    Output: void
+ ***********************************************************************/
+EXTERN void RememberPath(char*, char*, bool);
+
+/***********************************************************************
+ *  Title: Walk the PATH cache
+ * ---------------------------------------------------------------------
+ *    Purpose: Calls a function with every cached command and its path
+ *    Input: the function and an argument passed through to it
+ *    Output: void
+ ***********************************************************************/
+EXTERN void ForEachPath(void (*)(char*, char*, void*), void*);
+
 /***********************************************************************
  *  Title: Runs two command with a pipe
  * ---------------------------------------------------------------------
@@ -124,6 +257,31 @@ EXTERN void RunCmdRedirOut(commandT*, char*);
  ***********************************************************************/
 EXTERN void RunCmdRedirIn(commandT*, char*);
 
+/***********************************************************************
+ *  Title: Install a signal handler
+ * ---------------------------------------------------------------------
+ *    Purpose: Installs a handler with sigaction. Interrupted system
+ *    calls are restarted and SIGCHLD, SIGINT and SIGTSTP are blocked
+ *    while it runs, so handlers never interrupt each other halfway
+ *    through a change to the job list.
+ *    Input: the signal and the handler
+ *    Output: true on success
+ ***********************************************************************/
+EXTERN bool InstallHandler(int, void (*)(int));
+
+/***********************************************************************
+ *  Title: Set up job control
+ * ---------------------------------------------------------------------
+ *    Purpose: When standard input is a terminal, waits until the
+ *    shell is in the foreground, puts it in its own process group and
+ *    takes the terminal. From then on every foreground job gets the
+ *    terminal with tcsetpgrp, so keyboard signals go from the kernel
+ *    straight to the job, and the shell takes it back afterwards.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void InitJobControl();
+
 /***********************************************************************
  *  Title: Stop the foreground process
  * ---------------------------------------------------------------------
@@ -142,6 +300,35 @@ EXTERN void stopFgProc();
  ***********************************************************************/
 EXTERN void killFgProc();
 
+/***********************************************************************
+ *  Title: Add a job to the job table
+ * ---------------------------------------------------------------------
+ *    Purpose: Lists a process that was not started by Exec() (e.g. a
+ *    command server worker) as a running job.
+ *    Input: the pid and the command line
+ *    Output: void
+ ***********************************************************************/
+EXTERN void AddJob(pid_t, char*);
+
+/***********************************************************************
+ *  Title: Remove a job from the job table
+ * ---------------------------------------------------------------------
+ *    Purpose: Removes a job added with AddJob without reporting it.
+ *    Input: the pid
+ *    Output: void
+ ***********************************************************************/
+EXTERN void RemoveJob(pid_t);
+
+/***********************************************************************
+ *  Title: Start the spawn server
+ * ---------------------------------------------------------------------
+ *    Purpose: Forks a helper that launches all later jobs, so launch
+ *    cost stays the same however large the shell grows.
+ *    Input: void
+ *    Output: true if the helper is running
+ ***********************************************************************/
+EXTERN bool StartSpawnServer();
+
 /***********************************************************************
  *  Title: Clean up memory usage and processes before exiting
  * ---------------------------------------------------------------------
@@ -0,0 +1,452 @@
+/***************************************************************************
+ *  Title: Script files
+ * -------------------------------------------------------------------------
+ *    Purpose: Runs script files through an on-disk cache of parsed lines
+ *    File: script.c
+ ***************************************************************************/
+#define __SCRIPT_IMPL__
+
+/************System include***********************************************/
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "script.h"
+#include "interpreter.h"
+#include "io.h"
+#include "runtime.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define SCRIPT_PATHLEN 1024
+
+/* record kinds */
+#define REC_CMDS 1   /* parsed commands, run with RunCmd() */
+#define REC_LINE 2   /* raw line, needs Interpret() at run time */
+#define REC_EXIT 3   /* the "exit" line */
+
+/* command flags */
+#define CMD_IN  1
+#define CMD_OUT 2
+
+/*
+ * A cache file is the header followed by one record per non-empty line:
+ *   REC_CMDS: kind, n, then n times argc, bg, flags, cmdline,
+ *             [redirect_in], [redirect_out], argv[0..argc-1]
+ *   REC_LINE: kind, the line
+ *   REC_EXIT: kind
+ * Numbers are 32 bit words, strings are a length word followed by the
+ * bytes and a '\0', padded to a word.
+ */
+typedef struct script_hdr_t
+{
+  char magic[4];       /* "TSHC" */
+  uint32_t version;    /* SCRIPT_CACHE_VERSION */
+  uint64_t mtimeSec;   /* mtime of the script the cache was made from */
+  uint64_t mtimeNsec;
+  uint64_t size;       /* size of the script */
+  uint64_t hash;       /* FNV-1a hash of the script */
+  uint64_t aliases;    /* AliasFingerprint() when the script was parsed */
+  uint32_t records;    /* number of records */
+  uint32_t pad;
+} scriptHdrT;
+
+/* growable buffer the records are written to */
+typedef struct script_buf_t
+{
+  char* data;
+  size_t len, size;
+} scriptBufT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+static uint64_t hash(const char*, size_t, uint64_t);
+static bool cachePath(char*, char*, size_t);
+static void put(scriptBufT*, const void*, size_t);
+static void putWord(scriptBufT*, uint32_t);
+static void putString(scriptBufT*, const char*);
+static uint32_t compile(char*, size_t, scriptBufT*);
+static void saveCache(char*, scriptHdrT*, scriptBufT*);
+static char* loadCache(char*, scriptHdrT*, char*, size_t*);
+static char* getString(char**);
+static void run(char*, uint32_t);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+int RunScript(char* path)
+{
+  int fd;
+  struct stat st;
+  char* src = NULL;
+  char* map = NULL;
+  size_t mapLen = 0;
+  char cache[SCRIPT_PATHLEN];
+  bool haveCache;
+  scriptHdrT hdr;
+  scriptBufT buf = { NULL, 0, 0 };
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) == -1)
+  {
+    PrintPError(path);
+    return 127;
+  }
+  if (st.st_size > 0)
+  {
+    src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (src == MAP_FAILED)
+    {
+      PrintPError(path);
+      close(fd);
+      return 127;
+    }
+  }
+  close(fd);
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, "TSHC", 4);
+  hdr.version = SCRIPT_CACHE_VERSION;
+  hdr.mtimeSec = st.st_mtim.tv_sec;
+  hdr.mtimeNsec = st.st_mtim.tv_nsec;
+  hdr.size = st.st_size;
+  hdr.aliases = AliasFingerprint();
+
+  haveCache = cachePath(path, cache, sizeof(cache));
+  if (haveCache)
+    map = loadCache(cache, &hdr, src, &mapLen);
+
+  if (map != NULL)
+    run(map + sizeof(scriptHdrT), hdr.records);
+  else
+  {
+    hdr.hash = hash(src, st.st_size, 14695981039346656037UL);
+    hdr.records = compile(src, st.st_size, &buf);
+    if (haveCache)
+      saveCache(cache, &hdr, &buf);
+    run(buf.data, hdr.records);
+    free(buf.data);
+  }
+
+  if (map != NULL)
+    munmap(map, mapLen);
+  if (src != NULL)
+    munmap(src, st.st_size);
+  return lastExitStatus;
+}
+
+/*FNV-1a over a block of memory*/
+static uint64_t hash(const char* data, size_t len, uint64_t h)
+{
+  size_t i;
+  for (i = 0; i < len; i++)
+    h = (h ^ (unsigned char)data[i]) * 1099511628211UL;
+  return h;
+}
+
+bool CacheDir(char* dir, size_t size)
+{
+  char* env;
+
+  if ((env = getenv("TSH_CACHE_DIR")) != NULL)
+  {
+    if (env[0] == '\0')
+      return FALSE;
+    snprintf(dir, size, "%s", env);
+  }
+  else if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0] != '\0')
+    snprintf(dir, size, "%s/tsh", env);
+  else if ((env = getenv("HOME")) != NULL)
+  {
+    snprintf(dir, size, "%s/.cache", env);
+    mkdir(dir, 0700);
+    snprintf(dir, size, "%s/.cache/tsh", env);
+  }
+  else
+    return FALSE;
+  return mkdir(dir, 0700) == 0 || access(dir, W_OK) == 0;
+}
+
+/*Build the name of the cache file of a script*/
+static bool cachePath(char* path, char* buf, size_t size)
+{
+  char dir[SCRIPT_PATHLEN];
+  char* real;
+  uint64_t key;
+
+  if (!CacheDir(dir, sizeof(dir)))
+    return FALSE;
+
+  /* the same script reached through different paths shares its entry */
+  real = realpath(path, NULL);
+  key = hash(real != NULL ? real : path, strlen(real != NULL ? real : path), 14695981039346656037UL);
+  free(real);
+  return snprintf(buf, size, "%s/%016llx.tshc", dir, (unsigned long long)key) < size;
+}
+
+static void put(scriptBufT* buf, const void* data, size_t len)
+{
+  if (buf->len + len > buf->size)
+  {
+    buf->size = (buf->len + len) * 2 + 256;
+    buf->data = realloc(buf->data, buf->size);
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+static void putWord(scriptBufT* buf, uint32_t word)
+{
+  put(buf, &word, sizeof(word));
+}
+
+static void putString(scriptBufT* buf, const char* s)
+{
+  static const char zero[4] = { 0, 0, 0, 0 };
+  uint32_t len = strlen(s);
+  putWord(buf, len);
+  put(buf, s, len);
+  put(buf, zero, 4 - len % 4);
+}
+
+/*Parse every line of a script into records, returns the number of records*/
+static uint32_t compile(char* src, size_t len, scriptBufT* buf)
+{
+  uint32_t records = 0;
+  size_t start = 0, end;
+  char *line, *parsed;
+  commandT **command, *cmd;
+  bool raw = FALSE;
+  int i, j, n;
+
+  while (start < len)
+  {
+    for (end = start; end < len && src[end] != '\n'; end++);
+    line = strndup(src + start, end - start);
+    start = end + 1;
+
+    /* an open if/while/for takes in the following lines */
+    while (start < len && IsIncomplete(line))
+    {
+      for (end = start; end < len && src[end] != '\n'; end++);
+      line = realloc(line, strlen(line) + end - start + 2);
+      strcat(line, "\n");
+      strncat(line, src + start, end - start);
+      start = end + 1;
+    }
+
+    if (strcmp(line, "exit") == 0)
+    {
+      putWord(buf, REC_EXIT);
+      records++;
+      free(line);
+      break;
+    }
+
+    /* compound commands and assignments are parsed by Interpret() */
+    if (IsCompound(line) || IsAssignment(line))
+    {
+      putWord(buf, REC_LINE);
+      putString(buf, line);
+      records++;
+      free(line);
+      continue;
+    }
+
+    parsed = strdup(line);
+    command = ParseCmdLine(parsed, &n);
+    if (command == NULL)
+    {
+      free(parsed);
+      free(line);
+      continue;
+    }
+
+    /* alias definitions change how every later line is expanded */
+    if (command[0]->argc > 0 && (strcmp(command[0]->argv[0], "alias") == 0 ||
+                                 strcmp(command[0]->argv[0], "unalias") == 0))
+      raw = TRUE;
+    /* the record has room for one output file, cmd > a > b is parsed again */
+    for (i = 0; i < n && command[i]->redirect_tee == NULL; i++);
+
+    if (raw || i < n || command[0]->argc <= 0 || NeedsExpansion(command))
+    {
+      putWord(buf, REC_LINE);
+      putString(buf, line);
+    }
+    else
+    {
+      putWord(buf, REC_CMDS);
+      putWord(buf, n);
+      for (i = 0; i < n; i++)
+      {
+        cmd = command[i];
+        putWord(buf, cmd->argc);
+        putWord(buf, cmd->bg);
+        putWord(buf, (cmd->redirect_in != NULL ? CMD_IN : 0) |
+                     (cmd->redirect_out != NULL ? CMD_OUT : 0));
+        putString(buf, cmd->cmdline);
+        if (cmd->redirect_in != NULL)
+          putString(buf, cmd->redirect_in);
+        if (cmd->redirect_out != NULL)
+          putString(buf, cmd->redirect_out);
+        for (j = 0; j < cmd->argc; j++)
+          putString(buf, cmd->argv[j]);
+      }
+    }
+    records++;
+
+    for (i = 0; i < n; i++)
+      ReleaseCmdT(&command[i]);
+    free(command);
+    free(parsed);
+    free(line);
+  }
+  return records;
+}
+
+/*Write a cache file under a temporary name and move it into place*/
+static void saveCache(char* cache, scriptHdrT* hdr, scriptBufT* buf)
+{
+  char tmp[SCRIPT_PATHLEN + 32];
+  int fd;
+  bool ok;
+
+  snprintf(tmp, sizeof(tmp), "%s.%d", cache, (int)getpid());
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1)
+    return;
+  ok = write(fd, hdr, sizeof(*hdr)) == sizeof(*hdr) &&
+       write(fd, buf->data, buf->len) == buf->len;
+  close(fd);
+  if (!ok || rename(tmp, cache) == -1)
+    unlink(tmp);
+}
+
+/*Map the cache file of a script if it is still valid for it*/
+static char* loadCache(char* cache, scriptHdrT* want, char* src, size_t* mapLen)
+{
+  int fd;
+  struct stat st;
+  char* map;
+  scriptHdrT* hdr;
+
+  fd = open(cache, O_RDWR);
+  if (fd == -1)
+    return NULL;
+  if (fstat(fd, &st) == -1 || st.st_size < sizeof(scriptHdrT))
+  {
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    close(fd);
+    return NULL;
+  }
+  hdr = (scriptHdrT*)map;
+  if (memcmp(hdr->magic, want->magic, 4) != 0 || hdr->version != want->version ||
+      hdr->size != want->size || hdr->aliases != want->aliases)
+    goto stale;
+
+  want->hash = hdr->hash;
+  want->records = hdr->records;
+
+  /* a touched but unchanged script only needs its mtime refreshed */
+  if (hdr->mtimeSec != want->mtimeSec || hdr->mtimeNsec != want->mtimeNsec)
+  {
+    if (hdr->hash != hash(src, want->size, 14695981039346656037UL))
+      goto stale;
+    if (pwrite(fd, want, sizeof(*want), 0) != sizeof(*want))
+      goto stale;
+  }
+  *mapLen = st.st_size;
+  close(fd);
+  return map;
+
+stale:
+  munmap(map, st.st_size);
+  close(fd);
+  return NULL;
+}
+
+/*Read a string record field and advance past it*/
+static char* getString(char** p)
+{
+  uint32_t len = *(uint32_t*)*p;
+  char* s = *p + sizeof(uint32_t);
+  *p = s + len + (4 - len % 4);
+  return s;
+}
+
+/*Run the records of a parsed script*/
+static void run(char* p, uint32_t records)
+{
+  uint32_t r, kind, flags;
+  int i, j, n, argc;
+  char* line;
+  commandT** command;
+
+  for (r = 0; r < records && !forceExit; r++)
+  {
+    kind = *(uint32_t*)p;
+    p += sizeof(uint32_t);
+    if (kind == REC_EXIT)
+      break;
+
+    /* checks the status of background jobs, like the interactive loop */
+    CheckJobs();
+
+    if (kind == REC_LINE)
+    {
+      line = strdup(getString(&p));
+      Interpret(line, FALSE);
+      free(line);
+      continue;
+    }
+
+    n = *(uint32_t*)p;
+    p += sizeof(uint32_t);
+    command = malloc(sizeof(commandT*) * n);
+    for (i = 0; i < n; i++)
+    {
+      argc = ((uint32_t*)p)[0];
+      command[i] = CreateCmdT(argc);
+      command[i]->bg = ((uint32_t*)p)[1];
+      flags = ((uint32_t*)p)[2];
+      p += 3 * sizeof(uint32_t);
+      command[i]->cmdline = strdup(getString(&p));
+      if (flags & CMD_IN)
+      {
+        command[i]->is_redirect_in = 1;
+        command[i]->redirect_in = strdup(getString(&p));
+      }
+      if (flags & CMD_OUT)
+      {
+        command[i]->is_redirect_out = 1;
+        command[i]->redirect_out = strdup(getString(&p));
+      }
+      for (j = 0; j < argc; j++)
+        command[i]->argv[j] = strdup(getString(&p));
+    }
+    RunCmd(command, n);
+    for (i = 0; i < n; i++)
+      ReleaseCmdT(&command[i]);
+    free(command);
+  }
+}
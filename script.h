@@ -0,0 +1,69 @@
+/***************************************************************************
+ *  Title: Script files
+ * -------------------------------------------------------------------------
+ *    Purpose: Runs script files through an on-disk cache of parsed lines
+ *    File: script.h
+ ***************************************************************************/
+
+#ifndef __SCRIPT_H__
+#define __SCRIPT_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <stddef.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __SCRIPT_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* bump whenever the layout of a cache file changes */
+#define SCRIPT_CACHE_VERSION 2
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Find the cache directory
+ * ---------------------------------------------------------------------
+ *    Purpose: Returns $TSH_CACHE_DIR, $XDG_CACHE_HOME/tsh or
+ *    ~/.cache/tsh and creates it. An empty $TSH_CACHE_DIR turns all
+ *    on-disk caches off.
+ *    Input: a buffer and its size
+ *    Output: true if the directory can be used
+ ***********************************************************************/
+EXTERN bool CacheDir(char*, size_t);
+
+/***********************************************************************
+ *  Title: Run a script file
+ * ---------------------------------------------------------------------
+ *    Purpose: Runs every line of a script like the interactive loop
+ *    would. The parsed script is kept in the cache directory, keyed
+ *    by the script's path, mtime and content hash and by the alias
+ *    table, and is mapped and run without tokenizing on later runs.
+ *    Input: the path of the script
+ *    Output: the exit status of the last command, 127 if the script
+ *    cannot be read
+ ***********************************************************************/
+EXTERN int RunScript(char*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __SCRIPT_H__ */
@@ -0,0 +1,679 @@
+/***************************************************************************
+ *  Title: Command server
+ * -------------------------------------------------------------------------
+ *    Purpose: Runs command lines submitted over a Unix domain socket
+ *    File: server.c
+ ***************************************************************************/
+#define __SERVER_IMPL__
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "server.h"
+#include "interpreter.h"
+#include "runtime.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* bytes read from a socket or pipe at once */
+#define CHUNK 65536
+/* stop reading a worker's output while its client has this much unsent */
+#define OUT_HIGH (1024 * 1024)
+#define MAXEVENTS 64
+
+typedef enum { FD_NONE, FD_LISTEN, FD_CHILD, FD_CLIENT, FD_STDOUT, FD_STDERR } fdKindT;
+
+typedef struct client_l
+{
+  int fd;
+  char *in, *out;           /* unparsed input, unsent output */
+  int inLen, inCap;
+  int outLen, outCap;
+  pid_t worker;             /* worker running the current line, 0 if idle */
+  int pipes[2];             /* worker stdout/stderr, -1 once closed */
+  bool eof;                 /* client sends nothing more */
+  bool dead;                /* client cannot be written to anymore */
+  bool queued;              /* waiting for a free slot */
+  bool writing;             /* EPOLLOUT is armed */
+  struct client_l *nextQueued;
+} clientT;
+
+typedef struct endpoint_t
+{
+  fdKindT kind;
+  clientT* client;
+} endpointT;
+
+/************Global Variables*********************************************/
+
+static int gEpoll;
+/* what every watched descriptor is, indexed by descriptor */
+static endpointT* gFds = NULL;
+static int gFdCap = 0;
+/* clients with a worker running, gMaxJobs slots */
+static clientT** gBusy = NULL;
+/* clients waiting for a slot, in arrival order */
+static clientT *gQueueHead = NULL, *gQueueTail = NULL;
+static int gRunning = 0;
+static int gMaxJobs = SERVER_MAXJOBS;
+/* the SIGCHLD handler wakes the event loop through this pipe */
+static int gChildPipe[2];
+/* builtins that change the shell itself, run in the server so every later line sees it */
+static char* kShellBuiltins[] = { "cd", "alias", "unalias", "unset", "hash", "enable", "compression", "priority", "prefetch", NULL };
+
+/************Function Prototypes******************************************/
+static void watch(int fd, fdKindT kind, clientT* c, int events);
+static void unwatch(int fd);
+static void acceptClients(int fd);
+static void readClient(clientT* c, int events);
+static void flushClient(clientT* c);
+static void readWorker(clientT* c, int stream, bool drain);
+static void reapWorkers();
+static void finishLine(clientT* c, int status);
+static void tryStart(clientT* c);
+static void startLine(clientT* c, char* line);
+static bool changesShell(char* line);
+static void runInServer(clientT* c, char* line);
+static int captureFile();
+static void relayCaptured(clientT* c, int stream, int fd);
+static void startQueued();
+static void maybeClose(clientT* c);
+static void appendOut(clientT* c, char* data, int len);
+static void setPipeEvents(clientT* c, int events);
+static void serverSigchld(int signo);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+int ServeCommands(char* path, int maxJobs)
+{
+  struct sockaddr_un addr;
+  struct epoll_event events[MAXEVENTS];
+  int lfd, n, i;
+  endpointT* ep;
+
+  gMaxJobs = maxJobs > 0 ? maxJobs : SERVER_MAXJOBS;
+  gBusy = calloc(gMaxJobs, sizeof(clientT*));
+  //The server is stopped with a signal, and clients may vanish at any time
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (pipe2(gChildPipe, O_NONBLOCK | O_CLOEXEC) == -1)
+  {
+    PrintPError("pipe");
+    return 1;
+  }
+  signal(SIGCHLD, serverSigchld);
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "%s: socket path too long\n", path);
+    return 1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  unlink(path);
+  if (lfd == -1 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(lfd, SOMAXCONN) == -1)
+  {
+    PrintPError(path);
+    return 1;
+  }
+
+  gEpoll = epoll_create1(EPOLL_CLOEXEC);
+  watch(lfd, FD_LISTEN, NULL, EPOLLIN);
+  watch(gChildPipe[0], FD_CHILD, NULL, EPOLLIN);
+
+  while (1)
+  {
+    n = epoll_wait(gEpoll, events, MAXEVENTS, -1);
+    if (n == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      PrintPError("epoll_wait");
+      return 1;
+    }
+    for (i = 0; i < n; i++)
+    {
+      ep = &gFds[events[i].data.fd];
+      switch (ep->kind)
+      {
+        case FD_LISTEN:
+          acceptClients(events[i].data.fd);
+          break;
+        case FD_CHILD:
+          reapWorkers();
+          break;
+        case FD_CLIENT:
+          if (events[i].events & EPOLLOUT)
+            flushClient(ep->client);
+          if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            readClient(ep->client, events[i].events);
+          else
+            maybeClose(ep->client);
+          break;
+        case FD_STDOUT:
+          readWorker(ep->client, 0, FALSE);
+          break;
+        case FD_STDERR:
+          readWorker(ep->client, 1, FALSE);
+          break;
+        case FD_NONE:
+          //Closed earlier in this batch of events
+          break;
+      }
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////
+//  Clients
+//////////////////////////////////////////////////////////////
+
+static void acceptClients(int lfd)
+{
+  clientT* c;
+  int fd;
+
+  while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+  {
+    c = calloc(1, sizeof(clientT));
+    c->fd = fd;
+    c->pipes[0] = c->pipes[1] = -1;
+    watch(fd, FD_CLIENT, c, EPOLLIN);
+  }
+}
+
+static void readClient(clientT* c, int events)
+{
+  int n;
+
+  //The peer is completely gone, stop watching it until its line is done
+  if ((events & (EPOLLHUP | EPOLLERR)) && !c->dead)
+  {
+    c->eof = c->dead = TRUE;
+    epoll_ctl(gEpoll, EPOLL_CTL_DEL, c->fd, NULL);
+  }
+  while (!c->eof)
+  {
+    if (c->inCap - c->inLen < CHUNK)
+    {
+      c->inCap = c->inLen + CHUNK;
+      c->in = realloc(c->in, c->inCap);
+    }
+    n = read(c->fd, c->in + c->inLen, CHUNK);
+    if (n > 0)
+      c->inLen += n;
+    else if (n == 0 || errno != EAGAIN)
+    {
+      //Half closed: run what was sent, answer, then close
+      c->eof = TRUE;
+      if (n == -1)
+        c->dead = TRUE;
+      epoll_ctl(gEpoll, EPOLL_CTL_MOD, c->fd, &(struct epoll_event){ .events = c->writing ? EPOLLOUT : 0, .data.fd = c->fd });
+    }
+    else
+      break;
+  }
+  tryStart(c);
+  maybeClose(c);
+}
+
+static void flushClient(clientT* c)
+{
+  int n, done = 0;
+
+  while (done < c->outLen && !c->dead)
+  {
+    n = write(c->fd, c->out + done, c->outLen - done);
+    if (n > 0)
+      done += n;
+    else if (errno == EAGAIN)
+      break;
+    else
+      c->dead = TRUE;
+  }
+  if (c->dead)
+    done = c->outLen;
+  memmove(c->out, c->out + done, c->outLen - done);
+  c->outLen -= done;
+
+  //Only ask for EPOLLOUT while something is left
+  if ((c->outLen > 0) != c->writing && !c->dead)
+  {
+    c->writing = (c->outLen > 0);
+    epoll_ctl(gEpoll, EPOLL_CTL_MOD, c->fd, &(struct epoll_event){ .events = (c->eof ? 0 : EPOLLIN) | (c->writing ? EPOLLOUT : 0), .data.fd = c->fd });
+  }
+  //The worker was held back while the client was slow
+  if (c->outLen < OUT_HIGH)
+    setPipeEvents(c, EPOLLIN);
+}
+
+static void appendOut(clientT* c, char* data, int len)
+{
+  if (c->dead)
+    return;
+  if (c->outCap - c->outLen < len)
+  {
+    c->outCap = (c->outLen + len) * 2;
+    c->out = realloc(c->out, c->outCap);
+  }
+  memcpy(c->out + c->outLen, data, len);
+  c->outLen += len;
+}
+
+static void maybeClose(clientT* c)
+{
+  //Everything that was sent has to be answered first
+  if (!(c->eof || c->dead) || c->worker != 0 || c->queued)
+    return;
+  if (!c->dead && (memchr(c->in, '\n', c->inLen) != NULL || c->outLen > 0))
+    return;
+  unwatch(c->fd);
+  free(c->in);
+  free(c->out);
+  free(c);
+}
+
+//////////////////////////////////////////////////////////////
+//  Workers
+//////////////////////////////////////////////////////////////
+
+static void tryStart(clientT* c)
+{
+  char *nl, *line;
+  int len;
+
+again:
+  if (c->worker != 0 || c->queued || c->dead || c->inLen == 0)
+    return;
+  nl = memchr(c->in, '\n', c->inLen);
+  if (nl == NULL)
+    return;
+  //A line that changes the shell takes no slot, it is over before the next event
+  if (gRunning >= gMaxJobs && !changesShell(c->in))
+  {
+    c->queued = TRUE;
+    c->nextQueued = NULL;
+    if (gQueueTail != NULL)
+      gQueueTail->nextQueued = c;
+    else
+      gQueueHead = c;
+    gQueueTail = c;
+    return;
+  }
+
+  len = nl - c->in;
+  line = malloc(len + 1);
+  memcpy(line, c->in, len);
+  line[len] = '\0';
+  if (len > 0 && line[len - 1] == '\r')
+    line[len - 1] = '\0';
+  memmove(c->in, nl + 1, c->inLen - len - 1);
+  c->inLen -= len + 1;
+
+  if (strcmp(line, "exit") == 0)
+  {
+    //Whatever follows "exit" is dropped
+    c->eof = TRUE;
+    c->inLen = 0;
+  }
+  else if (changesShell(line))
+  {
+    runInServer(c, line);
+    free(line);
+    goto again;
+  }
+  else
+    startLine(c, line);
+  free(line);
+}
+
+/*A single builtin that changes the shell itself, or NAME=value. Anything more,
+  a pipe, a list or an alias that may run a program, goes to a worker*/
+static bool changesShell(char* line)
+{
+  char word[32];
+  char quote = 0;
+  char* p;
+  int i, len;
+
+  //Only the first line counts when called on the client's whole input
+  for (p = line; *p != '\0' && *p != '\n'; p++)
+  {
+    if (quote != 0)
+      quote = (*p == quote) ? 0 : quote;
+    else if (*p == '\'' || *p == '"')
+      quote = *p;
+    else if (strchr("|&;<>()`", *p) != NULL)
+      return FALSE;
+  }
+  len = p - line;
+  for (p = line; *p == ' ' || *p == '\t'; p++);
+  for (i = 0; p[i] != '\0' && p[i] != '\n' && p[i] != ' ' && p[i] != '\t' && i < (int)sizeof(word) - 1; i++)
+    word[i] = p[i];
+  word[i] = '\0';
+  if (i == 0 || IsAlias(word))
+    return FALSE;
+  for (i = 0; word[i] != '\0' && word[i] != '='; i++);
+  if (word[i] == '=')
+  {
+    char* first = strndup(line, len);
+    bool assignment = !IsCompound(first) && IsAssignment(first);
+    free(first);
+    return assignment;
+  }
+  for (i = 0; kShellBuiltins[i] != NULL; i++)
+    if (strcmp(word, kShellBuiltins[i]) == 0)
+      return TRUE;
+  return FALSE;
+}
+
+/*Run a line in the server process itself, so what it changes stays for the
+  lines after it from every client. Its output is caught in unlinked files and
+  sent as usual*/
+static void runInServer(clientT* c, char* line)
+{
+  char frame[32];
+  int out, err, savedOut, savedErr;
+
+  out = captureFile();
+  err = captureFile();
+  savedOut = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+  savedErr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+  if (out == -1 || err == -1 || savedOut == -1 || savedErr == -1)
+  {
+    lastExitStatus = 126;
+    goto done;
+  }
+
+  OutFlush();
+  fflush(stdout);
+  fflush(stderr);
+  dup2(out, STDOUT_FILENO);
+  dup2(err, STDERR_FILENO);
+  Interpret(line, FALSE);
+  OutFlush();
+  fflush(stdout);
+  fflush(stderr);
+  dup2(savedOut, STDOUT_FILENO);
+  dup2(savedErr, STDERR_FILENO);
+
+  relayCaptured(c, 0, out);
+  relayCaptured(c, 1, err);
+done:
+  if (out != -1)
+    close(out);
+  if (err != -1)
+    close(err);
+  if (savedOut != -1)
+    close(savedOut);
+  if (savedErr != -1)
+    close(savedErr);
+  snprintf(frame, sizeof(frame), "$ %d\n", lastExitStatus);
+  appendOut(c, frame, strlen(frame));
+  flushClient(c);
+}
+
+/*A file with no name to catch output in, like ResultCapture() makes*/
+static int captureFile()
+{
+  char tmp[] = "/tmp/.tsh-serve.XXXXXX";
+  int fd;
+
+  fd = open("/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  //File systems without O_TMPFILE get a named file that is gone right away
+  if (fd == -1 && (fd = mkostemp(tmp, O_CLOEXEC)) != -1)
+    unlink(tmp);
+  return fd;
+}
+
+static void relayCaptured(clientT* c, int stream, int fd)
+{
+  char buf[CHUNK];
+  char header[32];
+  ssize_t n;
+
+  lseek(fd, 0, SEEK_SET);
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+  {
+    snprintf(header, sizeof(header), "%d %zd\n", stream + 1, n);
+    appendOut(c, header, strlen(header));
+    appendOut(c, buf, n);
+  }
+}
+
+static void startLine(clientT* c, char* line)
+{
+  int out[2], err[2], devnull, i;
+  char frame[32];
+  pid_t pid;
+
+  if (pipe2(out, O_CLOEXEC) == -1)
+  {
+    snprintf(frame, sizeof(frame), "$ %d\n", 126);
+    appendOut(c, frame, strlen(frame));
+    flushClient(c);
+    return;
+  }
+  if (pipe2(err, O_CLOEXEC) == -1)
+  {
+    close(out[0]);
+    close(out[1]);
+    snprintf(frame, sizeof(frame), "$ %d\n", 126);
+    appendOut(c, frame, strlen(frame));
+    flushClient(c);
+    return;
+  }
+
+  pid = fork();
+  if (pid == 0)
+  {
+    //The worker is an ordinary copy of the shell running one line
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    devnull = open("/dev/null", O_RDONLY);
+    dup2(devnull, 0);
+    dup2(out[1], 1);
+    dup2(err[1], 2);
+    Interpret(line, FALSE);
+    OutFlush();
+    fflush(stderr);
+    exit(lastExitStatus);
+  }
+  close(out[1]);
+  close(err[1]);
+  if (pid == -1)
+  {
+    close(out[0]);
+    close(err[0]);
+    snprintf(frame, sizeof(frame), "$ %d\n", 126);
+    appendOut(c, frame, strlen(frame));
+    flushClient(c);
+    return;
+  }
+  fcntl(out[0], F_SETFL, O_NONBLOCK);
+  fcntl(err[0], F_SETFL, O_NONBLOCK);
+  c->pipes[0] = out[0];
+  c->pipes[1] = err[0];
+  watch(out[0], FD_STDOUT, c, EPOLLIN);
+  watch(err[0], FD_STDERR, c, EPOLLIN);
+  c->worker = pid;
+  for (i = 0; gBusy[i] != NULL; i++);
+  gBusy[i] = c;
+  gRunning++;
+  //Every line in flight is a job, so "jobs" from any client sees all of them
+  AddJob(pid, line);
+}
+
+static void readWorker(clientT* c, int stream, bool drain)
+{
+  char buf[CHUNK];
+  char header[32];
+  int n, fd = c->pipes[stream];
+
+  while (fd != -1 && (drain || c->outLen < OUT_HIGH))
+  {
+    n = read(fd, buf, sizeof(buf));
+    if (n > 0)
+    {
+      snprintf(header, sizeof(header), "%d %d\n", stream + 1, n);
+      appendOut(c, header, strlen(header));
+      appendOut(c, buf, n);
+    }
+    else if (n == 0 || errno != EAGAIN)
+    {
+      unwatch(fd);
+      c->pipes[stream] = fd = -1;
+    }
+    else
+      break;
+  }
+  //Slow client: leave the rest in the pipe until it catches up
+  if (c->outLen >= OUT_HIGH)
+    setPipeEvents(c, 0);
+  flushClient(c);
+}
+
+static void reapWorkers()
+{
+  char c;
+  pid_t pid;
+  int status;
+  int i;
+
+  while (read(gChildPipe[0], &c, 1) == 1);
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+  {
+    for (i = 0; i < gMaxJobs; i++)
+    {
+      if (gBusy[i] != NULL && gBusy[i]->worker == pid)
+      {
+        clientT* client = gBusy[i];
+        gBusy[i] = NULL;
+        finishLine(client, status);
+        break;
+      }
+    }
+  }
+}
+
+static void finishLine(clientT* c, int status)
+{
+  char frame[32];
+  int code, i;
+
+  //The worker is gone, whatever it wrote is already in the pipes; output of
+  //background jobs it left behind is not waited for
+  for (i = 0; i < 2; i++)
+  {
+    readWorker(c, i, TRUE);
+    if (c->pipes[i] != -1)
+    {
+      unwatch(c->pipes[i]);
+      c->pipes[i] = -1;
+    }
+  }
+
+  if (WIFEXITED(status))
+    code = WEXITSTATUS(status);
+  else
+    code = 128 + WTERMSIG(status);
+  snprintf(frame, sizeof(frame), "$ %d\n", code);
+  appendOut(c, frame, strlen(frame));
+
+  RemoveJob(c->worker);
+  c->worker = 0;
+  gRunning--;
+  startQueued();
+  tryStart(c);
+  flushClient(c);
+  maybeClose(c);
+}
+
+static void startQueued()
+{
+  clientT* c;
+
+  while (gRunning < gMaxJobs && gQueueHead != NULL)
+  {
+    c = gQueueHead;
+    gQueueHead = c->nextQueued;
+    if (gQueueHead == NULL)
+      gQueueTail = NULL;
+    c->queued = FALSE;
+    tryStart(c);
+    maybeClose(c);
+  }
+}
+
+static void serverSigchld(int signo)
+{
+  int saved = errno;
+  //A full pipe already has the main loop woken up
+  if (write(gChildPipe[1], "x", 1) == -1) {}
+  errno = saved;
+}
+
+//////////////////////////////////////////////////////////////
+//  Descriptor Bookkeeping
+//////////////////////////////////////////////////////////////
+
+static void watch(int fd, fdKindT kind, clientT* c, int events)
+{
+  struct epoll_event ev;
+
+  if (fd >= gFdCap)
+  {
+    int cap = gFdCap == 0 ? 256 : gFdCap;
+    while (cap <= fd)
+      cap *= 2;
+    gFds = realloc(gFds, sizeof(endpointT) * cap);
+    memset(gFds + gFdCap, 0, sizeof(endpointT) * (cap - gFdCap));
+    gFdCap = cap;
+  }
+  gFds[fd].kind = kind;
+  gFds[fd].client = c;
+  ev.events = events;
+  ev.data.fd = fd;
+  epoll_ctl(gEpoll, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void unwatch(int fd)
+{
+  epoll_ctl(gEpoll, EPOLL_CTL_DEL, fd, NULL);
+  gFds[fd].kind = FD_NONE;
+  gFds[fd].client = NULL;
+  close(fd);
+}
+
+static void setPipeEvents(clientT* c, int events)
+{
+  int i;
+
+  for (i = 0; i < 2; i++)
+    if (c->pipes[i] != -1)
+      epoll_ctl(gEpoll, EPOLL_CTL_MOD, c->pipes[i], &(struct epoll_event){ .events = events, .data.fd = c->pipes[i] });
+}
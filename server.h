@@ -0,0 +1,64 @@
+/***************************************************************************
+ *  Title: Command server
+ * -------------------------------------------------------------------------
+ *    Purpose: Runs command lines submitted over a Unix domain socket
+ *    File: server.h
+ ***************************************************************************/
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __SERVER_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* default number of command lines running at the same time */
+#define SERVER_MAXJOBS 16
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Serve command lines on a Unix domain socket
+ * ---------------------------------------------------------------------
+ *    Purpose: Accepts any number of clients. A client sends command
+ *    lines terminated by '\n'; each one runs through Interpret() in a
+ *    forked worker that is listed in the shared job table. A line that
+ *    is just cd, alias, unalias, unset, hash, enable, compression,
+ *    priority, prefetch or NAME=value runs in the server itself, so
+ *    what it changes holds for every later line of every client. A
+ *    client's lines run one after the other, at most maxjobs lines run
+ *    at once over all clients. The server answers with frames:
+ *        "1 <len>\n<len bytes>"   output on stdout
+ *        "2 <len>\n<len bytes>"   output on stderr
+ *        "$ <status>\n"           the line finished with this status
+ *    The line "exit" closes the connection.
+ *    Input: the socket path and the concurrency limit
+ *    Output: the exit code of the shell
+ ***********************************************************************/
+EXTERN int ServeCommands(char*, int);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __SERVER_H__ */
@@ -0,0 +1,444 @@
+/***************************************************************************
+ *  Title: Spawn server
+ * -------------------------------------------------------------------------
+ *    Purpose: Launches jobs from a small helper forked at startup so the
+ *    cost of a launch does not grow with the size of the shell
+ *    File: spawn.c
+ ***************************************************************************/
+#define __SPAWN_IMPL__
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "spawn.h"
+#include "cgroup.h"
+#include "jobsched.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* messages from the helper to the shell */
+#define MSG_PID   'P'  /* reply to a launch request */
+#define MSG_EVENT 'E'  /* a child exited or stopped */
+
+typedef struct spawn_msg_t
+{
+  int type;
+  pid_t pid;
+  int status;
+} spawnMsgT;
+
+/* launch request, followed by len bytes of NUL separated strings:
+ * path, cgroup ("" for none), cpus ("" for any), argc arguments, envc environment entries */
+typedef struct spawn_req_t
+{
+  int len;
+  int argc;
+  int envc;
+  int bg;
+} spawnReqT;
+
+/************Global Variables*********************************************/
+
+extern char** environ;
+
+/* shell's end of the socketpair, -1 without a helper */
+static int gSock = -1;
+static pid_t gHelper = -1;
+static spawnEventT gEvent = NULL;
+
+/* helper side: the SIGCHLD handler wakes up the main loop through this pipe */
+static int gChildPipe[2];
+
+/************Function Prototypes******************************************/
+/* main loop of the helper process */
+static void helperLoop(int sock);
+/* forks and execs one launch request inside the helper */
+static void helperLaunch(int sock);
+/* helper SIGCHLD handler */
+static void helperSigchld(int signo);
+/* reads/writes exactly len bytes, waiting on a nonblocking descriptor */
+static bool readFull(int fd, void* buf, int len);
+static bool writeFull(int fd, void* buf, int len);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+bool SpawnStart(spawnEventT event)
+{
+#ifdef F_SETSIG
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+    return FALSE;
+  gHelper = fork();
+  if (gHelper == -1)
+  {
+    close(sv[0]);
+    close(sv[1]);
+    return FALSE;
+  }
+  if (gHelper == 0)
+  {
+    close(sv[0]);
+    helperLoop(sv[1]);
+    _exit(0);
+  }
+  close(sv[1]);
+  gSock = sv[0];
+  gEvent = event;
+  //Have the kernel raise SIGCHLD whenever the helper reports something,
+  //so the normal reaping path picks the events up
+  fcntl(gSock, F_SETFD, FD_CLOEXEC);
+  fcntl(gSock, F_SETOWN, getpid());
+  fcntl(gSock, F_SETSIG, SIGCHLD);
+  fcntl(gSock, F_SETFL, O_NONBLOCK | O_ASYNC);
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+bool SpawnActive()
+{
+  return gSock != -1;
+}
+
+pid_t SpawnExec(char* path, char** argv, int* fds, char* cgroup, char* cpus, bool bg)
+{
+  spawnReqT req;
+  spawnMsgT msg;
+  struct msghdr mh;
+  struct iovec iov;
+  struct cmsghdr* cm;
+  struct pollfd pfd;
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  char *payload, *p;
+  int i, n;
+
+  if (gSock == -1)
+    return -1;
+  if (cgroup == NULL)
+    cgroup = "";
+  if (cpus == NULL)
+    cpus = "";
+
+  //Flatten the request into one buffer of strings
+  req.len = strlen(path) + 1 + strlen(cgroup) + 1 + strlen(cpus) + 1;
+  for (req.argc = 0; argv[req.argc] != NULL; req.argc++)
+    req.len += strlen(argv[req.argc]) + 1;
+  for (req.envc = 0; environ[req.envc] != NULL; req.envc++)
+    req.len += strlen(environ[req.envc]) + 1;
+  req.bg = bg;
+  p = payload = malloc(req.len);
+  p = stpcpy(p, path) + 1;
+  p = stpcpy(p, cgroup) + 1;
+  p = stpcpy(p, cpus) + 1;
+  for (i = 0; i < req.argc; i++)
+    p = stpcpy(p, argv[i]) + 1;
+  for (i = 0; i < req.envc; i++)
+    p = stpcpy(p, environ[i]) + 1;
+
+  //The header carries stdin/stdout/stderr of the new process
+  memset(&mh, 0, sizeof(mh));
+  iov.iov_base = &req;
+  iov.iov_len = sizeof(req);
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = control;
+  mh.msg_controllen = sizeof(control);
+  cm = CMSG_FIRSTHDR(&mh);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(3 * sizeof(int));
+  memcpy(CMSG_DATA(cm), fds, 3 * sizeof(int));
+
+  //The socket is a stream: the header may go out in pieces, the descriptors with the first
+  pfd.fd = gSock;
+  pfd.events = POLLOUT;
+  while ((n = sendmsg(gSock, &mh, 0)) == -1 && (errno == EINTR || errno == EAGAIN))
+    if (errno == EAGAIN)
+      poll(&pfd, 1, -1);
+  if (n <= 0 || !writeFull(gSock, (char*)&req + n, sizeof(req) - n) || !writeFull(gSock, payload, req.len))
+  {
+    free(payload);
+    SpawnStop();
+    return -1;
+  }
+  free(payload);
+
+  //Events of earlier children can arrive before our reply
+  while (readFull(gSock, &msg, sizeof(msg)))
+  {
+    if (msg.type == MSG_PID)
+      return msg.pid;
+    if (msg.type == MSG_EVENT && gEvent != NULL)
+      gEvent(msg.pid, msg.status);
+  }
+  SpawnStop();
+  return -1;
+}
+
+void SpawnReap()
+{
+  spawnMsgT msg;
+  int n;
+
+  while (gSock != -1)
+  {
+    n = read(gSock, &msg, sizeof(msg));
+    if (n == -1 && errno == EINTR)
+      continue;
+    //The socket is a stream, the rest of a message read in part is on its way
+    if (n > 0 && n < (int)sizeof(msg) && !readFull(gSock, (char*)&msg + n, sizeof(msg) - n))
+    {
+      SpawnStop();
+      break;
+    }
+    if (n > 0)
+    {
+      if (msg.type == MSG_EVENT && gEvent != NULL)
+        gEvent(msg.pid, msg.status);
+    }
+    else
+    {
+      //End of file means the helper is gone, launches fall back to fork
+      if (n == 0)
+        SpawnStop();
+      break;
+    }
+  }
+}
+
+void SpawnStop()
+{
+  if (gSock != -1)
+    close(gSock);
+  gSock = -1;
+}
+
+//////////////////////////////////////////////////////////////
+//  Helper Process
+//////////////////////////////////////////////////////////////
+
+static void helperLoop(int sock)
+{
+  struct pollfd pfd[2];
+  spawnMsgT msg;
+  pid_t pid;
+  int status;
+  char c;
+
+  //Keyboard signals are meant for the jobs, not for the helper
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+  if (pipe(gChildPipe) == -1)
+    _exit(1);
+  fcntl(gChildPipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(gChildPipe[1], F_SETFL, O_NONBLOCK);
+  signal(SIGCHLD, helperSigchld);
+
+  pfd[0].fd = sock;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = gChildPipe[0];
+  pfd[1].events = POLLIN;
+  while (1)
+  {
+    if (poll(pfd, 2, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      _exit(1);
+    }
+    if (pfd[1].revents & POLLIN)
+    {
+      while (read(gChildPipe[0], &c, 1) == 1);
+      while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0)
+      {
+        msg.type = MSG_EVENT;
+        msg.pid = pid;
+        msg.status = status;
+        if (!writeFull(sock, &msg, sizeof(msg)))
+          _exit(0);
+      }
+    }
+    if (pfd[0].revents & (POLLIN | POLLHUP))
+      helperLaunch(sock);
+  }
+}
+
+static void helperLaunch(int sock)
+{
+  spawnReqT req;
+  spawnMsgT msg;
+  struct msghdr mh;
+  struct iovec iov;
+  struct cmsghdr* cm;
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  int fds[3] = { -1, -1, -1 };
+  char *payload, *p, *path, *cgroup, *cpus;
+  char **argv, **envp;
+  pid_t pid;
+  int i, n;
+
+  memset(&mh, 0, sizeof(mh));
+  iov.iov_base = &req;
+  iov.iov_len = sizeof(req);
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = control;
+  mh.msg_controllen = sizeof(control);
+  //The shell closed its end: it exited, and so do we
+  while ((n = recvmsg(sock, &mh, 0)) == -1 && errno == EINTR);
+  if (n <= 0 || !readFull(sock, (char*)&req + n, sizeof(req) - n))
+    _exit(0);
+  cm = CMSG_FIRSTHDR(&mh);
+  if (cm != NULL && cm->cmsg_type == SCM_RIGHTS)
+    memcpy(fds, CMSG_DATA(cm), 3 * sizeof(int));
+
+  payload = malloc(req.len);
+  argv = malloc(sizeof(char*) * (req.argc + 1));
+  envp = malloc(sizeof(char*) * (req.envc + 1));
+  if (!readFull(sock, payload, req.len))
+    _exit(0);
+  p = payload;
+  path = p;
+  p += strlen(p) + 1;
+  cgroup = p;
+  p += strlen(p) + 1;
+  cpus = p;
+  p += strlen(p) + 1;
+  for (i = 0; i < req.argc; i++, p += strlen(p) + 1)
+    argv[i] = p;
+  argv[i] = NULL;
+  for (i = 0; i < req.envc; i++, p += strlen(p) + 1)
+    envp[i] = p;
+  envp[i] = NULL;
+
+  pid = fork();
+  if (pid == 0)
+  {
+    sigset_t none;
+    //Same setup Exec() does after its own fork
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    close(sock);
+    close(gChildPipe[0]);
+    close(gChildPipe[1]);
+    if (cgroup[0] != '\0')
+      CgroupAttach(cgroup);
+    if (cpus[0] != '\0')
+      AffinityApply(cpus);
+    setpgid(0,0);
+    if (req.bg)
+      PriorityBackground(0);
+    for (i = 0; i < 3; i++)
+    {
+      if (fds[i] >= 0 && fds[i] != i)
+      {
+        dup2(fds[i], i);
+        close(fds[i]);
+      }
+    }
+    execve(path, argv, envp);
+    fprintf(stderr, "%s\n", "command not found");
+    _exit(0);
+  }
+  //Set the group from both sides so the shell can signal it right away
+  if (pid > 0)
+    setpgid(pid, pid);
+  for (i = 0; i < 3; i++)
+    if (fds[i] >= 0)
+      close(fds[i]);
+  free(payload);
+  free(argv);
+  free(envp);
+
+  msg.type = MSG_PID;
+  msg.pid = pid;
+  msg.status = 0;
+  if (!writeFull(sock, &msg, sizeof(msg)))
+    _exit(0);
+}
+
+static void helperSigchld(int signo)
+{
+  int saved = errno;
+  //A full pipe already has the main loop woken up
+  if (write(gChildPipe[1], "x", 1) == -1) {}
+  errno = saved;
+}
+
+//////////////////////////////////////////////////////////////
+//  Support Functions
+//////////////////////////////////////////////////////////////
+
+static bool readFull(int fd, void* buf, int len)
+{
+  struct pollfd pfd;
+  int n;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while (len > 0)
+  {
+    n = read(fd, buf, len);
+    if (n > 0)
+    {
+      buf = (char*)buf + n;
+      len -= n;
+    }
+    else if (n == 0)
+      return FALSE;
+    else if (errno == EAGAIN)
+      poll(&pfd, 1, -1);
+    else if (errno != EINTR)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static bool writeFull(int fd, void* buf, int len)
+{
+  struct pollfd pfd;
+  int n;
+
+  pfd.fd = fd;
+  pfd.events = POLLOUT;
+  while (len > 0)
+  {
+    n = write(fd, buf, len);
+    if (n > 0)
+    {
+      buf = (char*)buf + n;
+      len -= n;
+    }
+    else if (n == -1 && errno == EAGAIN)
+      poll(&pfd, 1, -1);
+    else if (n == -1 && errno != EINTR)
+      return FALSE;
+  }
+  return TRUE;
+}
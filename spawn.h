@@ -0,0 +1,98 @@
+/***************************************************************************
+ *  Title: Spawn server
+ * -------------------------------------------------------------------------
+ *    Purpose: Launches jobs from a small helper forked at startup so the
+ *    cost of a launch does not grow with the size of the shell
+ *    File: spawn.h
+ ***************************************************************************/
+
+#ifndef __SPAWN_H__
+#define __SPAWN_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <sys/types.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __SPAWN_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* called for every exit/stop event the helper reports, like waitpid */
+typedef void (*spawnEventT)(pid_t, int);
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Start the spawn server
+ * ---------------------------------------------------------------------
+ *    Purpose: Forks the helper and connects it with a socketpair.
+ *    Child events are announced to the shell with SIGCHLD and have to
+ *    be collected with SpawnReap.
+ *    Input: the function receiving child events
+ *    Output: true if the helper is running
+ ***********************************************************************/
+EXTERN bool SpawnStart(spawnEventT);
+
+/***********************************************************************
+ *  Title: Checks whether the spawn server is running
+ * ---------------------------------------------------------------------
+ *    Purpose: Tells the runtime whether to launch through the helper.
+ *    Input: void
+ *    Output: true if running
+ ***********************************************************************/
+EXTERN bool SpawnActive();
+
+/***********************************************************************
+ *  Title: Launch a program through the spawn server
+ * ---------------------------------------------------------------------
+ *    Purpose: Sends path, argv, the environment and the stdin/stdout/
+ *    stderr descriptors to the helper, which forks and execs.
+ *    Input: path, argv, the three descriptors, the cgroup to join (or
+ *    NULL), the cpus to pin to as a list (or NULL) and whether it is a
+ *    background job
+ *    Output: the pid of the new process, -1 on failure
+ ***********************************************************************/
+EXTERN pid_t SpawnExec(char*, char**, int*, char*, char*, bool);
+
+/***********************************************************************
+ *  Title: Collect child events
+ * ---------------------------------------------------------------------
+ *    Purpose: Reads all pending exit/stop events from the helper and
+ *    passes them to the event function. May wait for the rest of a
+ *    message that arrived in part, so not for a signal handler.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void SpawnReap();
+
+/***********************************************************************
+ *  Title: Stop the spawn server
+ * ---------------------------------------------------------------------
+ *    Purpose: Closes the connection, which makes the helper exit.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void SpawnStop();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __SPAWN_H__ */
@@ -0,0 +1,391 @@
+/***************************************************************************
+ *  Title: Shell state snapshot
+ * -------------------------------------------------------------------------
+ *    Purpose: Saves aliases, variables and the PATH cache for the next shell
+ *    File: state.c
+ ***************************************************************************/
+#define __STATE_IMPL__
+
+/************System include***********************************************/
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "state.h"
+#include "interpreter.h"
+#include "runtime.h"
+#include "script.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define STATE_PATHLEN 1024
+
+/* section tags */
+#define SEC_ALIASES 'A'  /* count pairs of alias, command */
+#define SEC_VARS    'V'  /* count pairs of name, value */
+#define SEC_PATHS   'P'  /* the value of PATH, then count pairs of name, path */
+
+/*
+ * The snapshot is the header followed by sections. Each section starts
+ * with a stateSecT giving its tag, the number of entries and the size
+ * of its payload, so readers skip sections they do not know. Strings
+ * are a length word followed by the bytes and a '\0', padded to a word.
+ */
+typedef struct state_hdr_t
+{
+  char magic[4];       /* "TSHS" */
+  uint32_t version;    /* STATE_VERSION */
+  uint64_t rcDev;      /* identity of the rc file, all 0 without one */
+  uint64_t rcIno;
+  uint64_t rcMtimeSec;
+  uint64_t rcMtimeNsec;
+  uint64_t rcSize;
+  uint32_t sections;   /* number of sections */
+  uint32_t pad;
+} stateHdrT;
+
+typedef struct state_sec_t
+{
+  uint32_t tag;
+  uint32_t count;
+  uint32_t bytes;      /* size of the payload after this header */
+  uint32_t pad;
+} stateSecT;
+
+/* growable buffer a section is written to */
+typedef struct state_buf_t
+{
+  char* data;
+  size_t len, size;
+  uint32_t count;
+} stateBufT;
+
+/************Global Variables*********************************************/
+
+/* where the snapshot is kept, "" when it is not used */
+static char gSnapshot[STATE_PATHLEN] = "";
+/* the rc file the state was made from */
+static stateHdrT gHdr;
+/* the mapped snapshot, kept for the life of the shell */
+static char* gMap = NULL;
+static size_t gMapLen = 0;
+/* payload of the alias and variable sections to write, NULL if the rc file has to run */
+static char* gAliases = NULL;
+static uint32_t gAliasCount = 0, gAliasBytes = 0;
+static char* gVars = NULL;
+static uint32_t gVarCount = 0, gVarBytes = 0;
+/* number of cached paths in the snapshot on disk */
+static uint32_t gPaths = 0;
+
+/************Function Prototypes******************************************/
+static void put(stateBufT*, const void*, size_t);
+static void putString(stateBufT*, const char*);
+static char* getString(char**);
+static void putPair(char*, char*, void*);
+static bool onlyDefinitions(char*);
+static bool mapSnapshot();
+static void writeSnapshot();
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void LoadState(bool useSnapshot)
+{
+  char dir[STATE_PATHLEN];
+  char rc[STATE_PATHLEN];
+  char* env;
+  struct stat st;
+  bool haveRc = FALSE;
+  stateBufT aliases = { NULL, 0, 0, 0 };
+  stateBufT vars = { NULL, 0, 0, 0 };
+
+  if ((env = getenv("TSH_RC")) != NULL)
+    snprintf(rc, sizeof(rc), "%s", env);
+  else if ((env = getenv("HOME")) != NULL)
+    snprintf(rc, sizeof(rc), "%s/.tshrc", env);
+  else
+    rc[0] = '\0';
+  if (rc[0] != '\0' && stat(rc, &st) == 0)
+    haveRc = TRUE;
+
+  memset(&gHdr, 0, sizeof(gHdr));
+  memcpy(gHdr.magic, "TSHS", 4);
+  gHdr.version = STATE_VERSION;
+  if (haveRc)
+  {
+    gHdr.rcDev = st.st_dev;
+    gHdr.rcIno = st.st_ino;
+    gHdr.rcMtimeSec = st.st_mtim.tv_sec;
+    gHdr.rcMtimeNsec = st.st_mtim.tv_nsec;
+    gHdr.rcSize = st.st_size;
+  }
+
+  if (!useSnapshot || !CacheDir(dir, sizeof(dir)) ||
+      snprintf(gSnapshot, sizeof(gSnapshot), "%s/state", dir) >= sizeof(gSnapshot))
+  {
+    gSnapshot[0] = '\0';
+    if (haveRc)
+      RunScript(rc);
+    return;
+  }
+
+  if (mapSnapshot())
+  {
+    if (gAliases == NULL && haveRc)
+      RunScript(rc);
+    return;
+  }
+
+  /* no usable snapshot: build the state and save it for the next shell */
+  if (haveRc)
+    RunScript(rc);
+  if (!haveRc || onlyDefinitions(rc))
+  {
+    ForEachAlias(putPair, &aliases);
+    gAliases = aliases.data;
+    gAliasCount = aliases.count;
+    gAliasBytes = aliases.len;
+    ForEachVar(putPair, &vars);
+    gVars = vars.data;
+    gVarCount = vars.count;
+    gVarBytes = vars.len;
+  }
+  writeSnapshot();
+}
+
+void SaveState()
+{
+  stateBufT paths = { NULL, 0, 0, 0 };
+
+  if (gSnapshot[0] == '\0')
+    return;
+  ForEachPath(putPair, &paths);
+  free(paths.data);
+  if (paths.count != gPaths)
+    writeSnapshot();
+}
+
+static void put(stateBufT* buf, const void* data, size_t len)
+{
+  if (buf->len + len > buf->size)
+  {
+    buf->size = (buf->len + len) * 2 + 256;
+    buf->data = realloc(buf->data, buf->size);
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+static void putString(stateBufT* buf, const char* s)
+{
+  static const char zero[4] = { 0, 0, 0, 0 };
+  uint32_t len = strlen(s);
+  put(buf, &len, sizeof(len));
+  put(buf, s, len);
+  put(buf, zero, 4 - len % 4);
+}
+
+/*Read a string and advance past it*/
+static char* getString(char** p)
+{
+  uint32_t len = *(uint32_t*)*p;
+  char* s = *p + sizeof(uint32_t);
+  *p = s + len + (4 - len % 4);
+  return s;
+}
+
+/*Add an alias or a cached path to a section*/
+static void putPair(char* name, char* value, void* arg)
+{
+  stateBufT* buf = arg;
+  putString(buf, name);
+  putString(buf, value);
+  buf->count++;
+}
+
+/*Check whether an rc file does nothing but define aliases and variables*/
+static bool onlyDefinitions(char* rc)
+{
+  FILE* f = fopen(rc, "r");
+  char* line = NULL;
+  size_t size = 0;
+  char* c;
+  bool only = TRUE;
+
+  if (f == NULL)
+    return FALSE;
+  while (only && getline(&line, &size, f) != -1)
+  {
+    line[strcspn(line, "\n")] = '\0';
+    for (c = line; *c == ' '; c++);
+    if (*c != '\0' && strncmp(c, "alias ", 6) != 0 && strncmp(c, "unalias ", 8) != 0 &&
+        !IsAssignment(c))
+      only = FALSE;
+  }
+  free(line);
+  fclose(f);
+  return only;
+}
+
+/*Map the snapshot and install its state if it was made from the same rc file*/
+static bool mapSnapshot()
+{
+  int fd;
+  struct stat st;
+  stateHdrT* hdr;
+  stateSecT* sec;
+  char *p, *end, *next, *path, *name;
+  uint32_t i, j;
+
+  fd = open(gSnapshot, O_RDONLY);
+  if (fd == -1)
+    return FALSE;
+  if (fstat(fd, &st) == -1 || st.st_size < sizeof(stateHdrT))
+  {
+    close(fd);
+    return FALSE;
+  }
+  gMap = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (gMap == MAP_FAILED)
+  {
+    gMap = NULL;
+    return FALSE;
+  }
+  gMapLen = st.st_size;
+
+  hdr = (stateHdrT*)gMap;
+  if (memcmp(hdr, &gHdr, offsetof(stateHdrT, sections)) != 0)
+  {
+    munmap(gMap, gMapLen);
+    gMap = NULL;
+    return FALSE;
+  }
+
+  p = gMap + sizeof(stateHdrT);
+  end = gMap + gMapLen;
+  for (i = 0; i < hdr->sections && p + sizeof(stateSecT) <= end; i++)
+  {
+    sec = (stateSecT*)p;
+    p += sizeof(stateSecT);
+    next = p + sec->bytes;
+    if (next > end)
+      break;
+    if (sec->tag == SEC_ALIASES)
+    {
+      gAliases = p;
+      gAliasCount = sec->count;
+      gAliasBytes = sec->bytes;
+      for (j = 0; j < sec->count; j++)
+      {
+        name = getString(&p);
+        DefineAlias(name, getString(&p), TRUE);
+      }
+    }
+    else if (sec->tag == SEC_VARS)
+    {
+      gVars = p;
+      gVarCount = sec->count;
+      gVarBytes = sec->bytes;
+      for (j = 0; j < sec->count; j++)
+      {
+        name = getString(&p);
+        DefineVar(name, getString(&p), TRUE);
+      }
+    }
+    else if (sec->tag == SEC_PATHS)
+    {
+      /* entries found with another PATH are of no use */
+      path = getString(&p);
+      if (getenv("PATH") != NULL && strcmp(path, getenv("PATH")) == 0)
+      {
+        for (j = 0; j < sec->count; j++)
+        {
+          name = getString(&p);
+          RememberPath(name, getString(&p), TRUE);
+        }
+        gPaths = sec->count;
+      }
+    }
+    p = next;
+  }
+  return TRUE;
+}
+
+/*Write the snapshot under a temporary name and move it into place*/
+static void writeSnapshot()
+{
+  char tmp[STATE_PATHLEN + 32];
+  stateBufT out = { NULL, 0, 0, 0 };
+  stateBufT paths = { NULL, 0, 0, 0 };
+  stateSecT sec;
+  stateHdrT hdr = gHdr;
+  int fd;
+  bool ok;
+
+  hdr.sections = 0;
+  put(&out, &hdr, sizeof(hdr));
+  if (gAliases != NULL)
+  {
+    memset(&sec, 0, sizeof(sec));
+    sec.tag = SEC_ALIASES;
+    sec.count = gAliasCount;
+    sec.bytes = gAliasBytes;
+    put(&out, &sec, sizeof(sec));
+    put(&out, gAliases, gAliasBytes);
+    hdr.sections++;
+  }
+  if (gVars != NULL)
+  {
+    memset(&sec, 0, sizeof(sec));
+    sec.tag = SEC_VARS;
+    sec.count = gVarCount;
+    sec.bytes = gVarBytes;
+    put(&out, &sec, sizeof(sec));
+    put(&out, gVars, gVarBytes);
+    hdr.sections++;
+  }
+  if (getenv("PATH") != NULL)
+  {
+    putString(&paths, getenv("PATH"));
+    ForEachPath(putPair, &paths);
+    memset(&sec, 0, sizeof(sec));
+    sec.tag = SEC_PATHS;
+    sec.count = paths.count;
+    sec.bytes = paths.len;
+    put(&out, &sec, sizeof(sec));
+    put(&out, paths.data, paths.len);
+    free(paths.data);
+    hdr.sections++;
+  }
+  memcpy(out.data, &hdr, sizeof(hdr));
+
+  snprintf(tmp, sizeof(tmp), "%s.%d", gSnapshot, (int)getpid());
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1)
+  {
+    free(out.data);
+    return;
+  }
+  ok = write(fd, out.data, out.len) == out.len;
+  close(fd);
+  if (!ok || rename(tmp, gSnapshot) == -1)
+    unlink(tmp);
+  else
+    gPaths = paths.count;
+  free(out.data);
+}
@@ -0,0 +1,69 @@
+/***************************************************************************
+ *  Title: Shell state snapshot
+ * -------------------------------------------------------------------------
+ *    Purpose: Saves aliases, variables and the PATH cache for the next shell
+ *    File: state.h
+ ***************************************************************************/
+
+#ifndef __STATE_H__
+#define __STATE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __STATE_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* bump whenever the layout of the snapshot changes */
+#define STATE_VERSION 1
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Load the shell state
+ * ---------------------------------------------------------------------
+ *    Purpose: Runs the rc file ($TSH_RC, default ~/.tshrc), or maps the
+ *    snapshot in the cache directory instead when it was made from the
+ *    same rc file. Aliases, variables and cached paths are used
+ *    straight from the mapping; a cached path is only checked when a
+ *    command uses it. An rc file that does more than define aliases
+ *    and variables is always run.
+ *    Input: false to ignore the snapshot
+ *    Output: void
+ ***********************************************************************/
+EXTERN void LoadState(bool);
+
+/***********************************************************************
+ *  Title: Save the shell state
+ * ---------------------------------------------------------------------
+ *    Purpose: Rewrites the snapshot when this shell added commands to
+ *    the PATH cache. The aliases and variables saved are those of the
+ *    rc file, not the ones defined interactively.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void SaveState();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __STATE_H__ */
@@ -0,0 +1,89 @@
+/*
+ * batchbench.c - One exec per item against the xbatch builtin of tsh
+ *
+ * usage: batchbench [-n ITEMS] [-P N] TSH
+ * Runs /bin/true over ITEMS items (default 20000), once as one command
+ * line per item and once through "xbatch -P N /bin/true" (default N 1),
+ * and prints the items per second of both.
+ *
+ * Build: make testing-tools
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* feeds a file to the shell on stdin, returns microseconds */
+static double run(char *tsh, char *input)
+{
+    double t0 = now();
+    pid_t pid = fork();
+
+    if (pid == 0) {
+	if (freopen(input, "r", stdin) == NULL)
+	    _exit(127);
+	execl(tsh, tsh, "--no-snapshot", (char *)NULL);
+	_exit(127);
+    }
+    waitpid(pid, NULL, 0);
+    return now() - t0;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, n = 20000, parallel = 1;
+    char items[] = "/tmp/batchbench.items.XXXXXX";
+    char each[] = "/tmp/batchbench.each.XXXXXX";
+    char batch[] = "/tmp/batchbench.batch.XXXXXX";
+    double us;
+    FILE *f;
+
+    while ((c = getopt(argc, argv, "n:P:")) != -1) {
+	if (c == 'n')
+	    n = atoi(optarg);
+	else if (c == 'P')
+	    parallel = atoi(optarg);
+	else
+	    optind = argc + 1;
+    }
+    if (optind != argc - 1 || n <= 0) {
+	fprintf(stderr, "Usage: %s [-n ITEMS] [-P N] TSH\n", argv[0]);
+	exit(1);
+    }
+
+    f = fdopen(mkstemp(items), "w");
+    for (i = 0; i < n; i++)
+	fprintf(f, "/tmp/some/directory/file%d.c\n", i);
+    fclose(f);
+
+    f = fdopen(mkstemp(each), "w");
+    for (i = 0; i < n; i++)
+	fprintf(f, "/bin/true /tmp/some/directory/file%d.c\n", i);
+    fprintf(f, "exit\n");
+    fclose(f);
+
+    f = fdopen(mkstemp(batch), "w");
+    fprintf(f, "xbatch -v -P %d /bin/true < %s\nexit\n", parallel, items);
+    fclose(f);
+
+    setenv("TSH_CACHE_DIR", "", 1);
+    printf("%d items\n", n);
+    us = run(argv[optind], each);
+    printf("one per item %12.0f items/s\n", n / (us / 1e6));
+    us = run(argv[optind], batch);
+    printf("xbatch -P %-3d %12.0f items/s\n", parallel, n / (us / 1e6));
+
+    unlink(items);
+    unlink(each);
+    unlink(batch);
+    exit(0);
+}
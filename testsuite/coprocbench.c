@@ -0,0 +1,141 @@
+/*
+ * coprocbench.c - Queries per second to a helper started once against once per query
+ *
+ * usage: coprocbench [-n QUERIES] TSH
+ * Sends QUERIES (default 200) numbers to a python3 helper that doubles
+ * them, once as "python3 -c PROG < query" for every query and once to
+ * a single "coproc H python3 -u -c PROG", writing each query with
+ * "echo N >&${H[1]}" and reading the answer with "read R <&${H[0]}".
+ * Prints the queries per second of both. The answers are checked
+ * first.
+ *
+ * Build: make testing-tools
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PROG "\"import sys; [print(int(l) * 2) for l in sys.stdin]\""
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* feeds a file to the shell on stdin with stdout going to output, returns microseconds */
+static double run(char *tsh, char *input, char *output)
+{
+    double t0;
+    pid_t pid;
+
+    fflush(stdout);
+    t0 = now();
+    pid = fork();
+
+    if (pid == 0) {
+	if (freopen(input, "r", stdin) == NULL || freopen(output, "w", stdout) == NULL)
+	    _exit(127);
+	execl(tsh, tsh, "--no-snapshot", (char *)NULL);
+	_exit(127);
+    }
+    waitpid(pid, NULL, 0);
+    return now() - t0;
+}
+
+/* a script of n queries, to a coprocess or to a new helper each time */
+static void script(char *path, char *query, int n, int coproc)
+{
+    FILE *f = fopen(path, "w");
+    int i;
+
+    if (coproc)
+	fprintf(f, "coproc H python3 -u -c %s\n", PROG);
+    for (i = 0; i < n; i++) {
+	if (coproc) {
+	    fprintf(f, "echo %d >&${H[1]}\n", i);
+	    fprintf(f, "read R <&${H[0]}\n");
+	    fprintf(f, "echo $R\n");
+	} else
+	    fprintf(f, "python3 -c %s < %s\n", PROG, query);
+    }
+    fprintf(f, "exit\n");
+    fclose(f);
+}
+
+/* the answer of every query, in order */
+static int answers(char *output, int n, int coproc)
+{
+    FILE *f = fopen(output, "r");
+    char line[256];
+    int i = 0;
+
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+	if (line[0] < '0' || line[0] > '9')
+	    continue;
+	if (atoi(line) != (coproc ? i : 21) * 2)
+	    break;
+	i++;
+    }
+    if (f != NULL)
+	fclose(f);
+    return i == n;
+}
+
+int main(int argc, char **argv)
+{
+    int c, n = 200;
+    char in[] = "/tmp/coprocbench.in.XXXXXX";
+    char out[] = "/tmp/coprocbench.out.XXXXXX";
+    char query[] = "/tmp/coprocbench.query.XXXXXX";
+    double fresh, coproc;
+    FILE *f;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+	if (c == 'n')
+	    n = atoi(optarg);
+	else
+	    optind = argc + 1;
+    }
+    if (optind != argc - 1 || n <= 0) {
+	fprintf(stderr, "Usage: %s [-n QUERIES] TSH\n", argv[0]);
+	exit(1);
+    }
+    f = fdopen(mkstemp(query), "w");
+    fprintf(f, "21\n");
+    fclose(f);
+    close(mkstemp(in));
+    close(mkstemp(out));
+    setenv("TSH_CACHE_DIR", "", 1);
+
+    script(in, query, 3, 0);
+    run(argv[optind], in, out);
+    if (!answers(out, 3, 0)) {
+	fprintf(stderr, "%s: wrong answers from a new helper, see %s (is python3 on PATH?)\n", argv[0], out);
+	exit(1);
+    }
+    script(in, query, 3, 1);
+    run(argv[optind], in, out);
+    if (!answers(out, 3, 1)) {
+	fprintf(stderr, "%s: wrong answers from the coprocess, see %s\n", argv[0], out);
+	exit(1);
+    }
+
+    printf("%d queries\n", n);
+    script(in, query, n, 0);
+    fresh = run(argv[optind], in, "/dev/null");
+    printf("helper per query %10.0f queries/s\n", n / (fresh / 1e6));
+    script(in, query, n, 1);
+    coproc = run(argv[optind], in, "/dev/null");
+    printf("coproc           %10.0f queries/s\n", n / (coproc / 1e6));
+    printf("%.1fx\n", fresh / coproc);
+
+    unlink(in);
+    unlink(out);
+    unlink(query);
+    exit(0);
+}
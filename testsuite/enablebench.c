@@ -0,0 +1,124 @@
+/*
+ * enablebench.c - Calls per second of a loaded builtin against the program
+ *
+ * usage: enablebench [-n CALLS] TSH CKSUM_SO
+ * Runs CALLS (default 5000) "cksum FILE" lines in tsh, once with the
+ * cksum builtin loaded from CKSUM_SO ("make" builds tools/cksum.so)
+ * and once with the cksum program on PATH, and prints the calls per
+ * second of both. The output of the two is compared first.
+ *
+ * Build: make testing-tools
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* feeds a file to the shell on stdin with stdout going to output, returns microseconds */
+static double run(char *tsh, char *input, char *output)
+{
+    double t0;
+    pid_t pid;
+
+    /* or the child writes it out again */
+    fflush(stdout);
+    t0 = now();
+    pid = fork();
+
+    if (pid == 0) {
+	if (freopen(input, "r", stdin) == NULL || freopen(output, "w", stdout) == NULL)
+	    _exit(127);
+	execl(tsh, tsh, "--no-snapshot", (char *)NULL);
+	_exit(127);
+    }
+    waitpid(pid, NULL, 0);
+    return now() - t0;
+}
+
+/* a script of n calls, loading the builtin first when so is not NULL */
+static void script(char *path, char *so, char *file, int n)
+{
+    FILE *f = fopen(path, "w");
+    int i;
+
+    if (so != NULL)
+	fprintf(f, "enable -f %s cksum\n", so);
+    for (i = 0; i < n; i++)
+	fprintf(f, "cksum %s\n", file);
+    fprintf(f, "exit\n");
+    fclose(f);
+}
+
+static int same(char *a, char *b)
+{
+    char x[4096], y[4096];
+    FILE *f = fopen(a, "r"), *g = fopen(b, "r");
+    size_t n = fread(x, 1, sizeof(x), f), m = fread(y, 1, sizeof(y), g);
+
+    fclose(f);
+    fclose(g);
+    return n == m && n > 0 && memcmp(x, y, n) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, n = 5000;
+    char data[] = "/tmp/enablebench.data.XXXXXX";
+    char in[] = "/tmp/enablebench.in.XXXXXX";
+    char out[] = "/tmp/enablebench.out.XXXXXX";
+    char out2[] = "/tmp/enablebench.out2.XXXXXX";
+    double loaded, external;
+    FILE *f;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+	if (c == 'n')
+	    n = atoi(optarg);
+	else
+	    optind = argc + 1;
+    }
+    if (optind != argc - 2 || n <= 0) {
+	fprintf(stderr, "Usage: %s [-n CALLS] TSH CKSUM_SO\n", argv[0]);
+	exit(1);
+    }
+    f = fdopen(mkstemp(data), "w");
+    for (i = 0; i < 100; i++)
+	fprintf(f, "line %d of the file the benchmark checksums\n", i);
+    fclose(f);
+    close(mkstemp(in));
+    close(mkstemp(out));
+    close(mkstemp(out2));
+    setenv("TSH_CACHE_DIR", "", 1);
+
+    script(in, argv[optind + 1], data, 1);
+    run(argv[optind], in, out);
+    script(in, NULL, data, 1);
+    run(argv[optind], in, out2);
+    if (!same(out, out2)) {
+	fprintf(stderr, "%s: the builtin and the program disagree, see %s and %s\n", argv[0], out, out2);
+	exit(1);
+    }
+
+    printf("%d calls\n", n);
+    script(in, argv[optind + 1], data, n);
+    loaded = run(argv[optind], in, "/dev/null");
+    printf("loaded builtin %12.0f calls/s\n", n / (loaded / 1e6));
+    script(in, NULL, data, n);
+    external = run(argv[optind], in, "/dev/null");
+    printf("program        %12.0f calls/s\n", n / (external / 1e6));
+    printf("%.1fx\n", external / loaded);
+
+    unlink(data);
+    unlink(in);
+    unlink(out);
+    unlink(out2);
+    exit(0);
+}
@@ -0,0 +1,88 @@
+/*
+ * loopbench.c - Loop iterations per second of tsh
+ *
+ * usage: loopbench [-n ITERATIONS] TSH
+ * Runs ITERATIONS (default 100000) calls of the builtin "true", once as
+ * two nested for loops read from stdin and once as unrolled lines, and
+ * prints the iterations per second of both.
+ *
+ * Build: make testing-tools
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* feeds a file to the shell on stdin, returns microseconds */
+static double run(char *tsh, char *input)
+{
+    double t0 = now();
+    pid_t pid = fork();
+
+    if (pid == 0) {
+	if (freopen(input, "r", stdin) == NULL)
+	    _exit(127);
+	execl(tsh, tsh, "--no-snapshot", (char *)NULL);
+	_exit(127);
+    }
+    waitpid(pid, NULL, 0);
+    return now() - t0;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, n = 100000, outer, inner = 100;
+    char loop[] = "/tmp/loopbench.loop.XXXXXX";
+    char flat[] = "/tmp/loopbench.flat.XXXXXX";
+    double us;
+    FILE *f;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+	if (c == 'n')
+	    n = atoi(optarg);
+	else
+	    optind = argc + 1;
+    }
+    if (optind != argc - 1 || n < inner) {
+	fprintf(stderr, "Usage: %s [-n ITERATIONS] TSH\n", argv[0]);
+	exit(1);
+    }
+    outer = n / inner;
+    n = outer * inner;
+
+    f = fdopen(mkstemp(loop), "w");
+    fprintf(f, "for i in");
+    for (i = 0; i < outer; i++)
+	fprintf(f, " %d", i);
+    fprintf(f, "\ndo\n  for j in");
+    for (i = 0; i < inner; i++)
+	fprintf(f, " %d", i);
+    fprintf(f, "\n  do\n    true\n  done\ndone\nexit\n");
+    fclose(f);
+
+    f = fdopen(mkstemp(flat), "w");
+    for (i = 0; i < n; i++)
+	fprintf(f, "true\n");
+    fprintf(f, "exit\n");
+    fclose(f);
+
+    setenv("TSH_CACHE_DIR", "", 1);
+    printf("%d iterations\n", n);
+    us = run(argv[optind], loop);
+    printf("for loop       %12.0f iterations/s\n", n / (us / 1e6));
+    us = run(argv[optind], flat);
+    printf("unrolled lines %12.0f iterations/s\n", n / (us / 1e6));
+
+    unlink(loop);
+    unlink(flat);
+    exit(0);
+}
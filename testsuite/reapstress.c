@@ -0,0 +1,314 @@
+/*
+ * reapstress.c - SIGCHLD storm against the job table of tsh
+ *
+ * usage: reapstress [-n JOBS] [-s MS] TSH
+ * Feeds tsh JOBS (default 2000) background jobs as fast as it reads
+ * them. Every job is this program again: it logs its start, sleeps up to
+ * MS milliseconds (default 20), logs its exit and exits with 0 or 1.
+ * Meanwhile a monitor stops and continues every 10th job, kills every
+ * 7th, and watches /proc to see when tsh reaps each one.
+ *
+ * It checks that every job was reaped, and reported Done exactly once,
+ * then prints the exit-to-reap latency percentiles, the highest job
+ * number tsh handed out and the most children alive at once. The exit
+ * status is 1 if a job was lost or reported twice.
+ *
+ * Build: make testing-tools
+ */
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TIMEOUT_NS (60 * 1000000000LL)
+
+/* what the monitor knows about a job */
+struct job {
+    pid_t pid;
+    unsigned long long starttime;  /* field 22 of /proc/PID/stat, tells reused pids apart */
+    long long exited;              /* ns, 0 while it runs */
+    long long reaped;              /* ns, 0 until tsh reaped it */
+    long long stopped;             /* ns of the SIGSTOP still to be undone, 0 for none */
+};
+
+static long long now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* start time of a process, 0 if it is gone */
+static unsigned long long starttime(pid_t pid)
+{
+    char path[64], buf[1024], *p;
+    unsigned long long start = 0;
+    int fd, n, field;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if ((fd = open(path, O_RDONLY)) == -1)
+	return 0;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+	return 0;
+    buf[n] = '\0';
+    /* the command name may hold spaces, count from the closing paren */
+    if ((p = strrchr(buf, ')')) == NULL)
+	return 0;
+    for (field = 2; field < 22 && p != NULL; field++)
+	p = strchr(p + 1, ' ');
+    if (p != NULL)
+	sscanf(p + 1, "%llu", &start);
+    return start;
+}
+
+/* a line of the log, written in one piece so that jobs do not mix them up */
+static void logLine(char *log, char kind, int id, long long t)
+{
+    char line[128];
+    int fd = open(log, O_WRONLY | O_APPEND);
+
+    if (fd == -1)
+	return;
+    snprintf(line, sizeof(line), "%c %d %d %llu %lld\n", kind, id, (int)getpid(),
+	     kind == 'S' ? starttime(getpid()) : 0ULL, t);
+    if (write(fd, line, strlen(line)) < 0)
+	perror("write");
+    close(fd);
+}
+
+/* job mode: reapstress -c ID MS LOG */
+static int job(int id, int ms, char *log)
+{
+    struct timespec ts;
+
+    logLine(log, 'S', id, now());
+    ms = ms == 0 ? 0 : (id * 7919) % (ms + 1);
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+    logLine(log, 'E', id, now());
+    return id % 5 == 0;
+}
+
+/* waiter mode, run by tsh in the foreground: reapstress -w LOG */
+static int waiter(char *log)
+{
+    char buf[4096];
+    int fd, n;
+
+    for (;;) {
+	if ((fd = open(log, O_RDONLY)) == -1)
+	    return 1;
+	/* the monitor ends the log with a D line */
+	if (lseek(fd, -2, SEEK_END) != -1 && (n = read(fd, buf, 2)) == 2 &&
+	    buf[0] == 'D') {
+	    close(fd);
+	    return 0;
+	}
+	close(fd);
+	usleep(10000);
+    }
+}
+
+static int cmpLongLong(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* the monitor: signals jobs and times their reaping, prints the results */
+static int monitor(int n, char *log)
+{
+    struct job *jobs = calloc(n, sizeof(struct job));
+    long long *latency = malloc(sizeof(long long) * n);
+    int *watch = malloc(sizeof(int) * n);  /* jobs started and not reaped yet */
+    int nwatch = 0;
+    long long start = now(), t;
+    char buf[65536], *line, *nl;
+    char kind;
+    int fd, got, len = 0, id, pid, c, i, reaped = 0, alive = 0, maxAlive = 0;
+    int stops = 0, kills = 0, unreaped;
+    unsigned long long st;
+    long long stamp;
+    FILE *f;
+
+    fd = open(log, O_RDONLY);
+    while (reaped < n && now() - start < TIMEOUT_NS) {
+	/* new lines of the log */
+	got = read(fd, buf + len, sizeof(buf) - 1 - len);
+	if (got > 0)
+	    len += got;
+	buf[len] = '\0';
+	for (line = buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+	    *nl = '\0';
+	    if (sscanf(line, "%c %d %d %llu %lld", &kind, &id, &pid, &st, &stamp) != 5 ||
+		id < 0 || id >= n)
+		continue;
+	    if (kind == 'S') {
+		jobs[id].pid = pid;
+		jobs[id].starttime = st;
+		watch[nwatch++] = id;
+		alive++;
+		if (alive > maxAlive)
+		    maxAlive = alive;
+		/* a job that is already gone may have left its pid to another process */
+		if (starttime(pid) != st)
+		    continue;
+		if (id % 7 == 6) {
+		    kill(pid, SIGKILL);
+		    jobs[id].exited = now();
+		    kills++;
+		} else if (id % 10 == 3) {
+		    kill(pid, SIGSTOP);
+		    jobs[id].stopped = now();
+		    stops++;
+		}
+	    } else if (kind == 'E' && jobs[id].exited == 0)
+		jobs[id].exited = stamp;
+	}
+	len -= line - buf;
+	memmove(buf, line, len);
+	/* polling flat out would take the cpu tsh needs to reap */
+	if (got <= 0)
+	    usleep(100);
+
+	/* continue what was stopped a while ago, see what tsh reaped */
+	t = now();
+	for (c = 0; c < nwatch; c++) {
+	    i = watch[c];
+	    if (jobs[i].stopped != 0 && t - jobs[i].stopped > 5000000) {
+		kill(jobs[i].pid, SIGCONT);
+		jobs[i].stopped = 0;
+	    }
+	    if (jobs[i].exited != 0 && starttime(jobs[i].pid) != jobs[i].starttime) {
+		jobs[i].reaped = t;
+		latency[reaped++] = t - jobs[i].exited;
+		alive--;
+		watch[c--] = watch[--nwatch];
+	    }
+	}
+    }
+    close(fd);
+
+    unreaped = n - reaped;
+    for (i = 0; i < n && unreaped > 0; i++)
+	if (jobs[i].reaped == 0)
+	    fprintf(stderr, "job %d (pid %d) was never reaped\n", i, (int)jobs[i].pid);
+    printf("%d jobs, %d stopped and continued, %d killed, %.2fs\n", n, stops, kills,
+	   (now() - start) / 1e9);
+    printf("not reaped: %d\n", unreaped);
+    if (reaped > 0) {
+	qsort(latency, reaped, sizeof(long long), cmpLongLong);
+	printf("exit-to-reap latency: p50 %.3fms  p95 %.3fms  p99 %.3fms  max %.3fms\n",
+	       latency[reaped / 2] / 1e6, latency[reaped * 95 / 100] / 1e6,
+	       latency[reaped * 99 / 100] / 1e6, latency[reaped - 1] / 1e6);
+    }
+    printf("children alive at once: %d\n", maxAlive);
+    fflush(stdout);
+
+    /* let the waiter in tsh go */
+    if ((f = fopen(log, "a")) != NULL) {
+	fprintf(f, "D\n");
+	fclose(f);
+    }
+    free(jobs);
+    free(latency);
+    free(watch);
+    return unreaped != 0;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, n = 2000, ms = 20, status, once = 0, twice = 0, never = 0, left = 0;
+    int maxJob = 0, jobNumber, failed;
+    char log[] = "/tmp/reapstress.log.XXXXXX";
+    char script[] = "/tmp/reapstress.in.XXXXXX";
+    char out[] = "/tmp/reapstress.out.XXXXXX";
+    char self[4096], line[4096], *p;
+    int *reported;
+    pid_t mon, tsh;
+    FILE *f;
+
+    if (argc == 5 && strcmp(argv[1], "-c") == 0)
+	return job(atoi(argv[2]), atoi(argv[3]), argv[4]);
+    if (argc == 3 && strcmp(argv[1], "-w") == 0)
+	return waiter(argv[2]);
+
+    while ((c = getopt(argc, argv, "n:s:")) != -1) {
+	if (c == 'n')
+	    n = atoi(optarg);
+	else if (c == 's')
+	    ms = atoi(optarg);
+	else
+	    optind = argc + 1;
+    }
+    if (optind != argc - 1 || n <= 0 || ms < 0) {
+	fprintf(stderr, "Usage: %s [-n JOBS] [-s MS] TSH\n", argv[0]);
+	exit(1);
+    }
+    if (realpath("/proc/self/exe", self) == NULL) {
+	perror("realpath");
+	exit(1);
+    }
+
+    close(mkstemp(log));
+    f = fdopen(mkstemp(script), "w");
+    for (i = 0; i < n; i++)
+	fprintf(f, "%s -c %d %d %s &\n", self, i, ms, log);
+    fprintf(f, "%s -w %s\njobs\nexit\n", self, log);
+    fclose(f);
+    close(mkstemp(out));
+
+    mon = fork();
+    if (mon == 0)
+	_exit(monitor(n, log));
+    tsh = fork();
+    if (tsh == 0) {
+	if (freopen(script, "r", stdin) == NULL || freopen(out, "w", stdout) == NULL)
+	    _exit(127);
+	setenv("TSH_CACHE_DIR", "", 1);
+	execl(argv[optind], argv[optind], "--no-snapshot", (char *)NULL);
+	_exit(127);
+    }
+    waitpid(tsh, NULL, 0);
+    waitpid(mon, &status, 0);
+    failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+
+    /* every job must be reported Done once, and none may be left in the table */
+    reported = calloc(n, sizeof(int));
+    f = fopen(out, "r");
+    while (fgets(line, sizeof(line), f) != NULL) {
+	if ((p = strstr(line, " -c ")) == NULL || sscanf(p + 4, "%d", &i) != 1 || i < 0 || i >= n)
+	    continue;
+	if (strstr(line, "Done") != NULL) {
+	    reported[i]++;
+	    if (sscanf(line, "[%d]", &jobNumber) == 1 && jobNumber > maxJob)
+		maxJob = jobNumber;
+	} else
+	    left++;
+    }
+    fclose(f);
+    for (i = 0; i < n; i++) {
+	if (reported[i] == 1)
+	    once++;
+	else if (reported[i] == 0)
+	    never++;
+	else
+	    twice++;
+    }
+    printf("reported done: %d once, %d more than once, %d never, %d still listed\n",
+	   once, twice, never, left);
+    printf("highest job number: %d\n", maxJob);
+
+    unlink(log);
+    unlink(script);
+    unlink(out);
+    free(reported);
+    exit(failed || twice != 0 || never != 0 || left != 0);
+}
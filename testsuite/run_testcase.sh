@@ -60,7 +60,7 @@ for SRC in ${SRCDIR}/*.c; do
 	echo "-----" >> ${OUTPUT}/gcc.output;
 done
 echo "LINKING";
-gcc	*.o -o ${TMP}/${BIN} >> ${OUTPUT}/gcc.output 2>&1;
+gcc	*.o -o ${TMP}/${BIN} -ldl >> ${OUTPUT}/gcc.output 2>&1;
 WARNING=`grep -c warning ${OUTPUT}/gcc.output`
 ERROR=`grep -c error ${OUTPUT}/gcc.output`
 
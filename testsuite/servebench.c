@@ -0,0 +1,164 @@
+/*
+ * servebench.c - Load generator for tsh --serve
+ *
+ * usage: servebench -s SOCKET [-c CLIENTS] [-n LINES] [-i IDLE] [-x LINE]
+ * Opens IDLE connections that never send anything, then has CLIENTS
+ * connections each submit LINES command lines (default "/bin/true"),
+ * one at a time, and reports throughput and latency percentiles.
+ *
+ * Build: make testing-tools
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct {
+    int fd;
+    int sent;		/* lines sent */
+    int skip;		/* output bytes of the current frame still to skip */
+    double start;	/* when the current line was sent */
+    char buf[4096];
+    int len;
+} conn_t;
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static int cmp(const void *a, const void *b)
+{
+    double x = *(double *)a, y = *(double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int dial(char *path)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+	perror(path);
+	exit(1);
+    }
+    return fd;
+}
+
+/* consumes frames, returns 1 when a "$ status" frame completed the line */
+static int parse(conn_t *c)
+{
+    char *nl;
+    int used, done = 0;
+
+    while (c->len > 0) {
+	if (c->skip > 0) {
+	    used = c->skip < c->len ? c->skip : c->len;
+	    c->skip -= used;
+	} else {
+	    nl = memchr(c->buf, '\n', c->len);
+	    if (nl == NULL)
+		break;
+	    used = nl - c->buf + 1;
+	    if (c->buf[0] == '$')
+		done = 1;
+	    else
+		c->skip = atoi(c->buf + 2);
+	}
+	memmove(c->buf, c->buf + used, c->len - used);
+	c->len -= used;
+    }
+    return done;
+}
+
+int main(int argc, char **argv)
+{
+    char *path = NULL, *line = "/bin/true";
+    int clients = 8, lines = 100, idle = 0;
+    int i, c, n, active, total, *idlefds;
+    double *lat, start, wall;
+    conn_t *conns;
+    struct pollfd *pfd;
+    char msg[4096];
+
+    while ((c = getopt(argc, argv, "s:c:n:i:x:")) != -1) {
+	switch (c) {
+	case 's': path = optarg; break;
+	case 'c': clients = atoi(optarg); break;
+	case 'n': lines = atoi(optarg); break;
+	case 'i': idle = atoi(optarg); break;
+	case 'x': line = optarg; break;
+	default: path = NULL; optind = argc; break;
+	}
+    }
+    if (path == NULL) {
+	fprintf(stderr, "Usage: %s -s SOCKET [-c CLIENTS] [-n LINES] [-i IDLE] [-x LINE]\n", argv[0]);
+	exit(1);
+    }
+    snprintf(msg, sizeof(msg), "%s\n", line);
+
+    idlefds = malloc(sizeof(int) * (idle + 1));
+    for (i = 0; i < idle; i++)
+	idlefds[i] = dial(path);
+
+    conns = calloc(clients, sizeof(conn_t));
+    pfd = calloc(clients, sizeof(struct pollfd));
+    lat = malloc(sizeof(double) * clients * lines);
+    total = 0;
+    start = now();
+    for (i = 0; i < clients; i++) {
+	conns[i].fd = dial(path);
+	conns[i].start = now();
+	write(conns[i].fd, msg, strlen(msg));
+	conns[i].sent = 1;
+	pfd[i].fd = conns[i].fd;
+	pfd[i].events = POLLIN;
+    }
+
+    active = clients;
+    while (active > 0) {
+	poll(pfd, clients, -1);
+	for (i = 0; i < clients; i++) {
+	    conn_t *k = &conns[i];
+	    if (!(pfd[i].revents & (POLLIN | POLLHUP)))
+		continue;
+	    n = read(k->fd, k->buf + k->len, sizeof(k->buf) - k->len);
+	    if (n <= 0) {
+		fprintf(stderr, "connection %d closed early\n", i);
+		exit(1);
+	    }
+	    k->len += n;
+	    if (!parse(k))
+		continue;
+	    lat[total++] = now() - k->start;
+	    if (k->sent == lines) {
+		close(k->fd);
+		pfd[i].fd = -1;
+		active--;
+		continue;
+	    }
+	    k->start = now();
+	    write(k->fd, msg, strlen(msg));
+	    k->sent++;
+	}
+    }
+    wall = now() - start;
+
+    qsort(lat, total, sizeof(double), cmp);
+    printf("%d lines over %d clients (%d idle connections)\n", total, clients, idle);
+    printf("throughput %10.1f lines/s\n", total / (wall / 1e6));
+    printf("latency us   p50 %.0f   p95 %.0f   p99 %.0f   max %.0f\n",
+	   lat[total / 2], lat[total * 95 / 100], lat[total * 99 / 100], lat[total - 1]);
+    for (i = 0; i < idle; i++)
+	close(idlefds[i]);
+    exit(0);
+}
@@ -0,0 +1,108 @@
+/*
+ * spawnbench.c - Launch latency with and without the spawn server
+ *
+ * usage: spawnbench [-m MB] [-n N]
+ * Grows the heap to MB megabytes (default 1024), then launches
+ * /bin/true N times (default 200) with fork+execv+waitpid and N times
+ * through the spawn server that was started while the process was
+ * still small, and prints the mean latency of both.
+ *
+ * Build: make testing-tools
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "spawn.h"
+
+static volatile int reaped = 0;
+
+static void event(pid_t pid, int status)
+{
+    reaped++;
+}
+
+static void sigchld(int signo)
+{
+    SpawnReap();
+}
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+int main(int argc, char **argv)
+{
+    int i, c, n = 200, mb = 1024;
+    int fds[3] = { 0, 1, 2 };
+    char *args[] = { "/bin/true", NULL };
+    char *heap;
+    double start, forkus, spawnus;
+    sigset_t chld, old;
+    pid_t pid;
+
+    while ((c = getopt(argc, argv, "m:n:")) != -1) {
+	if (c == 'm')
+	    mb = atoi(optarg);
+	else if (c == 'n')
+	    n = atoi(optarg);
+	else {
+	    fprintf(stderr, "Usage: %s [-m MB] [-n N]\n", argv[0]);
+	    exit(1);
+	}
+    }
+
+    /* the helper is forked while we are small, like tsh --spawn-server */
+    signal(SIGCHLD, sigchld);
+    if (!SpawnStart(event)) {
+	fprintf(stderr, "spawn server not available\n");
+	exit(1);
+    }
+
+    /* touch every page so fork has to copy the page tables */
+    heap = malloc((size_t)mb << 20);
+    memset(heap, 1, (size_t)mb << 20);
+
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+
+    start = now();
+    for (i = 0; i < n; i++) {
+	sigprocmask(SIG_BLOCK, &chld, &old);
+	pid = fork();
+	if (pid == 0) {
+	    execv(args[0], args);
+	    _exit(127);
+	}
+	waitpid(pid, NULL, 0);
+	sigprocmask(SIG_SETMASK, &old, NULL);
+    }
+    forkus = (now() - start) / n;
+
+    start = now();
+    for (i = 0; i < n; i++) {
+	sigprocmask(SIG_BLOCK, &chld, &old);
+	if (SpawnExec(args[0], args, fds, NULL, -1, 0) == -1) {
+	    fprintf(stderr, "spawn failed\n");
+	    exit(1);
+	}
+	while (reaped <= i)
+	    sigsuspend(&old);
+	sigprocmask(SIG_SETMASK, &old, NULL);
+    }
+    spawnus = (now() - start) / n;
+
+    printf("heap %d MB, %d launches\n", mb, n);
+    printf("fork+exec     %10.1f us/launch\n", forkus);
+    printf("spawn server  %10.1f us/launch\n", spawnus);
+    free(heap);
+    SpawnStop();
+    exit(0);
+}
@@ -0,0 +1,113 @@
+/*
+ * startbench.c - Shell startup time with and without the state snapshot
+ *
+ * usage: startbench [-a ALIASES] [-n RUNS] TSH
+ * Writes an rc file defining ALIASES aliases (default 5000), then
+ * starts TSH RUNS times (default 50) with --no-snapshot and RUNS times
+ * with a warm snapshot, and prints the mean and median time from exec
+ * until the shell has handled its first line ("exit") and gone away.
+ *
+ * Build: make testing-tools
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static int cmp(const void *a, const void *b)
+{
+    double x = *(double *)a, y = *(double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* one start of the shell, returns microseconds */
+static double start(char *tsh, int snapshot)
+{
+    int fds[2];
+    double t0;
+    pid_t pid;
+
+    pipe(fds);
+    t0 = now();
+    pid = fork();
+    if (pid == 0) {
+	dup2(fds[0], 0);
+	close(fds[0]);
+	close(fds[1]);
+	if (snapshot)
+	    execl(tsh, tsh, (char *)NULL);
+	else
+	    execl(tsh, tsh, "--no-snapshot", (char *)NULL);
+	_exit(127);
+    }
+    close(fds[0]);
+    write(fds[1], "exit\n", 5);
+    close(fds[1]);
+    waitpid(pid, NULL, 0);
+    return now() - t0;
+}
+
+static void report(char *what, double *t, int n)
+{
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+	sum += t[i];
+    qsort(t, n, sizeof(double), cmp);
+    printf("%-14s mean %8.0f us   median %8.0f us\n", what, sum / n, t[n / 2]);
+}
+
+int main(int argc, char **argv)
+{
+    int i, c, aliases = 5000, runs = 50;
+    char dir[] = "/tmp/startbench.XXXXXX";
+    char rc[64], cmd[128];
+    double *t;
+    FILE *f;
+
+    while ((c = getopt(argc, argv, "a:n:")) != -1) {
+	if (c == 'a')
+	    aliases = atoi(optarg);
+	else if (c == 'n')
+	    runs = atoi(optarg);
+	else
+	    optind = argc + 1;
+    }
+    if (optind != argc - 1 || mkdtemp(dir) == NULL) {
+	fprintf(stderr, "Usage: %s [-a ALIASES] [-n RUNS] TSH\n", argv[0]);
+	exit(1);
+    }
+
+    snprintf(rc, sizeof(rc), "%s/tshrc", dir);
+    f = fopen(rc, "w");
+    for (i = 0; i < aliases; i++)
+	fprintf(f, "alias a%d='/bin/echo %d'\n", i, i);
+    fclose(f);
+    setenv("TSH_RC", rc, 1);
+    setenv("TSH_CACHE_DIR", dir, 1);
+
+    t = malloc(sizeof(double) * runs);
+    printf("%d aliases, %d runs\n", aliases, runs);
+    for (i = 0; i < runs; i++)
+	t[i] = start(argv[optind], 0);
+    report("rc file", t, runs);
+
+    start(argv[optind], 1);	/* writes the snapshot */
+    for (i = 0; i < runs; i++)
+	t[i] = start(argv[optind], 1);
+    report("snapshot", t, runs);
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    system(cmd);
+    exit(0);
+}
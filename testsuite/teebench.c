@@ -0,0 +1,134 @@
+/*
+ * teebench.c - Throughput of cmd > a > b against cmd | tee a > b
+ *
+ * usage: teebench [-s MB] [-d DIR] TSH
+ * Writes MB megabytes (default 2048) to two files in DIR (default /tmp),
+ * once with "GEN > a > b" in tsh, where the shell copies the output in
+ * the kernel, and once with "GEN | tee a > b" in /bin/sh, and prints the
+ * GB/s of both. GEN is teebench itself writing zeros a megabyte at a
+ * time, so that the producer is not what is measured. The size of the
+ * files is checked after each run.
+ *
+ * Build: make testing-tools
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHUNK (1 << 20)
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* the generator: mb megabytes of zeros on stdout */
+static int generate(long mb)
+{
+    static char buf[CHUNK];
+    char *p;
+    ssize_t n, left;
+
+    for (; mb > 0; mb--)
+	for (p = buf, left = CHUNK; left > 0; p += n, left -= n)
+	    if ((n = write(STDOUT_FILENO, p, left)) <= 0)
+		return 1;
+    return 0;
+}
+
+/* runs argv with stdin from input, returns microseconds */
+static double run(char **argv, char *input)
+{
+    double t0;
+    pid_t pid;
+
+    fflush(stdout);
+    t0 = now();
+    pid = fork();
+
+    if (pid == 0) {
+	if (input != NULL && freopen(input, "r", stdin) == NULL)
+	    _exit(127);
+	execv(argv[0], argv);
+	_exit(127);
+    }
+    waitpid(pid, NULL, 0);
+    return now() - t0;
+}
+
+static int sized(char *file, long mb)
+{
+    struct stat st;
+
+    return stat(file, &st) == 0 && st.st_size == (off_t)mb * CHUNK;
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    long mb = 2048;
+    char *dir = "/tmp", self[PATH_MAX], a[PATH_MAX], b[PATH_MAX], line[4 * PATH_MAX];
+    char in[] = "/tmp/teebench.in.XXXXXX";
+    char *tsh[] = { NULL, "--no-snapshot", NULL };
+    char *sh[] = { "/bin/sh", "-c", line, NULL };
+    double fanout, tee;
+    FILE *f;
+
+    if (argc == 3 && strcmp(argv[1], "-g") == 0)
+	return generate(atol(argv[2]));
+    while ((c = getopt(argc, argv, "s:d:")) != -1) {
+	if (c == 's')
+	    mb = atol(optarg);
+	else if (c == 'd')
+	    dir = optarg;
+	else
+	    optind = argc + 1;
+    }
+    if (optind != argc - 1 || mb <= 0) {
+	fprintf(stderr, "Usage: %s [-s MB] [-d DIR] TSH\n", argv[0]);
+	exit(1);
+    }
+    if (realpath(argv[0], self) == NULL) {
+	perror(argv[0]);
+	exit(1);
+    }
+    snprintf(a, sizeof(a), "%s/teebench.a.%d", dir, (int)getpid());
+    snprintf(b, sizeof(b), "%s/teebench.b.%d", dir, (int)getpid());
+    close(mkstemp(in));
+    setenv("TSH_CACHE_DIR", "", 1);
+    tsh[0] = argv[optind];
+
+    printf("%ld MB to 2 files\n", mb);
+    f = fopen(in, "w");
+    fprintf(f, "%s -g %ld > %s > %s\nexit\n", self, mb, a, b);
+    fclose(f);
+    fanout = run(tsh, in);
+    if (!sized(a, mb) || !sized(b, mb)) {
+	fprintf(stderr, "%s: tsh wrote the wrong size, see %s and %s\n", argv[0], a, b);
+	exit(1);
+    }
+    printf("> a > b   %8.2f GB/s\n", mb / 1024.0 / (fanout / 1e6));
+    unlink(a);
+    unlink(b);
+
+    snprintf(line, sizeof(line), "%s -g %ld | tee %s > %s", self, mb, a, b);
+    tee = run(sh, NULL);
+    if (!sized(a, mb) || !sized(b, mb)) {
+	fprintf(stderr, "%s: tee wrote the wrong size, see %s and %s\n", argv[0], a, b);
+	exit(1);
+    }
+    printf("| tee a > b %6.2f GB/s\n", mb / 1024.0 / (tee / 1e6));
+    printf("%.1fx\n", tee / fanout);
+
+    unlink(a);
+    unlink(b);
+    unlink(in);
+    exit(0);
+}
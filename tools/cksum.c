@@ -0,0 +1,96 @@
+/*
+ * cksum.c - POSIX cksum as a builtin loaded with "enable -f"
+ *
+ * usage: enable -f tools/cksum.so cksum
+ *        cksum [FILE...]
+ * Prints the CRC, the size and the name of every FILE, or of stdin
+ * without a name, like cksum(1), but without a fork and exec. See
+ * tshbuiltin.h for what a loadable builtin may and may not do.
+ *
+ * Build: make
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tshbuiltin.h"
+
+static uint32_t table[256];
+
+static void makeTable()
+{
+    uint32_t c;
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+	c = (uint32_t)i << 24;
+	for (j = 0; j < 8; j++)
+	    c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : c << 1;
+	table[i] = c;
+    }
+}
+
+/* CRC and size of what can be read from fd, -1 on a read error */
+static int crc(int fd, uint32_t *sum, long long *size)
+{
+    unsigned char buf[65536];
+    uint32_t c = 0;
+    long long n = 0, len;
+    ssize_t got;
+    int i;
+
+    while ((got = read(fd, buf, sizeof(buf))) != 0) {
+	if (got == -1) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	for (i = 0; i < got; i++)
+	    c = (c << 8) ^ table[(c >> 24) ^ buf[i]];
+	n += got;
+    }
+    /* the length goes in too, least significant byte first */
+    for (len = n; len != 0; len >>= 8)
+	c = (c << 8) ^ table[(c >> 24) ^ (len & 0xff)];
+    *sum = ~c;
+    *size = n;
+    return 0;
+}
+
+static int run(int argc, char **argv, int in, int out, int err)
+{
+    char line[4352];
+    uint32_t sum;
+    long long size;
+    int i, fd, n, status = 0;
+
+    if (table[1] == 0)
+	makeTable();
+    if (argc == 1) {
+	if (crc(in, &sum, &size) == -1) {
+	    dprintf(err, "cksum: -: %s\n", strerror(errno));
+	    return 1;
+	}
+	n = snprintf(line, sizeof(line), "%u %lld\n", sum, size);
+	return write(out, line, n) == n ? 0 : 1;
+    }
+    for (i = 1; i < argc; i++) {
+	if ((fd = open(argv[i], O_RDONLY | O_CLOEXEC)) == -1 || crc(fd, &sum, &size) == -1) {
+	    dprintf(err, "cksum: %s: %s\n", argv[i], strerror(errno));
+	    if (fd != -1)
+		close(fd);
+	    status = 1;
+	    continue;
+	}
+	close(fd);
+	n = snprintf(line, sizeof(line), "%u %lld %.4096s\n", sum, size, argv[i]);
+	if (write(out, line, n) != n)
+	    status = 1;
+    }
+    return status;
+}
+
+tshBuiltinT cksum_builtin = { TSH_BUILTIN_ABI, "cksum", run, "cksum [FILE...]" };
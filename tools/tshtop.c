@@ -0,0 +1,270 @@
+/*
+ * tshtop.c - The jobs of every tsh on the host
+ *
+ * usage: tshtop [-n COUNT] [-i MS]
+ * Shows the job table each shell publishes in /dev/shm, refreshed
+ * every MS milliseconds (default 100) until ctrl-c, or COUNT times.
+ * Reading a table never makes a shell wait (see jobshm.h); the tables
+ * of shells that were killed are removed. CPU time and memory of
+ * running jobs come from /proc, those of finished jobs from what the
+ * shell reaped; CPU% is over the last refresh.
+ *
+ * Build: make
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jobshm.h"
+
+#define MAXSHELLS 256
+#define MAXSAMPLES 4096
+#define RESCAN 10          /* refreshes between looks at /dev/shm for new shells */
+
+/* a mapped table */
+struct shell {
+    char name[64];
+    const jobShmT *map;
+};
+
+/* CPU time of a job at the last refresh */
+struct sample {
+    pid_t pid;
+    long long cpu;         /* us */
+    long long at;          /* ns */
+    int seen;              /* refresh it was last seen in */
+};
+
+static struct shell shells[MAXSHELLS];
+static int nshells = 0;
+static struct sample samples[MAXSAMPLES];
+static int nsamples = 0;
+static long ticks, pagekb;
+
+static long long now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* map the tables of shells that started since the last scan, drop those that are gone */
+static void scan()
+{
+    DIR *dir = opendir(JOBSHM_DIR);
+    struct dirent *d;
+    char path[320];
+    struct stat st;
+    void *map;
+    int fd, i;
+
+    for (i = 0; i < nshells; i++) {
+	snprintf(path, sizeof(path), "%s/%s", JOBSHM_DIR, shells[i].name);
+	if (access(path, F_OK) == -1) {
+	    munmap((void *)shells[i].map, sizeof(jobShmT));
+	    shells[i--] = shells[--nshells];
+	}
+    }
+    if (dir == NULL)
+	return;
+    while ((d = readdir(dir)) != NULL && nshells < MAXSHELLS) {
+	if (strncmp(d->d_name, JOBSHM_PREFIX, strlen(JOBSHM_PREFIX)) != 0 ||
+	    strlen(d->d_name) >= sizeof(shells[0].name))
+	    continue;
+	for (i = 0; i < nshells && strcmp(shells[i].name, d->d_name) != 0; i++);
+	if (i < nshells)
+	    continue;
+	snprintf(path, sizeof(path), "%s/%s", JOBSHM_DIR, d->d_name);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+	    continue;
+	map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= sizeof(jobShmT))
+	    map = mmap(NULL, sizeof(jobShmT), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	    continue;
+	snprintf(shells[nshells].name, sizeof(shells[0].name), "%s", d->d_name);
+	shells[nshells++].map = map;
+    }
+    closedir(dir);
+}
+
+/* CPU time (us) and resident memory (kB) of a running process, 0 if it is gone */
+static int procStat(pid_t pid, long long *cpu, long long *rss)
+{
+    char path[64], buf[1024], *p;
+    unsigned long utime, stime;
+    long pages;
+    int fd, n;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if ((fd = open(path, O_RDONLY)) == -1)
+	return 0;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+	return 0;
+    buf[n] = '\0';
+    /* fields 14, 15 and 24, counted from the end of the command name */
+    if ((p = strrchr(buf, ')')) == NULL ||
+	sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+	       &utime, &stime, &pages) != 3)
+	return 0;
+    *cpu = (utime + stime) * 1000000LL / ticks;
+    *rss = pages * pagekb;
+    return 1;
+}
+
+/* CPU% of a job since the last refresh, -1 the first time it is seen */
+static double cpuPercent(pid_t pid, long long cpu, long long t, int refresh)
+{
+    double pct = -1;
+    int i;
+
+    for (i = 0; i < nsamples && samples[i].pid != pid; i++);
+    if (i < nsamples) {
+	if (t > samples[i].at)
+	    pct = (cpu - samples[i].cpu) * 1e5 / (t - samples[i].at);
+    } else if (nsamples < MAXSAMPLES)
+	nsamples++;
+    else
+	return -1;
+    samples[i].pid = pid;
+    samples[i].cpu = cpu;
+    samples[i].at = t;
+    samples[i].seen = refresh;
+    return pct;
+}
+
+static void duration(char *buf, size_t size, long long us)
+{
+    long long s = us / 1000000;
+
+    if (s < 60)
+	snprintf(buf, size, "%lld.%01llds", s, us / 100000 % 10);
+    else if (s < 3600)
+	snprintf(buf, size, "%lld:%02lld", s / 60, s % 60);
+    else
+	snprintf(buf, size, "%lld:%02lld:%02lld", s / 3600, s / 60 % 60, s % 60);
+}
+
+static void memory(char *buf, size_t size, long long kb)
+{
+    if (kb < 10240)
+	snprintf(buf, size, "%lldK", kb);
+    else if (kb < 10240 * 1024)
+	snprintf(buf, size, "%lldM", kb / 1024);
+    else
+	snprintf(buf, size, "%lldG", kb / 1024 / 1024);
+}
+
+static void show(int refresh, int clear)
+{
+    static jobShmT table;
+    const jobShmJobT *job;
+    char up[32], elapsed[32], cpuTime[32], rss[32], state[16], pct[16], number[16], path[320];
+    long long t = now(), cpu, kb;
+    double p;
+    int i, j, live = 0, njobs = 0;
+
+    if (clear)
+	printf("\033[H\033[2J");
+    for (i = 0; i < nshells; i++) {
+	if (!JobShmRead(shells[i].map, &table))
+	    continue;
+	/* a shell that was killed leaves its table behind, the next scan forgets it */
+	if (kill(table.pid, 0) == -1 && errno == ESRCH) {
+	    snprintf(path, sizeof(path), "%s/%.63s", JOBSHM_DIR, shells[i].name);
+	    unlink(path);
+	    continue;
+	}
+	live++;
+	njobs += table.njobs;
+	duration(up, sizeof(up), (t - table.started) / 1000);
+	printf("tsh %d%s%s, up %s, %d job%s\n", (int)table.pid, table.tty[0] != '\0' ? " on " : "",
+	       table.tty, up, table.njobs + table.more, table.njobs + table.more == 1 ? "" : "s");
+	if (table.njobs == 0)
+	    continue;
+	printf("  %5s %7s %-8s %9s %9s %6s %6s  %s\n", "JOB", "PID", "STATE", "ELAPSED", "CPU", "CPU%",
+	       "RSS", "COMMAND");
+	for (j = 0; j < table.njobs; j++) {
+	    job = &table.jobs[j];
+	    if (job->status == 'D') {
+		cpu = job->utime + job->stime;
+		kb = job->maxrss;
+		duration(elapsed, sizeof(elapsed), (job->ended - job->started) / 1000);
+		snprintf(state, sizeof(state), job->exitStatus == 0 ? "Done" : "Exit %d", job->exitStatus);
+		snprintf(pct, sizeof(pct), "-");
+	    } else {
+		if (!procStat(job->pid, &cpu, &kb))
+		    cpu = kb = 0;
+		duration(elapsed, sizeof(elapsed), (t - job->started) / 1000);
+		snprintf(state, sizeof(state), job->status == 'S' ? "Stopped" : "Running");
+		p = cpuPercent(job->pid, cpu, t, refresh);
+		if (p < 0)
+		    snprintf(pct, sizeof(pct), "-");
+		else
+		    snprintf(pct, sizeof(pct), "%.1f", p);
+	    }
+	    duration(cpuTime, sizeof(cpuTime), cpu);
+	    memory(rss, sizeof(rss), kb);
+	    if (job->jobNumber == 0)
+		snprintf(number, sizeof(number), "fg");
+	    else
+		snprintf(number, sizeof(number), "[%d]", job->jobNumber);
+	    printf("  %5s %7d %-8s %9s %9s %6s %6s  %s\n", number, (int)job->pid, state, elapsed,
+		   cpuTime, pct, rss, job->command);
+	}
+	if (table.more > 0)
+	    printf("  ... %d more\n", table.more);
+    }
+    printf("%d shell%s, %d job%s\n", live, live == 1 ? "" : "s", njobs, njobs == 1 ? "" : "s");
+    if (!clear)
+	printf("\n");
+    fflush(stdout);
+
+    /* forget jobs that are gone */
+    for (i = 0; i < nsamples; i++)
+	if (refresh - samples[i].seen > RESCAN)
+	    samples[i--] = samples[--nsamples];
+}
+
+int main(int argc, char **argv)
+{
+    int c, refresh, count = -1, ms = 100, clear = isatty(1);
+    struct timespec ts;
+
+    while ((c = getopt(argc, argv, "n:i:")) != -1) {
+	if (c == 'n')
+	    count = atoi(optarg);
+	else if (c == 'i')
+	    ms = atoi(optarg);
+	else
+	    optind = argc + 1;
+    }
+    if (optind != argc || ms <= 0) {
+	fprintf(stderr, "Usage: %s [-n COUNT] [-i MS]\n", argv[0]);
+	exit(1);
+    }
+    ticks = sysconf(_SC_CLK_TCK);
+    pagekb = sysconf(_SC_PAGESIZE) / 1024;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+
+    for (refresh = 0; count < 0 || refresh < count; refresh++) {
+	if (refresh % RESCAN == 0)
+	    scan();
+	show(refresh, clear);
+	if (count < 0 || refresh + 1 < count)
+	    nanosleep(&ts, NULL);
+    }
+    exit(0);
+}
@@ -29,6 +29,7 @@
  *
  ***************************************************************************/
 #define __MYSS_IMPL__
+#define __PROBES_IMPL__
 
 /************System include***********************************************/
 #include <stdlib.h>
@@ -40,6 +41,11 @@
 #include "io.h"
 #include "interpreter.h"
 #include "runtime.h"
+#include "script.h"
+#include "server.h"
+#include "state.h"
+#include "jobshm.h"
+#include "probes.h"
  #include <stdio.h>
 
 /************Defines and Typedefs*****************************************/
@@ -56,6 +62,8 @@
 /************Function Prototypes******************************************/
 /* handles SIGINT and SIGSTOP signals */	
 static void sig(int);
+/* removes the job table before SIGTERM, SIGHUP or SIGQUIT ends the shell */
+static void fatal(int);
 
 /************External Declaration*****************************************/
 
@@ -63,12 +71,71 @@ static void sig(int);
 
 int main (int argc, char *argv[])
 {
+  int i;
+  size_t len;
+  char* servePath = NULL;
+  char* scriptPath = NULL;
+  int maxJobs = SERVER_MAXJOBS;
+  bool useSnapshot = TRUE;
+
+  /* command line options; the spawn server is forked first, while the shell is still small */
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--spawn-server") == 0)
+    {
+      if (!StartSpawnServer()) PrintPError("spawn server");
+    }
+    else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+      servePath = argv[++i];
+    else if (strcmp(argv[i], "--max-jobs") == 0 && i + 1 < argc)
+      maxJobs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--no-snapshot") == 0)
+      useSnapshot = FALSE;
+    else if (argv[i][0] != '-' && scriptPath == NULL)
+      scriptPath = argv[i];
+    else
+    {
+      fprintf(stderr, "usage: %s [--spawn-server] [--no-snapshot] [--serve SOCKET [--max-jobs N]] [SCRIPT]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  /* the job table tshtop reads */
+  JobShmOpen();
+  InstallHandler(SIGTERM, fatal);
+  InstallHandler(SIGHUP, fatal);
+  InstallHandler(SIGQUIT, fatal);
+
+  /* aliases and the PATH cache, from the snapshot or the rc file */
+  LoadState(useSnapshot);
+
+  /* command server mode never reads stdin */
+  if (servePath != NULL)
+  {
+    i = ServeCommands(servePath, maxJobs);
+    JobShmClose();
+    return i;
+  }
+
   /* Initialize command buffer */
   char* cmdLine = malloc(sizeof(char*)*BUFSIZE);
+  char* moreLine = malloc(sizeof(char*)*BUFSIZE);
 
   /* shell initialization */
-  if (signal(SIGINT, sig) == SIG_ERR) PrintPError("SIGINT");
-  if (signal(SIGTSTP, sig) == SIG_ERR) PrintPError("SIGTSTP");
+  if (!InstallHandler(SIGINT, sig)) PrintPError("SIGINT");
+  if (!InstallHandler(SIGTSTP, sig)) PrintPError("SIGTSTP");
+  InitJobControl();
+
+  /* a script runs from its cached parse instead of the read loop */
+  if (scriptPath != NULL)
+  {
+    free(cmdLine);
+    free(moreLine);
+    i = RunScript(scriptPath);
+    cleanExit();
+    SaveState();
+    return i;
+  }
 
   while (!forceExit) /* repeat forever */
   {
@@ -76,6 +143,17 @@ int main (int argc, char *argv[])
     /* read command line */
     getCommandLine(&cmdLine, BUFSIZE);
 
+    /* an open if/while/for goes on on the next lines */
+    while (IsIncomplete(cmdLine) && !feof(stdin))
+    {
+      getCommandLine(&moreLine, BUFSIZE);
+      //the next getCommandLine() takes the buffer to hold BUFSIZE characters at least
+      len = strlen(cmdLine) + strlen(moreLine) + 2;
+      cmdLine = realloc(cmdLine, len > BUFSIZE + 1 ? len : BUFSIZE + 1);
+      strcat(cmdLine, "\n");
+      strcat(cmdLine, moreLine);
+    }
+
     if(strcmp(cmdLine, "exit") == 0)
     {
       cleanExit();
@@ -93,15 +171,25 @@ int main (int argc, char *argv[])
   }
 
   /* shell termination */
+  SaveState();
   free(cmdLine);
+  free(moreLine);
   return 0;
 } /* end main */
 
 static void sig(int signo)
 {
   //If the user pressed ctrl-c (sigint)
-  if (signo == 2) killFgProc();
+  if (signo == SIGINT) killFgProc();
   //If the user pressed ctrl-z (sigtstp)
-  if (signo == 20) stopFgProc();
+  if (signo == SIGTSTP) stopFgProc();
+}
+
+static void fatal(int signo)
+{
+  JobShmUnlink();
+  //Die of the signal as before, it is delivered once the handler returns
+  signal(signo, SIG_DFL);
+  raise(signo);
 }
 
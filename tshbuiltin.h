@@ -0,0 +1,40 @@
+/***************************************************************************
+ *  Title: Loadable builtin interface
+ * -------------------------------------------------------------------------
+ *    Purpose: What a shared object loaded with "enable -f" provides
+ *    File: tshbuiltin.h
+ ***************************************************************************/
+
+#ifndef __TSHBUILTIN_H__
+#define __TSHBUILTIN_H__
+
+/************Defines and Typedefs*****************************************/
+
+/* bump whenever tshBuiltinT or the rules below change */
+#define TSH_BUILTIN_ABI 1
+
+/*
+ * A shared object provides a builtin NAME by defining
+ *
+ *   tshBuiltinT NAME_builtin = { TSH_BUILTIN_ABI, "NAME", run, "NAME [args...]" };
+ *
+ * "enable -f lib.so NAME" loads it, and from then on the shell calls
+ * run(argc, argv, in, out, err) in its own process instead of starting
+ * a program. The builtin reads from in and writes to out and err,
+ * descriptors the shell owns: it must not close them or write to
+ * stdout with stdio. Its return value is the exit status (0 to 255).
+ * The shell resets getopt() before every call. Since nothing is left
+ * behind by a process exiting, a builtin must not exit(), must free
+ * what it allocates and close what it opens, and must leave signals
+ * alone. It cannot be interrupted: anything long should run as a
+ * background job ("NAME args &"), which runs it in a subshell.
+ */
+typedef struct tsh_builtin_t
+{
+  int abi;              /* TSH_BUILTIN_ABI it was built against */
+  const char* name;
+  int (*run)(int argc, char** argv, int in, int out, int err);
+  const char* usage;    /* one line, shown by "enable" */
+} tshBuiltinT;
+
+#endif /* __TSHBUILTIN_H__ */